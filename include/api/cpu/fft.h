@@ -0,0 +1,79 @@
+#ifndef __CPU_FFT_H_GUARD
+#define __CPU_FFT_H_GUARD
+
+#include <complex>
+#include <vector>
+
+#include <api/math.h>
+#include <util/thread_pool.h>
+
+namespace cpu {
+namespace fft {
+
+typedef std::complex<math::real> complex;
+
+// Precomputed tables of a backward complex transform of a power of two length.
+struct fft_plan {
+    explicit fft_plan(int length);
+
+    int length;
+    bool has_radix2_stage; // For odd powers of two.
+    std::vector<int> bit_reverse;
+    std::vector<complex> twiddles; // Three arrays per radix-4 stage.
+};
+
+// How the column pass of ifft2d_hermitian_inplace reaches the columns, which
+// are a whole row apart in memory.
+enum column_pass {
+    COLUMN_PASS_BLOCKED, // Gathers blocks of adjacent columns; the butterflies
+                         // run across the block.
+    COLUMN_PASS_TRANSPOSED // Transposes strips of columns into contiguous
+                           // rows, transforms them and transposes back.
+};
+
+// Host counterpart of gpu::fft::ifft2d_hermitian_inplace. Uses the same
+// memory layout: each batch holds size.y rows of size.x / 2 + 1 complex
+// coefficients, which are overwritten by size.y rows of size.x real samples
+// with a row stride of size.x + 2 reals. The transform is unnormalized.
+// Both dimensions have to be powers of two.
+//
+// The columns of the half spectrum are transformed first, see column_pass,
+// then each row is turned into real samples with a complex transform of half
+// the row length.
+class ifft2d_hermitian_inplace {
+public:
+    ifft2d_hermitian_inplace(
+        util::thread_pool &pool,
+        const math::ivec2 &size,
+        size_t num_batches,
+        column_pass pass = COLUMN_PASS_BLOCKED);
+    ifft2d_hermitian_inplace(const ifft2d_hermitian_inplace &) = delete;
+    ifft2d_hermitian_inplace &operator=(const ifft2d_hermitian_inplace &) = delete;
+
+    void transform(math::real *buffer);
+
+    column_pass get_column_pass() const { return pass; }
+
+private:
+    void transform_columns(complex *batch, int first_column, int num_columns, complex *scratch);
+    void transform_columns_transposed(
+        complex *batch,
+        int first_column,
+        int num_columns,
+        complex *scratch);
+    void transform_row(math::real *row);
+
+    util::thread_pool &pool;
+    math::ivec2 size;
+    size_t num_batches;
+    column_pass pass;
+
+    fft_plan row_plan; // size.x / 2 points.
+    fft_plan column_plan; // size.y points.
+    std::vector<complex> row_twiddles; // exp(+i*2*pi*k/size.x), k < size.x / 2.
+};
+
+} // namespace fft
+} // namespace cpu
+
+#endif // !__CPU_FFT_H_GUARD
@@ -0,0 +1,38 @@
+#ifndef __SIMD_H_GUARD
+#define __SIMD_H_GUARD
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CPU_SIMD_X86 1
+#include <immintrin.h>
+#else
+#define CPU_SIMD_X86 0
+#endif
+
+// Functions using wider instruction sets than the build baseline are tagged
+// with these and only called after checking get_instruction_set().
+#if defined(__GNUC__) || defined(__clang__)
+#define CPU_SIMD_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define CPU_SIMD_TARGET_AVX512 __attribute__((target("avx512f,avx2,fma")))
+#else
+#define CPU_SIMD_TARGET_AVX2
+#define CPU_SIMD_TARGET_AVX512
+#endif
+
+namespace cpu {
+namespace simd {
+
+enum instruction_set {
+    INSTRUCTION_SET_SCALAR = 0,
+    INSTRUCTION_SET_AVX2 = 1, // AVX2 + FMA
+    INSTRUCTION_SET_AVX512 = 2 // AVX-512F
+};
+
+// Widest instruction set supported by both the CPU and the OS. The
+// OCEAN_SIMD environment variable (scalar, avx2 or avx512) can lower it.
+instruction_set get_instruction_set();
+const char *get_instruction_set_name(instruction_set set);
+
+} // namespace simd
+} // namespace cpu
+
+#endif // !__SIMD_H_GUARD
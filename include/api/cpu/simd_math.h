@@ -0,0 +1,257 @@
+#ifndef __SIMD_MATH_H_GUARD
+#define __SIMD_MATH_H_GUARD
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include <api/cpu/simd.h>
+
+namespace cpu {
+namespace simd {
+
+// Polynomial approximations of elementary functions in single precision. The
+// vector versions evaluate the same polynomials as the scalar ones, so results
+// only differ by the rounding of fused multiply-adds.
+
+namespace detail {
+
+// sin/cos: reduce to [-pi/4, pi/4] by a multiple q of pi/2 (pi/2 split in
+// three parts so q * pi/2 is exact), then Taylor polynomials, then fix up
+// by the quadrant. Max. error is around 1e-6 for arguments up to a few
+// hundred.
+constexpr float two_over_pi = 0.636619772367581343f;
+constexpr float pio2_hi = 1.5703125f;
+constexpr float pio2_mid = 4.837512969970703125e-4f;
+constexpr float pio2_lo = 7.54978995489188216e-8f;
+constexpr float sin_c3 = -1.0f / 6.0f;
+constexpr float sin_c5 = 1.0f / 120.0f;
+constexpr float sin_c7 = -1.0f / 5040.0f;
+constexpr float cos_c2 = -1.0f / 2.0f;
+constexpr float cos_c4 = 1.0f / 24.0f;
+constexpr float cos_c6 = -1.0f / 720.0f;
+constexpr float cos_c8 = 1.0f / 40320.0f;
+
+// exp: x = n * ln(2) + r with |r| <= ln(2) / 2, a degree 6 polynomial for
+// e^r (Cephes expf), then scaling by 2^n through the exponent bits. Arguments
+// below exp_min give zero rather than denormals, which are slow to compute
+// with; arguments above exp_max are clamped. Max. relative error is around
+// 2e-7.
+constexpr float exp_min = -87.0f;
+constexpr float exp_max = 88.0f;
+constexpr float log2e = 1.44269504088896341f;
+constexpr float ln2_hi = 0.693359375f;
+constexpr float ln2_lo = -2.12194440e-4f;
+constexpr float exp_c2 = 5.0000001201e-1f;
+constexpr float exp_c3 = 1.6666665459e-1f;
+constexpr float exp_c4 = 4.1665795894e-2f;
+constexpr float exp_c5 = 8.3334519073e-3f;
+constexpr float exp_c6 = 1.3981999507e-3f;
+constexpr float exp_c7 = 1.9875691500e-4f;
+
+// log: x = m * 2^e with m in [sqrt(1/2), sqrt(2)), then a polynomial in
+// m - 1 (Cephes logf). Only for positive normal numbers. Max. relative error
+// is around 2e-7.
+constexpr float sqrt_half = 0.707106781186547524f;
+constexpr float log_c3 = 3.3333331174e-1f;
+constexpr float log_c4 = -2.4999993993e-1f;
+constexpr float log_c5 = 2.0000714765e-1f;
+constexpr float log_c6 = -1.6668057665e-1f;
+constexpr float log_c7 = 1.4249322787e-1f;
+constexpr float log_c8 = -1.2420140846e-1f;
+constexpr float log_c9 = 1.1676998740e-1f;
+constexpr float log_c10 = -1.1514610310e-1f;
+constexpr float log_c11 = 7.0376836292e-2f;
+
+inline float bits_to_float(uint32_t x)
+{
+    float f;
+    std::memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+inline uint32_t float_to_bits(float f)
+{
+    uint32_t x;
+    std::memcpy(&x, &f, sizeof(x));
+    return x;
+}
+
+} // namespace detail
+
+inline void sincos_poly(float x, float &s, float &c)
+{
+    using namespace detail;
+    float q = std::floor(x * two_over_pi + 0.5f);
+    int qi = int(q);
+    float r = ((x - q * pio2_hi) - q * pio2_mid) - q * pio2_lo;
+    float r2 = r * r;
+    float sr = r + r * r2 * (sin_c3 + r2 * (sin_c5 + r2 * sin_c7));
+    float cr = 1.0f + r2 * (cos_c2 + r2 * (cos_c4 + r2 * (cos_c6 + r2 * cos_c8)));
+    s = (qi & 1) ? cr : sr;
+    c = (qi & 1) ? sr : cr;
+    if (qi & 2)
+        s = -s;
+    if ((qi + 1) & 2)
+        c = -c;
+}
+
+inline float exp_poly(float x)
+{
+    using namespace detail;
+    if (x < exp_min)
+        return 0.0f;
+    x = std::fmin(x, exp_max);
+    const float n = std::floor(x * log2e + 0.5f);
+    const float r = (x - n * ln2_hi) - n * ln2_lo;
+    float p = exp_c6 + r * exp_c7;
+    p = exp_c5 + r * p;
+    p = exp_c4 + r * p;
+    p = exp_c3 + r * p;
+    p = exp_c2 + r * p;
+    p = (p * r) * r + r + 1.0f;
+    return p * bits_to_float(uint32_t(int(n) + 127) << 23);
+}
+
+inline float log_poly(float x)
+{
+    using namespace detail;
+    const uint32_t bits = float_to_bits(x);
+    float e = float(int((bits >> 23) & 0xff) - 126);
+    float m = bits_to_float((bits & 0x807fffff) | 0x3f000000); // In [1/2, 1).
+    float f;
+    if (m < sqrt_half) {
+        e -= 1.0f;
+        f = (m + m) - 1.0f;
+    } else {
+        f = m - 1.0f;
+    }
+    const float f2 = f * f;
+    float p = log_c10 + f * log_c11;
+    p = log_c9 + f * p;
+    p = log_c8 + f * p;
+    p = log_c7 + f * p;
+    p = log_c6 + f * p;
+    p = log_c5 + f * p;
+    p = log_c4 + f * p;
+    p = log_c3 + f * p;
+    float y = (p * f) * f2;
+    y = e * ln2_lo + y;
+    y = -0.5f * f2 + y;
+    return (f + y) + e * ln2_hi;
+}
+
+#if CPU_SIMD_X86
+
+CPU_SIMD_TARGET_AVX2 inline void sincos_avx2(__m256 x, __m256 &s, __m256 &c)
+{
+    using namespace detail;
+    const __m256i one_i = _mm256_set1_epi32(1), two_i = _mm256_set1_epi32(2);
+    __m256 q = _mm256_round_ps(
+        _mm256_mul_ps(x, _mm256_set1_ps(two_over_pi)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256i qi = _mm256_cvtps_epi32(q);
+    __m256 r = _mm256_fnmadd_ps(q, _mm256_set1_ps(pio2_hi), x);
+    r = _mm256_fnmadd_ps(q, _mm256_set1_ps(pio2_mid), r);
+    r = _mm256_fnmadd_ps(q, _mm256_set1_ps(pio2_lo), r);
+    __m256 r2 = _mm256_mul_ps(r, r);
+
+    __m256 sr = _mm256_fmadd_ps(r2, _mm256_set1_ps(sin_c7), _mm256_set1_ps(sin_c5));
+    sr = _mm256_fmadd_ps(sr, r2, _mm256_set1_ps(sin_c3));
+    sr = _mm256_fmadd_ps(_mm256_mul_ps(sr, r2), r, r);
+    __m256 cr = _mm256_fmadd_ps(r2, _mm256_set1_ps(cos_c8), _mm256_set1_ps(cos_c6));
+    cr = _mm256_fmadd_ps(cr, r2, _mm256_set1_ps(cos_c4));
+    cr = _mm256_fmadd_ps(cr, r2, _mm256_set1_ps(cos_c2));
+    cr = _mm256_fmadd_ps(cr, r2, _mm256_set1_ps(1.0f));
+
+    __m256 swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(qi, one_i), one_i));
+    __m256 sin_sign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(qi, two_i), 30));
+    __m256 cos_sign = _mm256_castsi256_ps(
+        _mm256_slli_epi32(_mm256_and_si256(_mm256_add_epi32(qi, one_i), two_i), 30));
+    s = _mm256_xor_ps(_mm256_blendv_ps(sr, cr, swap), sin_sign);
+    c = _mm256_xor_ps(_mm256_blendv_ps(cr, sr, swap), cos_sign);
+}
+
+CPU_SIMD_TARGET_AVX2 inline __m256 exp_avx2(__m256 x)
+{
+    using namespace detail;
+    const __m256 in_range = _mm256_cmp_ps(x, _mm256_set1_ps(exp_min), _CMP_GE_OQ);
+    x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(exp_min)), _mm256_set1_ps(exp_max));
+    const __m256 n = _mm256_floor_ps(
+        _mm256_fmadd_ps(x, _mm256_set1_ps(log2e), _mm256_set1_ps(0.5f)));
+    __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(ln2_hi), x);
+    r = _mm256_fnmadd_ps(n, _mm256_set1_ps(ln2_lo), r);
+    __m256 p = _mm256_fmadd_ps(r, _mm256_set1_ps(exp_c7), _mm256_set1_ps(exp_c6));
+    p = _mm256_fmadd_ps(r, p, _mm256_set1_ps(exp_c5));
+    p = _mm256_fmadd_ps(r, p, _mm256_set1_ps(exp_c4));
+    p = _mm256_fmadd_ps(r, p, _mm256_set1_ps(exp_c3));
+    p = _mm256_fmadd_ps(r, p, _mm256_set1_ps(exp_c2));
+    p = _mm256_fmadd_ps(_mm256_mul_ps(p, r), r, _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+    const __m256i scale =
+        _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+    return _mm256_and_ps(_mm256_mul_ps(p, _mm256_castsi256_ps(scale)), in_range);
+}
+
+CPU_SIMD_TARGET_AVX2 inline __m256 log_avx2(__m256 x)
+{
+    using namespace detail;
+    const __m256i bits = _mm256_castps_si256(x);
+    __m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(
+        _mm256_and_si256(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(0xff)),
+        _mm256_set1_epi32(126)));
+    const __m256 m = _mm256_castsi256_ps(_mm256_or_si256(
+        _mm256_and_si256(bits, _mm256_set1_epi32(int(0x807fffff))),
+        _mm256_set1_epi32(0x3f000000)));
+    const __m256 small = _mm256_cmp_ps(m, _mm256_set1_ps(sqrt_half), _CMP_LT_OQ);
+    e = _mm256_sub_ps(e, _mm256_and_ps(small, _mm256_set1_ps(1.0f)));
+    const __m256 f = _mm256_sub_ps(_mm256_add_ps(m, _mm256_and_ps(small, m)), _mm256_set1_ps(1.0f));
+
+    const __m256 f2 = _mm256_mul_ps(f, f);
+    __m256 p = _mm256_fmadd_ps(f, _mm256_set1_ps(log_c11), _mm256_set1_ps(log_c10));
+    p = _mm256_fmadd_ps(f, p, _mm256_set1_ps(log_c9));
+    p = _mm256_fmadd_ps(f, p, _mm256_set1_ps(log_c8));
+    p = _mm256_fmadd_ps(f, p, _mm256_set1_ps(log_c7));
+    p = _mm256_fmadd_ps(f, p, _mm256_set1_ps(log_c6));
+    p = _mm256_fmadd_ps(f, p, _mm256_set1_ps(log_c5));
+    p = _mm256_fmadd_ps(f, p, _mm256_set1_ps(log_c4));
+    p = _mm256_fmadd_ps(f, p, _mm256_set1_ps(log_c3));
+    __m256 y = _mm256_mul_ps(_mm256_mul_ps(p, f), f2);
+    y = _mm256_fmadd_ps(e, _mm256_set1_ps(ln2_lo), y);
+    y = _mm256_fmadd_ps(_mm256_set1_ps(-0.5f), f2, y);
+    return _mm256_fmadd_ps(e, _mm256_set1_ps(ln2_hi), _mm256_add_ps(f, y));
+}
+
+CPU_SIMD_TARGET_AVX512 inline void sincos_avx512(__m512 x, __m512 &s, __m512 &c)
+{
+    using namespace detail;
+    const __m512i one_i = _mm512_set1_epi32(1), two_i = _mm512_set1_epi32(2);
+    __m512 q = _mm512_roundscale_ps(
+        _mm512_mul_ps(x, _mm512_set1_ps(two_over_pi)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m512i qi = _mm512_cvtps_epi32(q);
+    __m512 r = _mm512_fnmadd_ps(q, _mm512_set1_ps(pio2_hi), x);
+    r = _mm512_fnmadd_ps(q, _mm512_set1_ps(pio2_mid), r);
+    r = _mm512_fnmadd_ps(q, _mm512_set1_ps(pio2_lo), r);
+    __m512 r2 = _mm512_mul_ps(r, r);
+
+    __m512 sr = _mm512_fmadd_ps(r2, _mm512_set1_ps(sin_c7), _mm512_set1_ps(sin_c5));
+    sr = _mm512_fmadd_ps(sr, r2, _mm512_set1_ps(sin_c3));
+    sr = _mm512_fmadd_ps(_mm512_mul_ps(sr, r2), r, r);
+    __m512 cr = _mm512_fmadd_ps(r2, _mm512_set1_ps(cos_c8), _mm512_set1_ps(cos_c6));
+    cr = _mm512_fmadd_ps(cr, r2, _mm512_set1_ps(cos_c4));
+    cr = _mm512_fmadd_ps(cr, r2, _mm512_set1_ps(cos_c2));
+    cr = _mm512_fmadd_ps(cr, r2, _mm512_set1_ps(1.0f));
+
+    __mmask16 swap = _mm512_test_epi32_mask(qi, one_i);
+    __m512i sin_sign = _mm512_slli_epi32(_mm512_and_si512(qi, two_i), 30);
+    __m512i cos_sign = _mm512_slli_epi32(_mm512_and_si512(_mm512_add_epi32(qi, one_i), two_i), 30);
+    s = _mm512_castsi512_ps(
+        _mm512_xor_si512(_mm512_castps_si512(_mm512_mask_blend_ps(swap, sr, cr)), sin_sign));
+    c = _mm512_castsi512_ps(
+        _mm512_xor_si512(_mm512_castps_si512(_mm512_mask_blend_ps(swap, cr, sr)), cos_sign));
+}
+
+#endif // CPU_SIMD_X86
+
+} // namespace simd
+} // namespace cpu
+
+#endif // !__SIMD_MATH_H_GUARD
@@ -2,17 +2,19 @@
 #define __COMPUTE_H_GUARD
 
 #include <set>
+#include <string>
 #include <vector>
 
-#include <api/gpu/graphics.h>
-#include <api/os/window.h>
-
 #define CL_HPP_ENABLE_EXCEPTIONS 1
 #define CL_HPP_MINIMUM_OPENCL_VERSION 120
 #define CL_HPP_TARGET_OPENCL_VERSION 120
 #include <CL/cl2.hpp>
 #include <CL/cl_gl.h>
 
+namespace os {
+class window;
+} // namespace os
+
 namespace gpu {
 namespace compute {
 
@@ -23,14 +25,26 @@ typedef cl::CommandQueue command_queue;
 typedef cl::Memory memory_object;
 typedef cl::Buffer buffer;
 typedef cl::ImageGL graphics_image;
+typedef cl::Image2D image;
+typedef cl::ImageFormat image_format;
 typedef cl::Program program;
 typedef cl::Kernel kernel;
 typedef cl::Event event;
 typedef std::vector<event> event_vector;
 typedef cl::NDRange nd_range;
 
+// Queue on a GPU sharing objects with the GL context of the window. Defined in
+// compute_gl.cpp, so that tools without a window do not link the window code.
 command_queue init(const os::window &window);
-program create_program_from_file(gpu::compute::context context, const char *file_name);
+// Queue on the first device of the given type, without graphics interop. For
+// tools running the simulation without a window.
+command_queue init_headless(cl_device_type device_type = CL_DEVICE_TYPE_ALL);
+// True if init_headless finds a device, for tools with optional OpenCL checks.
+bool has_device(cl_device_type device_type = CL_DEVICE_TYPE_ALL);
+program create_program_from_file(
+    gpu::compute::context context,
+    const char *file_name,
+    const std::string &options = std::string());
 const char *get_error_string(cl_int status);
 
 class extension_set : public std::set<std::string> {
@@ -47,6 +61,10 @@ public:
     std::string to_string() const;
 };
 
+// First device of the given type with all the required extensions. Dies if
+// there is none.
+device get_device(cl_device_type device_type, const extension_set &required_extensions);
+
 } // namespace compute
 } // namespace gpu
 
@@ -12,10 +12,11 @@ namespace api {
 typedef clfftPlanHandle plan_handle;
 } // namespace api
 
+// Plans are baked once per size, batch count, layout and device and shared by
+// all instances.
 class ifft2d_hermitian_inplace {
 public:
     ifft2d_hermitian_inplace(gpu::compute::command_queue queue, const math::ivec2 &size, size_t num_batches);
-    ~ifft2d_hermitian_inplace();
     ifft2d_hermitian_inplace(const ifft2d_hermitian_inplace &) = delete;
     ifft2d_hermitian_inplace &operator=(const ifft2d_hermitian_inplace &) = delete;
 
@@ -29,6 +30,24 @@ private:
     gpu::compute::memory_object tmp_buf;
 };
 
+// Backward complex-to-complex transforms of num_batches interleaved N x M
+// spectra, unnormalized.
+class ifft2d_complex_inplace {
+public:
+    ifft2d_complex_inplace(gpu::compute::command_queue queue, const math::ivec2 &size, size_t num_batches);
+    ifft2d_complex_inplace(const ifft2d_complex_inplace &) = delete;
+    ifft2d_complex_inplace &operator=(const ifft2d_complex_inplace &) = delete;
+
+    gpu::compute::event enqueue_transform(
+        gpu::compute::command_queue queue,
+        gpu::compute::memory_object buffer,
+        gpu::compute::event_vector *wait_events = nullptr);
+
+private:
+    api::plan_handle fft_plan;
+    gpu::compute::memory_object tmp_buf;
+};
+
 } // namespace fft
 } // namespace gpu
 
@@ -0,0 +1,55 @@
+#ifndef __MAPPED_BUFFER_H_GUARD
+#define __MAPPED_BUFFER_H_GUARD
+
+#include <api/gpu/compute.h>
+#include <vector>
+
+namespace gpu {
+namespace compute {
+
+// Ring of host-visible buffers (CL_MEM_ALLOC_HOST_PTR) receiving copies of
+// device data. A buffer is mapped for reading right after its copy and stays
+// mapped until the ring comes back to it, so the host reads completed data in
+// place: on devices sharing memory with the host the map costs nothing,
+// elsewhere the driver transfers the data without blocking the queue.
+//
+// The data of a buffer stays valid for num_buffers - 1 further copies, so with
+// three buffers one can be read while the next one is copied into and another
+// is still being mapped.
+class mapped_buffer_ring {
+public:
+    mapped_buffer_ring(command_queue queue, size_t size, int num_buffers = 3);
+    ~mapped_buffer_ring();
+    mapped_buffer_ring(const mapped_buffer_ring &) = delete;
+    mapped_buffer_ring &operator=(const mapped_buffer_ring &) = delete;
+
+    // Enqueues a copy of the first size bytes of src into the next buffer and
+    // the map of that buffer. Returns the index of the buffer.
+    int enqueue_copy(const buffer &src, const event_vector *wait_events = nullptr);
+
+    // Fence of buffer i: whether its data can be read.
+    bool is_ready(int i) const;
+    // Waits for buffer i and returns its data.
+    const void *get_data(int i) const;
+    const event &get_map_event(int i) const { return slots[i].map_event; }
+
+    size_t get_size() const { return size; }
+    int get_num_buffers() const { return int(slots.size()); }
+
+private:
+    struct slot {
+        buffer host_buffer;
+        void *data; // Null while unmapped.
+        event map_event;
+    };
+
+    command_queue queue;
+    size_t size;
+    std::vector<slot> slots;
+    int next_slot;
+};
+
+} // namespace compute
+} // namespace gpu
+
+#endif // !__MAPPED_BUFFER_H_GUARD
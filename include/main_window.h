@@ -3,12 +3,17 @@
 
 #include <api/gpu/compute.h>
 #include <api/os/window.h>
+#include <memory>
 #include <ocean/surface_params.h>
+#include <ocean/surface_recording.h>
 #include <rendering/framebuffer.h>
 #include <rendering/rendering_params.h>
 #include <rendering/text_renderer.h>
 #include <scene/camera_controller.h>
 #include <scene/ocean_scene.h>
+#include <string>
+#include <util/statistics.h>
+#include <vector>
 
 class main_window {
 public:
@@ -27,7 +32,24 @@ private:
     void handle_resize_event(const util::extent &new_extent);
     void handle_keyboard_event(const os::keyboard_event &event);
 
-    void render_performance_metrics(double multisample_resolve_milliseconds);
+    // Frame stages with timing statistics.
+    enum stage {
+        STAGE_FRAME,
+        STAGE_PHASE_SHIFT,
+        STAGE_FFT,
+        STAGE_EXPORT,
+        STAGE_MIPMAPS,
+        STAGE_RENDER,
+        STAGE_OCEAN_DRAWCALL,
+        STAGE_RESOLVE,
+        NUM_STAGES
+    };
+
+    void update_statistics(double frame_milliseconds, double multisample_resolve_milliseconds);
+    void render_performance_metrics();
+    void render_statistics_panel();
+    void write_statistics_csv() const;
+    void write_trace();
 
     os::window window;
     gpu::compute::command_queue queue;
@@ -36,6 +58,10 @@ private:
     scene::ocean_scene ocean_scene;
     scene::camera_controller camera_controller;
     run_state run_state;
+    std::string trace_file_name; // Empty if tracing is off.
+    std::unique_ptr<ocean::surface_recorder> recorder; // Null if recording is off.
+    std::vector<util::rolling_statistics> stage_statistics; // In milliseconds.
+    int histogram_stage; // Stage shown in the histogram of the statistics panel.
 };
 
 #endif // !__MAIN_WINDOW_H_GUARD
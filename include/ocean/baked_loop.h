@@ -0,0 +1,68 @@
+#ifndef __BAKED_LOOP_H_GUARD
+#define __BAKED_LOOP_H_GUARD
+
+#include <string>
+#include <vector>
+
+#include <api/math.h>
+#include <ocean/host_simulation.h>
+#include <ocean/surface_params.h>
+#include <util/mapped_file.h>
+#include <util/thread_pool.h>
+
+namespace ocean {
+
+class spectrum;
+
+// Frames of one period of the surface (see spectrum::period), rendered with
+// host_simulation and kept as RGBA8 maps, either in memory or in a memory
+// mapped file. A file baked with the same parameters is reused as is.
+// Sampling blends the two frames nearest to the requested time, so the FFT
+// is only run while baking.
+class baked_loop {
+public:
+    typedef host_simulation::texel texel;
+
+    // An empty file_path keeps the frames in memory.
+    baked_loop(
+        util::thread_pool &pool,
+        const surface_params &params,
+        int num_frames,
+        const std::string &file_path);
+    baked_loop(const baked_loop &) = delete;
+    baked_loop &operator=(const baked_loop &) = delete;
+
+    // Renders every frame of wave_spectrum, unless the backing file already
+    // holds frames for the same parameters.
+    void bake(const spectrum &wave_spectrum);
+    // The frames have to be baked again after the spectrum has changed.
+    void invalidate() { is_baked = false; }
+    bool is_valid() const { return is_baked; }
+
+    // Writes the maps at the given time; both have fft_size.x * fft_size.y
+    // texels.
+    void sample(math::real time, texel *displacement_map, texel *normal_map) const;
+
+    int get_num_frames() const { return num_frames; }
+
+private:
+    struct file_header;
+
+    size_t get_frame_texel_count() const { return size_t(fft_size.x) * fft_size.y; }
+    texel *get_frame(int i) const { return frames + 2 * get_frame_texel_count() * i; }
+
+    util::thread_pool &pool;
+    math::ivec2 fft_size;
+    int num_frames;
+    bool is_baked;
+
+    // One of these holds the frames: displacement then normal map per frame.
+    std::vector<texel> memory;
+    util::mapped_file file;
+    file_header *header;
+    texel *frames;
+};
+
+} // namespace ocean
+
+#endif // !__BAKED_LOOP_H_GUARD
@@ -0,0 +1,163 @@
+#ifndef __HEIGHT_FIELD_H_GUARD
+#define __HEIGHT_FIELD_H_GUARD
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <api/cpu/simd.h>
+#include <api/math.h>
+#include <ocean/surface_params.h>
+#include <util/thread_pool.h>
+
+namespace ocean {
+
+namespace detail {
+
+struct sample_args;
+
+// Bounds of the heights over a square of node_size cells (between texel
+// centers), grown by the largest horizontal displacement.
+struct height_bounds {
+    float min, max;
+};
+
+struct pyramid_level {
+    std::vector<height_bounds> nodes;
+    math::ivec2 size; // In nodes, divides the tile.
+    int node_size; // In cells.
+};
+
+} // namespace detail
+
+// Host copy of the displacement of the latest simulated frame, for physics
+// (buoyancy, collisions) that needs the water surface at arbitrary points.
+// Positions are in rendering units in the plane of the ocean, like model_pos
+// in shaders/ocean.glsl, and the surface repeats every tile_size_logical.
+//
+// The displacement moves the grid point p0 horizontally too, so the surface
+// point above xz is the one with p0 + displacement(p0).xz == xz; queries find
+// p0 by fixed-point iteration. Batches are split over the thread pool and use
+// AVX2 gathers if the CPU has them.
+//
+// Ray queries walk a min/max pyramid of the heights, which repeats with the
+// tile like the textures (WRAP_MODE_REPEAT), and only march the nodes the ray
+// may hit.
+//
+// Updates and queries must not overlap; surface_geometry updates the copy in
+// enqueue_generate.
+class height_field {
+public:
+    height_field(util::thread_pool &pool, const surface_params &params);
+    height_field(const height_field &) = delete;
+    height_field &operator=(const height_field &) = delete;
+
+    // One displacement component in meters, fft_size.x by fft_size.y values.
+    struct field_view {
+        const float *data;
+        size_t element_stride; // In floats.
+        size_t row_stride; // In floats.
+    };
+
+    // Takes the x, y and z displacement of the frame at time.
+    void update(math::real time, const field_view &dx, const field_view &dy, const field_view &dz);
+    // Same from an RGBA8 displacement map, see kernels/export_to_texture.cl.
+    void update(math::real time, const uint32_t *displacement_map);
+    bool is_valid() const { return has_frame; }
+    math::real get_time() const { return time; }
+
+    // Any of the outputs may be null. Heights are relative to the undisplaced
+    // plane, velocities are those of the water surface in rendering units per
+    // second, estimated from the last two frames (zero after the first one).
+    void sample(
+        const math::vec2 *xz,
+        size_t count,
+        math::real *heights,
+        math::vec3 *normals,
+        math::vec3 *velocities) const;
+    void sample_heights(const math::vec2 *xz, size_t count, math::real *heights) const
+    {
+        sample(xz, count, heights, nullptr, nullptr);
+    }
+    void sample_normals(const math::vec2 *xz, size_t count, math::vec3 *normals) const
+    {
+        sample(xz, count, nullptr, normals, nullptr);
+    }
+    void sample_velocities(const math::vec2 *xz, size_t count, math::vec3 *velocities) const
+    {
+        sample(xz, count, nullptr, nullptr, velocities);
+    }
+
+    struct ray_hit {
+        math::real distance; // Negative if the ray misses the surface.
+        math::vec3 normal;
+    };
+
+    // Intersects the rays origin + t * direction, 0 <= t <= max_distance,
+    // with the surface; distances are in units of the direction vectors. A
+    // ray starting below the surface hits it at zero.
+    void intersect(
+        const math::vec3 *origins,
+        const math::vec3 *directions,
+        size_t count,
+        math::real max_distance,
+        ray_hit *hits) const;
+    // Same without the pyramid, marching the whole length of every ray. For
+    // reference.
+    void intersect_brute_force(
+        const math::vec3 *origins,
+        const math::vec3 *directions,
+        size_t count,
+        math::real max_distance,
+        ray_hit *hits) const;
+
+    cpu::simd::instruction_set get_instruction_set() const { return instruction_set; }
+    void set_instruction_set(cpu::simd::instruction_set set) { instruction_set = set; }
+
+private:
+    // Planes of fft_size.x by fft_size.y values.
+    enum plane {
+        PLANE_DX,
+        PLANE_DY,
+        PLANE_DZ,
+        PLANE_NX,
+        PLANE_NY,
+        PLANE_NZ,
+        PLANE_PREVIOUS_DX,
+        PLANE_PREVIOUS_DY,
+        PLANE_PREVIOUS_DZ,
+        NUM_PLANES
+    };
+
+    float *get_plane(plane p) { return planes.data() + p * plane_size; }
+    const float *get_plane(plane p) const { return planes.data() + p * plane_size; }
+    void begin_update(math::real time);
+    void update_normals();
+    void update_pyramid();
+    detail::sample_args get_sample_args() const;
+    void intersect_rays(
+        const math::vec3 *origins,
+        const math::vec3 *directions,
+        size_t count,
+        math::real max_distance,
+        ray_hit *hits,
+        bool use_pyramid) const;
+
+    util::thread_pool &pool;
+    math::ivec2 size;
+    size_t plane_size;
+    math::vec3 units_per_meter;
+    math::vec2 texels_per_unit;
+    cpu::simd::instruction_set instruction_set;
+
+    std::vector<float> planes;
+    std::vector<detail::pyramid_level> pyramid; // Finest level first.
+    bool has_frame;
+    bool has_previous_frame;
+    math::real time;
+    math::real previous_time;
+};
+
+} // namespace ocean
+
+#endif // !__HEIGHT_FIELD_H_GUARD
@@ -0,0 +1,37 @@
+#ifndef __HOST_PHASE_SHIFT_H_GUARD
+#define __HOST_PHASE_SHIFT_H_GUARD
+
+#include <api/cpu/simd.h>
+#include <api/math.h>
+#include <ocean/surface_params.h>
+#include <util/thread_pool.h>
+
+namespace ocean {
+
+class spectrum;
+
+// Host version of kernels/phase_shift.cl. Reads the wave vectors and the
+// dispersion relation from spectrum::wave_tables; per frame each coefficient
+// costs one sin/cos polynomial and a few multiply-adds. Uses AVX-512 or AVX2
+// if the CPU has them.
+class host_phase_shift {
+public:
+    host_phase_shift(const surface_params &params);
+    host_phase_shift(const host_phase_shift &) = delete;
+    host_phase_shift &operator=(const host_phase_shift &) = delete;
+
+    // Writes spectrum::get_num_output_fields half spectra to output, in the layout
+    // of cpu::fft::ifft2d_hermitian_inplace.
+    void apply(util::thread_pool &pool, const spectrum &wave_spectrum, math::real time, math::real *output) const;
+
+    cpu::simd::instruction_set get_instruction_set() const { return instruction_set; }
+
+private:
+    math::ivec2 fft_size;
+    bool reduced_fields;
+    cpu::simd::instruction_set instruction_set;
+};
+
+} // namespace ocean
+
+#endif // !__HOST_PHASE_SHIFT_H_GUARD
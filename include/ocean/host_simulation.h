@@ -0,0 +1,68 @@
+#ifndef __HOST_SIMULATION_H_GUARD
+#define __HOST_SIMULATION_H_GUARD
+
+#include <cstdint>
+#include <vector>
+
+#include <api/cpu/fft.h>
+#include <api/math.h>
+#include <ocean/host_phase_shift.h>
+#include <ocean/surface_params.h>
+#include <util/thread_pool.h>
+#include <util/timing.h>
+
+namespace ocean {
+
+class spectrum;
+
+// Runs the phase shift -> inverse FFT -> export chain on the host. The
+// resulting maps match the output of kernels/phase_shift.cl and
+// kernels/export_to_texture.cl: RGBA8 texels, fft_size.x texels per row. The
+// parameters are those of one cascade, see spectrum::get_cascade_params.
+class host_simulation {
+public:
+    typedef uint32_t texel;
+
+    host_simulation(util::thread_pool &pool, const surface_params &params);
+    host_simulation(const host_simulation &) = delete;
+    host_simulation &operator=(const host_simulation &) = delete;
+
+    void generate(const spectrum &wave_spectrum, math::real time);
+
+    const std::vector<texel> &get_displacement_map() const { return displacement_map; }
+    const std::vector<texel> &get_normal_map() const { return normal_map; }
+
+    // Output field i of the FFT (see kernels/phase_shift.cl), in meters.
+    const math::real *get_field(int i) const
+    {
+        return fft_buffer.data() + i * get_field_row_stride() * fft_size.y;
+    }
+    size_t get_field_row_stride() const { return fft_size.x + 2; }
+
+    struct timing_data {
+        double phase_shift_milliseconds;
+        double fft_milliseconds;
+        double export_milliseconds;
+    };
+    timing_data get_timing_data() const { return timings; }
+
+private:
+    void export_maps();
+
+    util::thread_pool &pool;
+    math::ivec2 fft_size;
+    math::real cascade_max_displacement; // Quantization range of the displacement map, smaller
+                                         // for the smaller cascades like the kernel's.
+    int num_fields;
+    host_phase_shift phase_shift;
+    cpu::fft::ifft2d_hermitian_inplace fft_algorithm;
+    std::vector<math::real> fft_buffer;
+    std::vector<texel> displacement_map, normal_map;
+
+    util::cpu_timer timer;
+    timing_data timings;
+};
+
+} // namespace ocean
+
+#endif // !__HOST_SIMULATION_H_GUARD
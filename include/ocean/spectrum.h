@@ -1,27 +1,76 @@
 #ifndef __SPECTRUM_H_GUARD
 #define __SPECTRUM_H_GUARD
 
+#include <api/cpu/simd.h>
 #include <api/gpu/compute.h>
 #include <api/math.h>
+#include <atomic>
+#include <cmath>
 #include <ocean/surface_params.h>
+#include <string>
+#include <thread>
+#include <util/cached_data.h>
 #include <vector>
 
 namespace ocean {
 
 class spectrum {
 public:
+    // Number of spectra written by enqueue_generate: displacement (3) and its
+    // jacobian (6). With surface_params::reduced_fields ddz_du is left out, it
+    // equals ddx_dv; ddz_dv moves to its place.
+    static constexpr int num_output_fields = 9;
+    static constexpr int num_reduced_output_fields = 8;
+    static int get_num_output_fields(const surface_params &params)
+    {
+        return params.reduced_fields ? num_reduced_output_fields : num_output_fields;
+    }
+    // With surface_params::packed_fft enqueue_generate writes this many full
+    // complex spectra instead, holding two fields each.
+    static int get_num_packed_output_fields(const surface_params &params)
+    {
+        return (get_num_output_fields(params) + 1) / 2;
+    }
+    // Build options for kernels reading the fields.
+    static std::string get_kernel_build_options(const surface_params &params)
+    {
+        return params.reduced_fields ? "-DREDUCED_FIELDS" : "";
+    }
+
+    // All angular frequencies are multiples of 2*pi/period, so the surface
+    // repeats itself after this many seconds.
+    static constexpr math::real period = math::real(10);
+
+    // Parameters of cascade i of the surface params describes: the tiles
+    // shrink by surface_params::cascade_scale from one cascade to the next.
+    static surface_params get_cascade_params(const surface_params &params, int cascade);
+    // Tile size of the first cascade over that of params.cascade.
+    static math::real get_cascade_ratio(const surface_params &params)
+    {
+        return std::pow(params.cascade_scale, math::real(params.cascade));
+    }
+    // Wavenumbers params.cascade simulates, from x up to y, in rad/m. Waves
+    // that fit four times into the tile of the next cascade are left to it;
+    // the first cascade has no lower bound and the last no upper one.
+    static math::vec2 get_cascade_band(const surface_params &params);
+
+    // A null context keeps the spectrum on the host only.
     spectrum(gpu::compute::context context, const surface_params &params);
+    ~spectrum();
     spectrum(const spectrum &) = delete;
     spectrum &operator=(const spectrum &) = delete;
 
+    // output_buffer holds the fields of every cascade, one after the other;
+    // this writes those of surface_params::cascade.
     gpu::compute::event enqueue_generate(
         gpu::compute::command_queue queue,
         math::real time,
         gpu::compute::memory_object output_buffer,
         const gpu::compute::event_vector *wait_events = nullptr);
     const surface_params &get_params() const { return params; }
+    // The amplitude being faded to; see get_current_amplitude.
     float get_amplitude() const { return params.amplitude; }
-    void set_amplitude(float amplitude) { params.amplitude = amplitude; }
+    void set_amplitude(float amplitude);
     math::vec2 get_wind_vector() const { return params.wind_speed * params.wind_direction; }
     void set_wind_vector(math::vec2 v)
     {
@@ -29,18 +78,142 @@ public:
         params.wind_speed = math::length(v);
     }
 
-    void rebuild(gpu::compute::context context);
+    // The initial spectrum is Gaussian noise, which only depends on fft_size
+    // and the cascade, scaled by an envelope from the wind. The noise is drawn once: every
+    // coefficient takes its random numbers from a counter-based generator
+    // keyed by its index, so rows are generated in parallel on the default
+    // thread pool, with SIMD where available, and the result does not depend
+    // on the number of threads. With a context it is uploaded once as well.
+    //
+    // rebuild applies the envelope for the current parameters to a second
+    // spectrum, the target, without waiting for it: a host-only spectrum
+    // builds it on a worker thread, otherwise a kernel builds it on the device
+    // ahead of the next enqueue_generate, in the same queue. Once the target
+    // is there, the surface blends over to it in
+    // surface_params::transition_time seconds of simulation time; a rebuild
+    // during a blend starts the next one from the blended spectrum. Amplitude
+    // changes blend the same way.
+    void rebuild();
+    // Advances the blends to the time of the frame about to be generated,
+    // which enqueue_generate does itself. A host-only spectrum takes a
+    // finished target here and blends its host data.
+    void update(math::real time);
+    // Ends the blends at the target, waiting for a host-only rebuild to
+    // finish first. For consumers that can not blend, such as baked loops.
+    void finish_transition();
+    // Draws the noise again with the current instruction set, which only
+    // changes the rounding of the result. The constructor already did.
+    void draw_noise();
+
+    // Of the spectrum blend, one once settled.
+    math::real get_transition_weight() const { return spectrum_fade.weight; }
+    math::real get_current_amplitude() const
+    {
+        const math::real w = amplitude_fade.weight;
+        return (1 - w) * amplitude_from + w * params.amplitude;
+    }
+
+    cpu::simd::instruction_set get_instruction_set() const { return instruction_set; }
+    void set_instruction_set(cpu::simd::instruction_set set) { instruction_set = set; }
+
+    // Host copy of the initial spectrum in structure-of-arrays form,
+    // (fft_size.x / 2 + 1) * fft_size.y coefficients, blended as of the last
+    // update. Empty for spectra with a context, which only keep theirs on the
+    // device.
+    struct host_data {
+        std::vector<math::real> re, im;
+    };
+    const host_data &get_host_data() const
+    {
+        return spectrum_fade.is_settled() ? host_spectra[target_slot] : host_blend;
+    }
+
+    // Quantities of the half spectrum that only depend on fft_size and
+    // tile_size_physical. Built once and used by every phase shift.
+    struct wave_tables {
+        std::vector<math::real> k_x; // Per column.
+        std::vector<math::real> k_z; // Per row.
+        std::vector<math::real> inv_k; // Per coefficient; zero where k vanishes.
+        std::vector<math::real> omega; // Per coefficient.
+    };
+    static wave_tables build_wave_tables(const surface_params &params);
+
+    // Expected significant wave height, four times the standard deviation of
+    // the height, of surfaces drawn for params at an amplitude of 1, in
+    // meters for the models other than Phillips. The sum over the discrete
+    // spectrum, so it misses waves longer than the tile or shorter than two
+    // samples, and those outside the band of the cascade.
+    static double get_significant_wave_height(const surface_params &params);
+    const wave_tables &get_wave_tables() const { return tables.get(); }
 
 private:
-    void load_phase_shift_kernel(gpu::compute::context context);
-    math::real phillips_spectrum(int i, int j);
+    // Blend weight from the old value (0) to the new one (1).
+    struct fade {
+        fade() : start(0), weight(1), is_starting(false) {}
+        // Starts over at the time of the next update.
+        void restart()
+        {
+            weight = 0;
+            is_starting = true;
+        }
+        void settle()
+        {
+            weight = 1;
+            is_starting = false;
+        }
+        void update(math::real time, math::real duration);
+        bool is_settled() const { return weight >= 1; }
+
+        math::real start;
+        math::real weight;
+        bool is_starting;
+    };
+
+    void load_kernels();
+    void upload_wave_table();
+    void launch_rebuild();
+    void wait_for_rebuild();
+    static void build_envelope(
+        const surface_params &p,
+        cpu::simd::instruction_set set,
+        const host_data &noise,
+        host_data &out);
+    void install_host_target();
+    void enqueue_install_target(
+        gpu::compute::command_queue queue,
+        const gpu::compute::event_vector *wait_events,
+        gpu::compute::event &event);
 
     static constexpr math::real g = math::real(9.80665);
 
     surface_params params;
+    cpu::simd::instruction_set instruction_set;
+    gpu::compute::context context;
+
+    // The spectrum in slot target_slot is blended over from the other one.
+    int target_slot;
+    fade spectrum_fade;
+    fade amplitude_fade;
+    math::real amplitude_from;
+    bool is_fade_skipped; // The next target replaces the spectrum at once.
+
+    host_data noise_host; // Host-only spectra.
+    host_data host_spectra[2];
+    host_data host_blend;
+    host_data host_target; // Written by the builder.
+    std::thread builder;
+    std::atomic<bool> is_target_built;
+    bool is_rebuild_pending; // Another rebuild after the running one.
 
-    gpu::compute::buffer initial_spectrum;
+    bool is_envelope_dirty; // The device target waits for rebuild's kernel.
+    util::cached_data<wave_tables> tables;
+    gpu::compute::buffer noise; // Interleaved like initial_spectra.
+    gpu::compute::buffer initial_spectra[2];
+    gpu::compute::buffer wave_table; // (k_x, k_z, inv_k, omega) per coefficient.
     gpu::compute::kernel phase_shift_kernel;
+    gpu::compute::kernel phase_shift_packed_kernel;
+    gpu::compute::kernel envelope_kernel;
+    gpu::compute::kernel blend_kernel;
 };
 
 } // namespace ocean
@@ -3,50 +3,100 @@
 
 #include <api/gpu/compute.h>
 #include <api/gpu/fft.h>
+#include <api/gpu/mapped_buffer.h>
+#include <algorithm>
 #include <api/math.h>
+#include <deque>
+#include <memory>
+#include <ocean/baked_loop.h>
+#include <ocean/height_field.h>
+#include <ocean/host_simulation.h>
 #include <ocean/spectrum.h>
 #include <ocean/surface_params.h>
+#include <ocean/surface_recording.h>
 #include <rendering/texture_2d.h>
-#include <util/timing.h>
+#include <util/graphics_timer.h>
+#include <vector>
 
 namespace ocean {
 
 class surface_geometry {
 public:
+    // The queue is only used by SIMULATION_BACKEND_OPENCL and may be null
+    // otherwise.
     surface_geometry(gpu::compute::command_queue queue, const surface_params &params);
     surface_geometry(const surface_geometry &) = delete;
     surface_geometry &operator=(const surface_geometry &) = delete;
 
-    // Generates displacement map and height gradient map to textures.
+    // Generates displacement map and height gradient map to textures. With a
+    // pipeline depth above one this only enqueues the work, and the textures
+    // hold the last completed frame, which may be older than time.
     void enqueue_generate(math::real time, const gpu::compute::event_vector *wait_events = nullptr);
-    void bind_displacement_texture(gpu::graphics::texture_unit tex_unit)
+
+    // Each cascade has its own pair of textures. The textures to bind change
+    // between calls to enqueue_generate, so these have to be called after each
+    // of them.
+    void bind_displacement_texture(int cascade, gpu::graphics::texture_unit tex_unit)
     {
-        displacement_map.tex.bind(tex_unit);
+        get_displayed_frame().cascades[cascade]->displacement_map.tex.bind(tex_unit);
     }
-    void bind_height_gradient_texture(gpu::graphics::texture_unit tex_unit)
+    void bind_height_gradient_texture(int cascade, gpu::graphics::texture_unit tex_unit)
     {
-        height_gradient_map.tex.bind(tex_unit);
+        get_displayed_frame().cascades[cascade]->height_gradient_map.tex.bind(tex_unit);
     }
     inline void set_texture_max_anisotropy(float max_anisotropy);
 
+    // One unless surface_params::num_cascades is set; baked loops and replays
+    // have one.
+    int get_num_cascades() const { return int(spectra.size()); }
+    // See spectrum::get_cascade_ratio.
+    math::real get_cascade_ratio(int cascade) const
+    {
+        return spectrum::get_cascade_ratio(spectra[cascade]->get_params());
+    }
+
+    // Of one cascade. With OpenCL one batched transform covers every cascade,
+    // its time is only in timing_data::fft_milliseconds.
+    struct cascade_timing_data {
+        double phase_shift_milliseconds;
+        double fft_milliseconds;
+        double export_milliseconds;
+    };
+
+    // Latest completed measurements, which lag behind the frame by a few frames.
+    // The stages are summed over the cascades.
     struct timing_data {
         double phase_shift_milliseconds;
         double fft_milliseconds;
         double export_milliseconds;
         double mipmap_generation_milliseconds;
+        int fft_transform_count; // Number of 2D transforms fft_milliseconds covers.
+        int num_cascades;
+        cascade_timing_data cascades[max_cascades];
     };
     timing_data get_timing_data() const { return timings; }
 
-    float get_wave_amplitude() const { return wave_spectrum.get_amplitude(); }
-    void set_wave_amplitude(float a) { wave_spectrum.set_amplitude(a); }
-    math::vec2 get_wind_vector() const { return wave_spectrum.get_wind_vector(); }
-    void set_wind_vector(const glm::vec2 &v)
-    {
-        wave_spectrum.set_wind_vector(v);
-        queue.finish();
-        wave_spectrum.rebuild(queue.getInfo<CL_QUEUE_CONTEXT>());
-        queue.finish();
-    }
+    float get_wave_amplitude() const { return spectra.front()->get_amplitude(); }
+    void set_wave_amplitude(float a);
+    math::vec2 get_wind_vector() const { return spectra.front()->get_wind_vector(); }
+    void set_wind_vector(const glm::vec2 &v);
+    simulation_backend get_backend() const { return backend; }
+
+    // Null unless surface_params::height_queries is set. Holds the frame the
+    // textures hold, of the first cascade only, which has the longest waves.
+    const height_field *get_height_field() const { return heights.get(); }
+
+    // Displacement fields of the frame the textures hold, of the first cascade,
+    // in meters, to be read in place from host memory until the next
+    // enqueue_generate. The data pointers are null with a baked loop, when
+    // replaying a recording that is not RECORDING_FORMAT_FLOAT32, and with the
+    // OpenCL backend unless map_displacement or height_queries is set in
+    // surface_params.
+    struct host_displacement {
+        height_field::field_view dx, dy, dz;
+        math::real time;
+    };
+    const host_displacement &get_host_displacement() const { return displayed_displacement; }
 
 private:
     typedef rendering::texture_2d::texture_format texture_format;
@@ -57,24 +107,81 @@ private:
         rendering::texture_2d tex;
     };
 
-    gpu::compute::event enqueue_export_kernel(const gpu::compute::event_vector *wait_events = nullptr);
+    // Output textures of one cascade, and the events of the work of the
+    // cascade alone.
+    struct cascade_resources {
+        cascade_resources(gpu::compute::context context, math::ivec2 size);
+        shared_texture displacement_map, height_gradient_map;
+        gpu::compute::kernel export_kernel;
+        gpu::compute::event event_spectrum, event_export_kernel;
+    };
+
+    // One set of output textures, and the events of the work writing it.
+    struct frame_resources {
+        frame_resources(gpu::compute::context context, math::ivec2 size, int num_cascades);
+        std::vector<std::unique_ptr<cascade_resources>> cascades;
+        gpu::compute::event event_fft, event_acquire;
+        gpu::compute::event event_export; // Release of the textures, the last command.
+        math::real time;
+        int displacement_buffer; // In displacement_ring, -1 if none.
+    };
+
+    void enqueue_generate_compute(math::real time, const gpu::compute::event_vector *wait_events);
+    void generate_host(math::real time);
+    void generate_baked(math::real time);
+    void generate_replay(math::real time);
+    void generate_mipmaps(frame_resources &frame);
+    host_displacement get_mapped_displacement(const frame_resources &frame) const;
+    void set_displayed_displacement(const host_displacement &displacement);
+    int get_free_frame() const;
+    void retire_frames(bool wait_for_oldest);
+    frame_resources &get_displayed_frame() { return *frames[std::max(displayed_frame, 0)]; }
+    gpu::compute::event enqueue_export_kernel(
+        frame_resources &frame,
+        const gpu::compute::event_vector *wait_events = nullptr);
 
+    simulation_backend backend;
     bool is_gl_event_supported;
     gpu::compute::command_queue queue;
-    spectrum wave_spectrum;
-    gpu::fft::ifft2d_hermitian_inplace fft_algorithm;
-    gpu::compute::buffer fft_buffer;
-    gpu::compute::kernel export_kernel;
-    shared_texture displacement_map, height_gradient_map;
+    std::vector<std::unique_ptr<spectrum>> spectra; // One per cascade.
 
-    util::graphics_timer timer;
+    // SIMULATION_BACKEND_OPENCL
+    std::unique_ptr<gpu::fft::ifft2d_hermitian_inplace> fft_algorithm;
+    std::unique_ptr<gpu::fft::ifft2d_complex_inplace> packed_fft_algorithm;
+    gpu::compute::buffer fft_buffer; // Shared by all frames, the queue is in-order.
+                                     // The fields of each cascade in turn.
+    std::deque<int> pending_frames; // Enqueued frames, oldest first.
+    int64_t trace_offset_ns; // Added to profiling times to get trace times.
+
+    // SIMULATION_BACKEND_HOST, one per cascade.
+    std::vector<std::unique_ptr<host_simulation>> host_sims;
+
+    // Optional, replace either backend: the baked loop after baking, the
+    // replay from the start. The maps are uploaded from these.
+    std::unique_ptr<baked_loop> loop;
+    std::unique_ptr<surface_replay> replay;
+    std::vector<baked_loop::texel> staging_displacement_map, staging_normal_map;
+
+    // Host copies of the displacement.
+    std::unique_ptr<gpu::compute::mapped_buffer_ring> displacement_ring;
+    host_displacement displayed_displacement;
+    std::unique_ptr<height_field> heights;
+
+    std::vector<std::unique_ptr<frame_resources>> frames;
+    int displayed_frame; // Last completed frame, -1 before the first one.
+
+    util::graphics_timer upload_timer, mipmap_timer;
     timing_data timings;
 };
 
 void surface_geometry::set_texture_max_anisotropy(float max_anisotropy)
 {
-    displacement_map.tex.set_max_anisotropy(max_anisotropy);
-    height_gradient_map.tex.set_max_anisotropy(max_anisotropy);
+    for (auto &frame : frames) {
+        for (auto &cascade : frame->cascades) {
+            cascade->displacement_map.tex.set_max_anisotropy(max_anisotropy);
+            cascade->height_gradient_map.tex.set_max_anisotropy(max_anisotropy);
+        }
+    }
 }
 
 } // namespace ocean
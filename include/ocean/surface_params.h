@@ -2,9 +2,35 @@
 #define __SURFACE_PARAMS_H_GUARD
 
 #include <api/math.h>
+#include <string>
 
 namespace ocean {
 
+enum simulation_backend {
+    SIMULATION_BACKEND_OPENCL, // Needs a GPU with cl_khr_gl_sharing.
+    SIMULATION_BACKEND_HOST // Multi-threaded, runs without a compute device.
+};
+
+// Wave spectrum the initial spectrum is drawn from, see spectrum.cpp for the
+// formulas. All but the Phillips spectrum are in meters for an amplitude of 1.
+enum spectrum_model {
+    SPECTRUM_MODEL_PHILLIPS, // Tessendorf (2001), with its own cos^2 spreading.
+    SPECTRUM_MODEL_PIERSON_MOSKOWITZ, // Fully developed sea.
+    SPECTRUM_MODEL_JONSWAP, // Fetch limited sea.
+    SPECTRUM_MODEL_TMA // JONSWAP in water of finite depth.
+};
+
+// Distribution of the energy of the spectrum models over directions, relative
+// to the wind. Not used by SPECTRUM_MODEL_PHILLIPS.
+enum directional_spreading {
+    DIRECTIONAL_SPREADING_COSINE_SQUARED, // cos^2 over the half plane downwind.
+    DIRECTIONAL_SPREADING_MITSUYASU, // cos^2s(theta / 2), s narrowest at the peak.
+    DIRECTIONAL_SPREADING_DONELAN_BANNER // sech^2(beta * theta).
+};
+
+// Largest surface_params::num_cascades, keep in sync with shaders/ocean.glsl.
+constexpr int max_cascades = 4;
+
 struct surface_params {
     math::ivec2 fft_size; // Number of samples along the horizontal dimensions.
     math::vec3 tile_size_physical; // In meters.
@@ -12,13 +38,84 @@ struct surface_params {
     math::real amplitude;
     math::real wavelength_low_threshold; // Suppress waves of wavelenght smaller
                                          // than this (in meters).
+    int num_cascades; // Tiles of decreasing size simulated together and
+                      // summed, 1 to max_cascades; each only has the waves
+                      // of its band of wavelengths (see
+                      // spectrum::get_cascade_band). Baked loops and replays
+                      // have one.
+    math::real cascade_scale; // Ratio of the tile sizes of consecutive
+                              // cascades, above one. An integer ratio lines
+                              // up the repeats of the tiles.
+    int cascade; // The cascade the tile sizes describe, zero for the whole
+                 // surface; see spectrum::get_cascade_params.
     math::vec2 wind_direction;
-    math::real wind_speed;
+    math::real wind_speed; // At 10 meters above the surface.
+    spectrum_model model;
+    directional_spreading spreading;
+    math::real fetch; // SPECTRUM_MODEL_JONSWAP and _TMA: meters of open water
+                      // upwind.
+    math::real peak_enhancement; // SPECTRUM_MODEL_JONSWAP and _TMA: gamma,
+                                 // 3.3 on average.
+    math::real depth; // SPECTRUM_MODEL_TMA: in meters. The dispersion of the
+                      // waves stays that of deep water.
+    math::real transition_time; // Seconds over which changes of the wind and
+                                // the amplitude blend in, zero to apply them
+                                // at once.
+    simulation_backend backend;
+    bool reduced_fields; // Leave out ddz_du, which equals ddx_dv.
+    bool packed_fft; // SIMULATION_BACKEND_OPENCL: transform pairs of real
+                     // fields as one complex FFT instead of one
+                     // hermitian-to-real FFT each.
+    int baked_loop_frames; // If positive, precompute this many frames of one
+                           // period and interpolate between them.
+    std::string baked_loop_file; // Backing file of the baked frames, may be
+                                 // empty to keep them in memory.
+    int pipeline_depth; // SIMULATION_BACKEND_OPENCL: number of texture sets.
+                        // With more than one, the next frame is simulated
+                        // while the last completed one is rendered.
+    bool height_queries; // Keep a host copy of the displacement for
+                         // height_field queries.
+    bool map_displacement; // SIMULATION_BACKEND_OPENCL: keep the
+                           // displacement of recent frames mapped in host
+                           // memory (implied by height_queries).
+    std::string replay_file; // If not empty, play back this recording of
+                             // surface_recorder instead of simulating; it
+                             // has to have the same fft_size.
     void set_wind_vector(const math::vec2 wind_vector)
     {
         wind_speed = math::length(wind_vector);
         wind_direction = wind_vector / wind_speed;
     }
+
+    // The parameters of the demo. Every field is set, callers override what
+    // they need.
+    static surface_params get_defaults()
+    {
+        surface_params params;
+        params.fft_size = math::ivec2(512, 512);
+        params.tile_size_logical = math::vec3(100, 100, 100); // For rendering.
+        params.tile_size_physical = math::vec3(200, 200, 200); // For heightmap generation.
+        params.amplitude = 2.0;
+        params.wavelength_low_threshold = math::real(0.7);
+        params.num_cascades = 3;
+        params.cascade_scale = math::real(3.7);
+        params.cascade = 0;
+        params.set_wind_vector(math::vec2(15, 0));
+        params.model = SPECTRUM_MODEL_PHILLIPS;
+        params.spreading = DIRECTIONAL_SPREADING_COSINE_SQUARED;
+        params.fetch = 100000;
+        params.peak_enhancement = math::real(3.3);
+        params.depth = 20;
+        params.transition_time = 2;
+        params.backend = SIMULATION_BACKEND_OPENCL;
+        params.reduced_fields = true;
+        params.packed_fft = false;
+        params.baked_loop_frames = 0;
+        params.pipeline_depth = 2;
+        params.height_queries = false;
+        params.map_displacement = false;
+        return params;
+    }
 };
 
 } // namespace ocean
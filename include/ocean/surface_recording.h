@@ -0,0 +1,167 @@
+#ifndef __SURFACE_RECORDING_H_GUARD
+#define __SURFACE_RECORDING_H_GUARD
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <api/math.h>
+#include <ocean/height_field.h>
+#include <ocean/surface_params.h>
+#include <util/mapped_file.h>
+#include <util/thread_pool.h>
+
+namespace ocean {
+
+// How surface_recorder stores the values of a frame.
+enum recording_format {
+    RECORDING_FORMAT_FLOAT32,
+    RECORDING_FORMAT_FLOAT16,
+    RECORDING_FORMAT_UNORM8 // Quantized like the textures, see kernels/export_to_texture.cl.
+};
+
+// Planes of a recorded frame, in file order.
+enum recording_plane {
+    RECORDING_PLANE_DX,
+    RECORDING_PLANE_DY,
+    RECORDING_PLANE_DZ,
+    RECORDING_PLANE_NX,
+    RECORDING_PLANE_NY,
+    RECORDING_PLANE_NZ,
+    NUM_RECORDING_PLANES
+};
+
+namespace detail {
+
+// Locates frame i of a recording.
+struct recording_index_entry {
+    double time;
+    uint64_t offset; // From the start of the file.
+};
+
+} // namespace detail
+
+// Records the displacement of consecutive frames, and the normals computed
+// from it, to a file that can be memory mapped for replay and analysis:
+//
+//   header    surface_params and layout, padded to a page
+//   frames    fixed-size chunks, each starting on a page: the recording_plane
+//             planes (fft_size.x by fft_size.y values, in meters) in the
+//             chosen format
+//   index     time and offset of every frame
+//
+// append only copies the fields into one of a few buffers; a background
+// thread computes the normals, converts and writes the frames. If the thread
+// falls behind, frames are dropped rather than stalling the caller. The magic
+// of the header is written on close, so a recording that was not closed is
+// not mistaken for a complete one.
+class surface_recorder {
+public:
+    surface_recorder(
+        const std::string &path,
+        const surface_params &params,
+        recording_format format,
+        int num_buffers = 4);
+    ~surface_recorder() { close(); }
+    surface_recorder(const surface_recorder &) = delete;
+    surface_recorder &operator=(const surface_recorder &) = delete;
+
+    // Takes the displacement of the frame at time, in meters. Frames at or
+    // before the last appended time are ignored. Returns false if the frame
+    // was dropped.
+    bool append(
+        math::real time,
+        const height_field::field_view &dx,
+        const height_field::field_view &dy,
+        const height_field::field_view &dz);
+    // Writes the queued frames, the index and the header.
+    void close();
+
+    int get_num_frames() const { return num_written; }
+    int get_num_dropped_frames() const { return num_dropped; }
+    const std::string &get_path() const { return path; }
+
+private:
+    struct pending_frame {
+        double time;
+        std::vector<float> fields; // dx, dy and dz planes.
+    };
+
+    void writer_main();
+    void write_frame(const pending_frame &frame);
+    void write_data(const void *data, size_t size);
+
+    FILE *file;
+    std::string path;
+    surface_params params;
+    recording_format format;
+    size_t frame_stride;
+    double last_time; // Of the last appended frame.
+
+    // Only used by the writer thread.
+    std::vector<detail::recording_index_entry> index;
+    std::vector<float> normals;
+    std::vector<uint8_t> frame_data;
+    bool is_failed;
+
+    std::atomic<int> num_written;
+    std::atomic<int> num_dropped;
+
+    std::mutex mutex;
+    std::condition_variable queue_changed;
+    std::deque<pending_frame> queued_frames;
+    std::vector<pending_frame> free_frames;
+    bool is_finished;
+    std::thread thread;
+};
+
+// Memory maps a file written by surface_recorder.
+class surface_replay {
+public:
+    typedef uint32_t texel;
+
+    surface_replay(util::thread_pool &pool, const std::string &path);
+    surface_replay(const surface_replay &) = delete;
+    surface_replay &operator=(const surface_replay &) = delete;
+
+    // The parameters the surface was recorded with; the simulation options,
+    // which are not recorded, select the host backend without extras.
+    const surface_params &get_params() const { return params; }
+    recording_format get_format() const { return format; }
+    int get_num_frames() const { return int(index.size()); }
+    double get_frame_time(int i) const { return index[i].time; }
+    // Last frame recorded at or before time, the recording repeats after its
+    // last frame.
+    int find_frame(math::real time) const;
+
+    // Decodes plane p of frame i, fft_size.x by fft_size.y values.
+    void read_plane(int i, recording_plane p, float *values) const;
+    // Plane p of frame i in place, null unless the format is
+    // RECORDING_FORMAT_FLOAT32.
+    const float *get_mapped_plane(int i, recording_plane p) const;
+    // Writes the RGBA8 maps of the frame find_frame(time) returns, like
+    // host_simulation. The normals are the recorded central differences, which
+    // are flatter than those of host_simulation on the shortest waves (by a
+    // few degrees on average, see ocean_bench record).
+    void sample(math::real time, texel *displacement_map, texel *normal_map) const;
+
+private:
+    const uint8_t *get_plane(int i, recording_plane p) const;
+
+    util::thread_pool &pool;
+    util::mapped_file file;
+    surface_params params;
+    recording_format format;
+    size_t plane_size; // In bytes.
+    std::vector<detail::recording_index_entry> index;
+};
+
+} // namespace ocean
+
+#endif // !__SURFACE_RECORDING_H_GUARD
@@ -16,7 +16,10 @@ public:
     // Draw calls render to this framebuffer after calling activate.
     void activate();
     // Draw calls render to backbuffer after calling resolve_to_backbuffer.
-    void resolve_to_backbuffer();
+    void resolve_to_backbuffer() { resolve_to(0); }
+    // Blits to the given single-sample framebuffer of the same size, and
+    // binds it for drawing.
+    void resolve_to(gpu::graphics::framebuffer target);
 
 private:
     int width, height, num_samples;
@@ -0,0 +1,43 @@
+#ifndef __PIXEL_READBACK_H_GUARD
+#define __PIXEL_READBACK_H_GUARD
+
+#include <api/gpu/graphics.h>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace rendering {
+
+// Reads back frames through a ring of pixel buffer objects. The copy of a
+// frame is only mapped when the ring comes around to its buffer again, by
+// which time it has usually finished, so reading does not stall rendering.
+class pixel_readback {
+public:
+    // Receives RGB8 pixels, bottom row first, tightly packed.
+    typedef std::function<void(const uint8_t *pixels)> consumer;
+
+    pixel_readback(int width, int height, int num_buffers = 3);
+    ~pixel_readback();
+    pixel_readback(const pixel_readback &) = delete;
+    pixel_readback &operator=(const pixel_readback &) = delete;
+
+    // Starts copying the color buffer of the framebuffer bound for reading.
+    // If all buffers are in use, the oldest frame is passed to consume first.
+    void read(const consumer &consume);
+    // Passes all frames still being read to consume, oldest first.
+    void flush(const consumer &consume);
+
+    size_t get_frame_size() const { return size_t(width) * height * 3; }
+
+private:
+    void complete_oldest(const consumer &consume);
+
+    int width, height;
+    std::vector<GLuint> buffers;
+    int next_buffer;
+    int num_pending;
+};
+
+} // namespace rendering
+
+#endif // !__PIXEL_READBACK_H_GUARD
@@ -27,11 +27,16 @@ public:
     texture_2d(const util::extent &extent, texture_format format, const void *data = nullptr);
     ~texture_2d() { glDeleteTextures(1, &tex); }
     texture_2d(const texture_2d &) = delete;
-    texture_2d(texture_2d &&texture) : tex(texture.tex) { texture.tex = 0; }
+    texture_2d(texture_2d &&texture) : tex(texture.tex), extent(texture.extent), format(texture.format)
+    {
+        texture.tex = 0;
+    }
     texture_2d &operator=(const texture_2d &) = delete;
     texture_2d &operator=(texture_2d &&texture)
     {
         tex = texture.tex;
+        extent = texture.extent;
+        format = texture.format;
         texture.tex = 0;
         return *this;
     }
@@ -58,10 +63,15 @@ public:
         glBindTextureUnit(tex_unit, tex);
         GL_CHECK();
     }
+    // Replaces the contents of the base level. Data has to be tightly packed
+    // and match the format the texture was created with.
+    void set_data(const void *data);
     gpu::graphics::texture get_api_texture() const { return tex; }
 
 private:
     gpu::graphics::texture tex;
+    util::extent extent;
+    texture_format format;
 };
 
 inline void texture_2d::set_wrap_mode(wrap_mode wrap_mode)
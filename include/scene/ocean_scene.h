@@ -9,7 +9,7 @@
 #include <rendering/rendering_params.h>
 #include <rendering/shader_effect.h>
 #include <scene/camera.h>
-#include <util/timing.h>
+#include <util/graphics_timer.h>
 
 namespace scene {
 
@@ -22,9 +22,20 @@ public:
     ocean_scene(const ocean_scene &) = delete;
     ocean_scene &operator=(const ocean_scene &) = delete;
 
-    void render();
+    // Time is in seconds.
+    void render(math::real time);
     camera &get_main_camera() { return main_camera; }
     const camera &get_main_camera() const { return main_camera; }
+    // Null unless ocean::surface_params::height_queries is set.
+    const ocean::height_field *get_height_field() const
+    {
+        return ocean_surface.get_height_field();
+    }
+    // See ocean::surface_geometry::get_host_displacement.
+    const ocean::surface_geometry::host_displacement &get_host_displacement() const
+    {
+        return ocean_surface.get_host_displacement();
+    }
 
     struct timing_data {
         double render_milliseconds;
@@ -44,7 +55,7 @@ private:
     rendering::shader_effect sky_effect;
     rendering::cubemap sky_env;
 
-    util::graphics_timer timer;
+    util::graphics_timer render_timer, ocean_drawcall_timer;
     timing_data timings;
 
     struct GuiState {
@@ -0,0 +1,90 @@
+#ifndef __GRAPHICS_TIMER_H_GUARD
+#define __GRAPHICS_TIMER_H_GUARD
+
+#include <api/gpu/graphics.h>
+#include <util/timing.h>
+#include <util/trace.h>
+
+namespace util {
+
+// Measures GPU time between start() and stop_and_get_milliseconds(). The
+// queries are read back a few frames later instead of waiting for the GPU, so
+// stop_and_get_milliseconds returns the latest completed measurement. Use one
+// timer per measured quantity. Named timers also show up in the trace.
+class graphics_timer {
+public:
+    explicit graphics_timer(const char *trace_name = nullptr)
+        : trace_name(trace_name), next_query(0), is_started(false), last_milliseconds(0)
+    {
+        glCreateQueries(GL_TIMESTAMP, 2 * num_queries, api_timers);
+        for (auto &pending : is_pending)
+            pending = false;
+
+        // Offset from GL time to trace time, the GL timestamp is taken when
+        // the previous commands have reached the GPU.
+        GLint64 gl_now;
+        glGetInteger64v(GL_TIMESTAMP, &gl_now);
+        trace_offset_ns = trace::now() - gl_now;
+    }
+    ~graphics_timer() { glDeleteQueries(2 * num_queries, api_timers); }
+    graphics_timer(const graphics_timer &) = delete;
+    graphics_timer &operator=(const graphics_timer &) = delete;
+
+    void start()
+    {
+        harvest();
+        // Skip the measurement if the GPU is a whole ring behind.
+        is_started = !is_pending[next_query];
+        if (is_started)
+            glQueryCounter(api_timers[2 * next_query], GL_TIMESTAMP);
+    }
+    double stop_and_get_milliseconds()
+    {
+        if (is_started) {
+            glQueryCounter(api_timers[2 * next_query + 1], GL_TIMESTAMP);
+            is_pending[next_query] = true;
+            next_query = (next_query + 1) % num_queries;
+            is_started = false;
+        }
+        harvest();
+        return last_milliseconds;
+    }
+
+private:
+    enum { num_queries = 4 };
+
+    // Reads back the completed queries, oldest first.
+    void harvest()
+    {
+        for (int i = 0; i < num_queries; ++i) {
+            int query = (next_query + i) % num_queries;
+            if (!is_pending[query])
+                continue;
+            GLint is_available;
+            glGetQueryObjectiv(api_timers[2 * query + 1], GL_QUERY_RESULT_AVAILABLE, &is_available);
+            if (!is_available)
+                break;
+            GLint64 begin_ns, end_ns;
+            glGetQueryObjecti64v(api_timers[2 * query], GL_QUERY_RESULT, &begin_ns);
+            glGetQueryObjecti64v(api_timers[2 * query + 1], GL_QUERY_RESULT, &end_ns);
+            last_milliseconds = (end_ns - begin_ns) * 1e-6;
+            is_pending[query] = false;
+            if (trace_name)
+                trace::record(
+                    trace_name, begin_ns + trace_offset_ns, end_ns + trace_offset_ns,
+                    trace::TRACK_GRAPHICS_QUEUE);
+        }
+    }
+
+    const char *trace_name;
+    GLuint api_timers[2 * num_queries]; // Begin and end timestamp of each query.
+    bool is_pending[num_queries];
+    int next_query;
+    bool is_started;
+    double last_milliseconds;
+    int64_t trace_offset_ns;
+};
+
+} // namespace util
+
+#endif // !__GRAPHICS_TIMER_H_GUARD
@@ -0,0 +1,52 @@
+#ifndef __MAPPED_FILE_H_GUARD
+#define __MAPPED_FILE_H_GUARD
+
+#include <cstddef>
+#include <string>
+
+namespace util {
+
+// Memory mapping of a whole file, read-write or read-only.
+class mapped_file {
+public:
+    mapped_file();
+    // Opens or creates the file and resizes it to size bytes. The existing
+    // contents are kept if the file already had exactly this size.
+    mapped_file(const std::string &path, size_t size);
+    // Maps an existing file read-only, at its current size, without changing
+    // it. The mapping must not be written. An empty file maps to null.
+    explicit mapped_file(const std::string &path);
+    ~mapped_file();
+    mapped_file(const mapped_file &) = delete;
+    mapped_file &operator=(const mapped_file &) = delete;
+    mapped_file(mapped_file &&other);
+    mapped_file &operator=(mapped_file &&other);
+
+    void *data() const { return mapping; }
+    size_t size() const { return mapping_size; }
+    // True if the file existed with the requested size before mapping.
+    bool has_previous_contents() const { return reused; }
+
+    bool is_read_only() const { return read_only; }
+
+    // Writes dirty pages back to the file.
+    void flush();
+
+private:
+    void close();
+
+    void *mapping;
+    size_t mapping_size;
+    bool reused;
+    bool read_only;
+#ifdef _WIN32
+    void *file_handle;
+    void *mapping_handle;
+#else
+    int fd;
+#endif
+};
+
+} // namespace util
+
+#endif // !__MAPPED_FILE_H_GUARD
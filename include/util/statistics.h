@@ -0,0 +1,62 @@
+#ifndef __STATISTICS_H_GUARD
+#define __STATISTICS_H_GUARD
+
+#include <cstdint>
+#include <vector>
+
+namespace util {
+
+// Histogram of positive values with logarithmic bucket boundaries: every
+// power of two above min_value is split into sub_buckets equal buckets, so
+// the relative error of a bucket is below 1 / sub_buckets at any magnitude.
+// Bucket 0 counts the values below min_value, the last one those above the
+// range.
+class log_histogram {
+public:
+    explicit log_histogram(double min_value = 1e-3, int num_octaves = 20, int sub_buckets = 8);
+
+    void add(double value);
+    void clear();
+
+    int get_num_buckets() const { return int(counts.size()); }
+    double get_bucket_upper_bound(int bucket) const;
+    uint64_t get_bucket_count(int bucket) const { return counts[bucket]; }
+    uint64_t get_total_count() const { return total_count; }
+
+    // Upper bound of the bucket holding the given percentile (0-100).
+    double get_percentile(double percentile) const;
+
+private:
+    double min_value;
+    int num_octaves;
+    int sub_buckets;
+    std::vector<uint64_t> counts;
+    uint64_t total_count;
+};
+
+// Exact statistics of the last window_size samples, and a histogram of all
+// samples since the last clear.
+class rolling_statistics {
+public:
+    explicit rolling_statistics(int window_size = 600);
+
+    void add(double value);
+    void clear();
+
+    struct summary {
+        int count; // Samples in the window.
+        double min, mean, p50, p95, p99, max;
+    };
+    summary get_summary() const;
+    const log_histogram &get_histogram() const { return histogram; }
+
+private:
+    std::vector<double> window;
+    int window_size;
+    int next_sample;
+    log_histogram histogram;
+};
+
+} // namespace util
+
+#endif // !__STATISTICS_H_GUARD
@@ -0,0 +1,57 @@
+#ifndef __THREAD_POOL_H_GUARD
+#define __THREAD_POOL_H_GUARD
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace util {
+
+// Fixed set of worker threads for data-parallel loops.
+class thread_pool {
+public:
+    typedef std::function<void(int begin, int end)> range_function;
+
+    // A thread count of zero means one thread per hardware thread.
+    explicit thread_pool(unsigned num_threads = 0);
+    ~thread_pool();
+    thread_pool(const thread_pool &) = delete;
+    thread_pool &operator=(const thread_pool &) = delete;
+
+    unsigned get_num_threads() const { return unsigned(workers.size()) + 1; }
+
+    // Calls fn on disjoint subranges covering [0, count), each at least grain
+    // long (except the last one), and returns when all calls have finished.
+    // The calling thread takes part in the work. Nested calls and calls made
+    // while another thread is using the pool run serially on the caller.
+    void parallel_for(int count, const range_function &fn, int grain = 1);
+
+private:
+    void worker_main();
+    void run_chunks();
+
+    std::vector<std::thread> workers;
+    std::mutex submit_mutex;
+
+    std::mutex mutex;
+    std::condition_variable work_available;
+    std::condition_variable work_done;
+    unsigned generation;
+    unsigned pending_workers;
+    bool stopping;
+
+    const range_function *job_fn;
+    int job_count;
+    int job_chunk;
+    std::atomic<int> next_index;
+};
+
+// Process-wide pool shared by the host-side simulation components.
+thread_pool &default_thread_pool();
+
+} // namespace util
+
+#endif // !__THREAD_POOL_H_GUARD
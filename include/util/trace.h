@@ -0,0 +1,57 @@
+#ifndef __TRACE_H_GUARD
+#define __TRACE_H_GUARD
+
+#include <cstdint>
+#include <string>
+
+namespace util {
+namespace trace {
+
+enum track {
+    TRACK_CURRENT_THREAD,
+    TRACK_COMPUTE_QUEUE, // OpenCL commands, in host time.
+    TRACK_GRAPHICS_QUEUE // GL timer queries, in host time.
+};
+
+// Nanoseconds on the clock of all trace events.
+int64_t now();
+
+// Recording is off by default, record() is a no-op then.
+void set_enabled(bool enabled);
+bool is_enabled();
+
+// Records an event spanning [begin_ns, end_ns). The name has to outlive the
+// trace, typically it is a string literal. Each thread appends to its own
+// buffer without locking, and a full buffer overwrites its oldest events.
+void record(
+    const char *name,
+    int64_t begin_ns,
+    int64_t end_ns,
+    track event_track = TRACK_CURRENT_THREAD);
+
+// Writes the recorded events in the Chrome trace event format, which can be
+// opened in chrome://tracing or ui.perfetto.dev. Events recorded while
+// writing may be missing or inconsistent.
+bool write_json(const std::string &file_name);
+
+// Records its own lifetime on the current thread.
+class scope {
+public:
+    explicit scope(const char *name) : name(name), begin_ns(is_enabled() ? now() : 0) {}
+    ~scope()
+    {
+        if (begin_ns != 0)
+            record(name, begin_ns, now());
+    }
+    scope(const scope &) = delete;
+    scope &operator=(const scope &) = delete;
+
+private:
+    const char *name;
+    int64_t begin_ns;
+};
+
+} // namespace trace
+} // namespace util
+
+#endif // !__TRACE_H_GUARD
@@ -7,6 +7,15 @@ namespace util {
 
 std::string read_file_contents(const std::string &filename);
 
+// Creates the directory unless it exists. Its parent has to exist.
+bool make_directory(const std::string &path);
+
+// Directory for data kept between runs, created if needed: name inside
+// $OCEAN_CACHE_DIR, or inside cache/ in the working directory.
+std::string get_cache_directory(const std::string &name);
+
+void set_environment_variable(const std::string &name, const std::string &value);
+
 } // namespace util
 
 #endif // !__UTIL_H_GUARD
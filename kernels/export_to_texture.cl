@@ -2,6 +2,14 @@
 #define MAX_DISPLACEMENT_Y 5.0f
 #define MAX_DISPLACEMENT_Z 5.0f
 
+// With REDUCED_FIELDS the input has no ddz_du (it equals ddx_dv) and ddz_dv
+// takes its place, see phase_shift.cl.
+
+// The kernels read the fields of one cascade, from field first_field of in on.
+// Its displacement is multiplied by displacement_scale, the tile ratio of the
+// cascade (see spectrum::get_cascade_ratio), before it is quantized, so the
+// smaller cascades keep their precision; shaders/ocean.glsl divides it back.
+
 float map_to_unorm(float x, float max_mag) {
     return (x + max_mag) / (2.0f * max_mag);
 }
@@ -24,12 +32,31 @@ float4 pack_normal(float x, float y, float z) {
     return res;
 }
 
-kernel void export_to_texture(global float *in, int N, int M, write_only image2d_t displacement_img, write_only image2d_t normal_img) {
+void export_texel(int2 dest_coords, float dx, float dy, float dz,
+                  float ddx_du, float ddx_dv, float ddy_du, float ddy_dv, float ddz_du, float ddz_dv,
+                  float displacement_scale,
+                  write_only image2d_t displacement_img, write_only image2d_t normal_img) {
+    // Normal.
+    float nx = ddy_dv * ddz_du - ddz_dv * ddy_du;
+    float ny = ddz_dv * ddx_du - ddx_dv * ddz_du;
+    float nz = ddx_dv * ddy_du - ddy_dv * ddx_du;
+    float n_mag = sqrt(nx * nx + ny * ny + nz * nz);
+    nx /= n_mag;
+    ny /= n_mag;
+    nz /= n_mag;
+
+    write_imagef(displacement_img, dest_coords,
+                 pack_displacement(displacement_scale * dx, displacement_scale * dy, displacement_scale * dz));
+    write_imagef(normal_img, dest_coords, pack_normal(nx, ny, nz));
+}
+
+kernel void export_to_texture(global float *in, int N, int M, write_only image2d_t displacement_img, write_only image2d_t normal_img, int first_field, float displacement_scale) {
     const int i = get_global_id(0), j = get_global_id(1);
     if (i > N || j > M) return;
     int row_stride = N + 2;
     int buf_stride = (N + 2) * M;
     const int lin_idx = j * row_stride + i;
+    in += first_field * buf_stride;
 
     // Displacement.
     float dx =     in[0 * buf_stride + lin_idx];
@@ -41,19 +68,45 @@ kernel void export_to_texture(global float *in, int N, int M, write_only image2d
     float ddx_dv = in[4 * buf_stride + lin_idx];
     float ddy_du = in[5 * buf_stride + lin_idx];
     float ddy_dv = in[6 * buf_stride + lin_idx];
+#ifdef REDUCED_FIELDS
+    float ddz_du = ddx_dv;
+    float ddz_dv = in[7 * buf_stride + lin_idx] + 1;
+#else
     float ddz_du = in[7 * buf_stride + lin_idx];
     float ddz_dv = in[8 * buf_stride + lin_idx] + 1;
+#endif
 
-    // Normal.
-    float nx = ddy_dv * ddz_du - ddz_dv * ddy_du;
-    float ny = ddz_dv * ddx_du - ddx_dv * ddz_du;
-    float nz = ddx_dv * ddy_du - ddy_dv * ddx_du;
-    float n_mag = sqrt(nx * nx + ny * ny + nz * nz);
-    nx /= n_mag;
-    ny /= n_mag;
-    nz /= n_mag;
+    export_texel((int2)(i, j), dx, dy, dz, ddx_du, ddx_dv, ddy_du, ddy_dv, ddz_du, ddz_dv,
+                 displacement_scale, displacement_img, normal_img);
+}
 
-    int2 dest_coords = (int2)(i, j);
-    write_imagef(displacement_img, dest_coords, pack_displacement(dx, dy, dz));
-    write_imagef(normal_img, dest_coords, pack_normal(nx, ny, nz));
+// Input written by phase_shift_packed and transformed by a complex FFT: the
+// fields are the real and imaginary parts of N x M complex values, and
+// first_field counts complex spectra.
+kernel void export_to_texture_packed(global float2 *in, int N, int M, write_only image2d_t displacement_img, write_only image2d_t normal_img, int first_field, float displacement_scale) {
+    const int i = get_global_id(0), j = get_global_id(1);
+    if (i >= N || j >= M) return;
+    int buf_stride = N * M;
+    const int lin_idx = j * N + i;
+    in += first_field * buf_stride;
+
+    const float2 dx_dy =         in[0 * buf_stride + lin_idx];
+    const float2 dz_ddx_du =     in[1 * buf_stride + lin_idx];
+    const float2 ddx_dv_ddy_du = in[2 * buf_stride + lin_idx];
+#ifdef REDUCED_FIELDS
+    const float2 ddy_dv_ddz_dv = in[3 * buf_stride + lin_idx];
+    const float ddy_dv = ddy_dv_ddz_dv.x;
+    const float ddz_du = ddx_dv_ddy_du.x;
+    const float ddz_dv = ddy_dv_ddz_dv.y;
+#else
+    const float2 ddy_dv_ddz_du = in[3 * buf_stride + lin_idx];
+    const float2 ddz_dv_none = in[4 * buf_stride + lin_idx];
+    const float ddy_dv = ddy_dv_ddz_du.x;
+    const float ddz_du = ddy_dv_ddz_du.y;
+    const float ddz_dv = ddz_dv_none.x;
+#endif
+
+    export_texel((int2)(i, j), dx_dy.x, dx_dy.y, dz_ddx_du.x,
+                 dz_ddx_du.y + 1, ddx_dv_ddy_du.x, ddx_dv_ddy_du.y, ddy_dv, ddz_du,
+                 ddz_dv + 1, displacement_scale, displacement_img, normal_img);
 }
@@ -0,0 +1,115 @@
+typedef float real;
+typedef float2 real2;
+
+// Values of ocean::spectrum_model and ocean::directional_spreading;
+// spectrum::load_kernels defines SPECTRUM_MODEL and DIRECTIONAL_SPREADING.
+#define SPECTRUM_MODEL_PHILLIPS 0
+#define SPECTRUM_MODEL_PIERSON_MOSKOWITZ 1
+#define SPECTRUM_MODEL_JONSWAP 2
+#define SPECTRUM_MODEL_TMA 3
+#define DIRECTIONAL_SPREADING_COSINE_SQUARED 0
+#define DIRECTIONAL_SPREADING_MITSUYASU 1
+#define DIRECTIONAL_SPREADING_DONELAN_BANNER 2
+
+#define G 9.80665f
+
+// Parameters of the spectrum models, see model_args in spectrum.cpp.
+typedef struct {
+    real alpha;
+    real omega_p;
+    real gamma;
+    real depth;
+    real s_p;
+} model_args;
+
+// Frequency spectrum S(omega) of the model, see the policies in spectrum.cpp.
+real frequency_spectrum(const model_args *m, real omega)
+{
+    const real r = m->omega_p / omega;
+    const real r_2 = r * r;
+    real s = m->alpha * G * G * pown(omega, -5) * exp(-1.25f * r_2 * r_2);
+#if SPECTRUM_MODEL != SPECTRUM_MODEL_PIERSON_MOSKOWITZ
+    const real sigma = (omega <= m->omega_p) ? 0.07f : 0.09f;
+    const real d = (omega - m->omega_p) / (sigma * m->omega_p);
+    s *= pow(m->gamma, exp(-0.5f * d * d));
+#endif
+#if SPECTRUM_MODEL == SPECTRUM_MODEL_TMA
+    const real omega_h = omega * sqrt(m->depth / G);
+    if (omega_h <= 1)
+        s *= 0.5f * omega_h * omega_h;
+    else if (omega_h < 2)
+        s *= 1 - 0.5f * (2 - omega_h) * (2 - omega_h);
+#endif
+    return s;
+}
+
+// Spreading function evaluated as (D(theta) + D(theta + pi)) / 2.
+real spreading(const model_args *m, real cos_theta, real omega)
+{
+#if DIRECTIONAL_SPREADING == DIRECTIONAL_SPREADING_MITSUYASU
+    const real ratio = omega / m->omega_p;
+    const real s = m->s_p * ((ratio <= 1) ? pown(ratio, 5) : pow(ratio, -2.5f));
+    const real norm = exp(lgamma(s + 1) - lgamma(s + 0.5f)) / (2 * sqrt(M_PI_F));
+    const real c = 0.5f * (1 + cos_theta);
+    return 0.5f * norm * (pow(c, s) + pow(1 - c, s));
+#elif DIRECTIONAL_SPREADING == DIRECTIONAL_SPREADING_DONELAN_BANNER
+    const real ratio = max(omega / m->omega_p, 0.56f);
+    real beta;
+    if (ratio < 0.95f)
+        beta = 2.61f * pow(ratio, 1.3f);
+    else if (ratio < 1.6f)
+        beta = 2.28f * pow(ratio, -0.65f);
+    else
+        beta = exp10(-0.4f + 0.8393f * pow(ratio, -1.134f));
+    const real theta = acos(clamp(cos_theta, -1.0f, 1.0f));
+    const real sech_0 = 1 / cosh(beta * theta);
+    const real sech_1 = 1 / cosh(beta * (M_PI_F - theta));
+    return 0.25f * beta / tanh(beta * M_PI_F) * (sech_0 * sech_0 + sech_1 * sech_1);
+#else
+    return cos_theta * cos_theta / M_PI_F;
+#endif
+}
+
+// Scales the Gaussian noise of every coefficient of the half spectrum by the
+// magnitude the spectrum model gives it. Runs on a size_x by M range. Unlike
+// the wave table, the last column has the negative Nyquist frequency; see
+// spectrum::build_envelope for the host version. Coefficients outside the band
+// of wavenumbers of the cascade are left out, the others are scaled by gain.
+kernel void apply_envelope(global const real2 *noise, int N, int M, real2 tile_size, real2 wind_direction, real inv_L_sqr, real l_sqr, real alpha, real omega_p, real gamma, real depth, real s_p, real2 band, real gain, global real2 *out)
+{
+    const int x_i = get_global_id(0); // 0..N/2
+    const int z_i = get_global_id(1); // 0..M-1
+    const int idx = z_i * (N / 2 + 1) + x_i;
+
+    const real k_x = M_PI_F * 2 * ((x_i + N / 2) % N - N / 2) / tile_size.x;
+    const real k_z = M_PI_F * 2 * ((z_i + M / 2) % M - M / 2) / tile_size.y;
+    const real k_sqr = k_x * k_x + k_z * k_z;
+    const real k = sqrt(k_sqr);
+    if (k_sqr < 1e-10f || k < band.x || k >= band.y) {
+        out[idx] = 0;
+        return;
+    }
+    const real w = k_x * wind_direction.x + k_z * wind_direction.y;
+
+#if SPECTRUM_MODEL == SPECTRUM_MODEL_PHILLIPS
+    // Tessendorf (2001), eq. 40 and 41.
+    const real damp = exp(-inv_L_sqr / k_sqr - k_sqr * l_sqr);
+    const real p = damp * w * w / (k_sqr * k_sqr * k_sqr);
+    out[idx] = gain * 1e-3f * sqrt(p * 0.5f) * noise[idx];
+#else
+    const model_args m = { alpha, omega_p, gamma, depth, s_p };
+    const real omega = sqrt(G * k);
+    const real energy = frequency_spectrum(&m, omega) * spreading(&m, w / k, omega) * omega /
+                        (2 * k_sqr) * exp(-k_sqr * l_sqr);
+    const real cell_area = M_PI_F * M_PI_F * 4 / (tile_size.x * tile_size.y);
+    out[idx] = gain * sqrt(0.5f * energy * cell_area) * noise[idx];
+#endif
+}
+
+// Replaces from by its blend with to, from + w * (to - from). Runs on one
+// work item per coefficient.
+kernel void blend_spectra(global real2 *from, global const real2 *to, real w)
+{
+    const int idx = get_global_id(0);
+    from[idx] = mix(from[idx], to[idx], w);
+}
@@ -1,22 +1,22 @@
 typedef float real;
-
-constant real two_pi = 6.28318530718;
-constant real T = 10.0; // time period in seconds
-
-real periodize_omega(real omega, real period)
-{
-    real omega_0 = two_pi / period;
-    return floor(omega / omega_0) * omega_0;
-}
-
-real dispersion_relation(real k)
-{
-    return periodize_omega(sqrt(9.80665 * k), T);
-}
+typedef float2 real2;
+typedef float4 real4;
 
 #define LOCAL_SIZE 64
 
-kernel void phase_shift(global const real *in, real Lx, real Lz, int N, int M, real t, real A, global real *out)
+// With REDUCED_FIELDS ddz_du, which equals ddx_dv, is not written and ddz_dv
+// takes its place.
+#ifdef REDUCED_FIELDS
+#define N_FIELDS 8
+#else
+#define N_FIELDS 9
+#endif
+
+// The initial spectrum is blended from in_from to in_to by w, see
+// spectrum::rebuild. wave_table holds (k_x, k_z, 1/k, omega) for each
+// coefficient, see spectrum::wave_tables. The fields are written to out from
+// field first_field on, see spectrum::enqueue_generate.
+kernel void phase_shift(global const real *in_from, global const real *in_to, real w, global const real4 *wave_table, int N, int M, real t, real A, global real *out, int first_field)
 {
     const int global_idx = get_global_id(0);
     const int local_idx = global_idx % LOCAL_SIZE;
@@ -28,6 +28,7 @@ kernel void phase_shift(global const real *in, real Lx, real Lz, int N, int M, r
     const size_t out_row_stride = N + 2;
     const size_t out_buf_stride = out_row_stride * M;
     const size_t out_idx = out_row_stride * z_i + 2 * x_i;
+    out += first_field * out_buf_stride;
 
     // Pointers to the Fourier transform of the displacement field.
     global real *dx_out =     out + 0 * out_buf_stride;
@@ -40,20 +41,19 @@ kernel void phase_shift(global const real *in, real Lx, real Lz, int N, int M, r
     global real *ddy_du_out = out + 5 * out_buf_stride;
     global real *ddy_dv_out = out + 6 * out_buf_stride;
     global real *ddz_du_out = out + 7 * out_buf_stride;
-    global real *ddz_dv_out = out + 8 * out_buf_stride;
+    global real *ddz_dv_out = out + (N_FIELDS - 1) * out_buf_stride;
 
-    const real k_x = two_pi * x_i / Lx;
-    const int z = (z_i + M / 2) % M - M / 2;
-    const real k_z = two_pi * z / Lz;
-    const real k = sqrt(k_x * k_x + k_z * k_z);
-
-    const real omega = dispersion_relation(k);
+    const real4 wave = wave_table[global_idx / 2];
+    const real k_x = wave.x;
+    const real k_z = wave.y;
+    const real factor = wave.z;
+    const real omega = wave.w;
     real cos_omegat;
     const real sin_omegat = sincos(omega * t, &cos_omegat);
 
     // Fourier transform of the height (y displacement) at t=0.
     local real h_tilde[LOCAL_SIZE];
-    h_tilde[local_idx] = A * in[global_idx];
+    h_tilde[local_idx] = A * mix(in_from[global_idx], in_to[global_idx], w);
 
     const real isign = i ? 1 : -1;
 
@@ -72,7 +72,6 @@ kernel void phase_shift(global const real *in, real Lx, real Lz, int N, int M, r
     dy_out[global_idx] = h_tilde_shifted[local_idx];
 
     // Horizontal displacement (choppy waves).
-    real factor = (k < (real)(1e-10)) ? ((real)(0)) : ((real)(1) / k);
     dx_out[global_idx] = dh_du_tilde_shifted[local_idx] * factor;
     dz_out[global_idx] = dh_dv_tilde_shifted[local_idx] * factor;
 
@@ -83,6 +82,79 @@ kernel void phase_shift(global const real *in, real Lx, real Lz, int N, int M, r
     // Jacobian of horizontal displacement.
     ddx_du_out[global_idx] = k_x * k_x * factor * h_tilde_shifted[local_idx];
     ddx_dv_out[global_idx] = k_x * k_z * factor * h_tilde_shifted[local_idx];
+#ifndef REDUCED_FIELDS
     ddz_du_out[global_idx] = k_z * k_x * factor * h_tilde_shifted[local_idx];
+#endif
     ddz_dv_out[global_idx] = k_z * k_z * factor * h_tilde_shifted[local_idx];
 }
+
+// Shifted spectra of all fields at coefficient idx of the half spectrum, in the
+// output order of phase_shift.
+void shifted_fields(global const real *in_from, global const real *in_to, real w, global const real4 *wave_table, int idx, real t, real A, real2 *f)
+{
+    const real4 wave = wave_table[idx];
+    const real k_x = wave.x;
+    const real k_z = wave.y;
+    const real factor = wave.z;
+    const real omega = wave.w;
+    real cos_omegat;
+    const real sin_omegat = sincos(omega * t, &cos_omegat);
+
+    // h = A * h0 * exp(i*omega*t), ih = i * h
+    const real2 h0 = A * mix(vload2(idx, in_from), vload2(idx, in_to), w);
+    const real2 h = (real2)(h0.x * cos_omegat - h0.y * sin_omegat, h0.y * cos_omegat + h0.x * sin_omegat);
+    const real2 ih = (real2)(-h.y, h.x);
+
+    f[0] = k_x * factor * ih;       // dx
+    f[1] = h;                       // dy
+    f[2] = k_z * factor * ih;       // dz
+    f[3] = k_x * k_x * factor * h;  // ddx_du
+    f[4] = k_x * k_z * factor * h;  // ddx_dv
+    f[5] = k_x * ih;                // ddy_du
+    f[6] = k_z * ih;                // ddy_dv
+#ifdef REDUCED_FIELDS
+    f[7] = k_z * k_z * factor * h;  // ddz_dv
+#else
+    f[7] = k_z * k_x * factor * h;  // ddz_du
+    f[8] = k_z * k_z * factor * h;  // ddz_dv
+#endif
+}
+
+// Same fields as phase_shift, but as (N_FIELDS + 1) / 2 full N x M complex
+// spectra: field 2p is the real part and field 2p+1 the imaginary part of
+// spectrum p. Since both fields are real, one complex inverse FFT yields both.
+// Spectrum p goes to spectrum first_field + p of out. Run on an N x M range.
+kernel void phase_shift_packed(global const real *in_from, global const real *in_to, real w, global const real4 *wave_table, int N, int M, real t, real A, global real2 *out, int first_field)
+{
+    const int x_i = get_global_id(0); // 0..N-1
+    const int z_i = get_global_id(1); // 0..M-1
+    const int size_x = N / 2 + 1;
+    const int mirror_z_i = (M - z_i) % M;
+
+    real2 f[N_FIELDS];
+    if (x_i <= N / 2) {
+        shifted_fields(in_from, in_to, w, wave_table, z_i * size_x + x_i, t, A, f);
+        if (x_i == 0 || x_i == N / 2) {
+            // These columns are their own mirror image. The hermitian-to-real
+            // transform only keeps their hermitian part, so do the same here.
+            real2 g[N_FIELDS];
+            shifted_fields(in_from, in_to, w, wave_table, mirror_z_i * size_x + x_i, t, A, g);
+            for (int j = 0; j < N_FIELDS; ++j)
+                f[j] = (real)(0.5) * (f[j] + (real2)(g[j].x, -g[j].y));
+        }
+    } else {
+        // Negative frequencies are the conjugates of the mirrored coefficients.
+        shifted_fields(in_from, in_to, w, wave_table, mirror_z_i * size_x + (N - x_i), t, A, f);
+        for (int j = 0; j < N_FIELDS; ++j)
+            f[j].y = -f[j].y;
+    }
+
+    const size_t out_buf_stride = N * M;
+    const size_t out_idx = z_i * N + x_i;
+    out += first_field * out_buf_stride;
+    for (int p = 0; 2 * p < N_FIELDS; ++p) {
+        const real2 a = f[2 * p];
+        const real2 b = (2 * p + 1 < N_FIELDS) ? f[2 * p + 1] : (real2)(0);
+        out[p * out_buf_stride + out_idx] = (real2)(a.x - b.y, a.y + b.x);
+    }
+}
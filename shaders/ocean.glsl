@@ -10,17 +10,29 @@
 // The model space vertex positions are calculated by the vertex shader.
 // In model space the ocean plane coincides with the xz plane.
 
+// The surface is the sum of num_cascades tiles (see ocean::surface_params::num_cascades), each with its own
+// displacement and normal texture. Cascade i is cascade_ratio[i] times smaller than the first one.
+#define MAX_CASCADES 4 // ocean::max_cascades
+uniform int num_cascades = 1;
+uniform float cascade_ratio[MAX_CASCADES] = float[](1.0f, 1.0f, 1.0f, 1.0f);
+
 // Displacement mapping is used to render the ocean surface.
-// The displacement is encoded in the RGB channels of the displacement texture map as a fraction of max_displacement, so
-//   displacement = displacement_tex_sample * max_displacement
-uniform sampler2D displacement_tex;
+// The displacement is encoded in the RGB channels of the displacement texture map as a fraction of max_displacement,
+// which is divided by the ratio for the smaller cascades, so
+//   displacement = displacement_tex_sample * max_displacement / cascade_ratio
+uniform sampler2D displacement_tex[MAX_CASCADES];
 uniform vec3 max_displacement = vec3(5, 5, 5);
 uniform vec3 units_per_meter;    // rendering units per displacement_map units (i.e. meters)
-uniform vec3 tile_size_logical;  // in rendering units
+uniform vec3 tile_size_logical;  // in rendering units, of the first cascade
 
 vec3 get_displacement(vec2 p, vec2 dp_dx, vec2 dp_dy)
 {
-    return units_per_meter * max_displacement * (2.0f * textureGrad(displacement_tex, p, dp_dx, dp_dy).xyz - 1.0f);
+    vec3 res = vec3(0);
+    for (int i = 0; i < num_cascades; ++i) {
+        float r = cascade_ratio[i];
+        res += (2.0f * textureGrad(displacement_tex[i], r * p, r * dp_dx, r * dp_dy).xyz - 1.0f) / r;
+    }
+    return units_per_meter * max_displacement * res;
 }
 
 // Displacement mapping is only used up to a certain distance. Beyond that a noise-perturbed normal is used.
@@ -200,7 +212,7 @@ smooth in vec2 uv_gs, duv_dx_gs, duv_dy_gs;
 
 out vec3 color_out;
 
-uniform sampler2D normal_tex;
+uniform sampler2D normal_tex[MAX_CASCADES];
 uniform samplerCube sky_env;
 uniform vec3 rf0_water = vec3(0.02, 0.02, 0.02);
 uniform vec3 diffuse_water = 0.4 * vec3(0.04, 0.16, 0.47);
@@ -217,9 +229,21 @@ vec3 fresnel_reflectance(vec3 rf0, vec3 normal, vec3 incident)
     return rf0 + (1.0f - rf0) * pow(1.0f - ccos_theta_i, 5.0f);
 }
 
+// The slopes of the cascades add up.
+vec3 get_normal(vec2 p, vec2 dp_dx, vec2 dp_dy)
+{
+    vec2 slope = vec2(0);
+    for (int i = 0; i < num_cascades; ++i) {
+        float r = cascade_ratio[i];
+        vec3 n = 2 * textureGrad(normal_tex[i], r * p, r * dp_dx, r * dp_dy).xyz - 1;
+        slope += n.xz / max(n.y, 1e-2f);
+    }
+    return normalize(vec3(slope.x, 1, slope.y));
+}
+
 void main()
 {
-    vec3 normal = 2 * textureGrad(normal_tex, uv_gs, duv_dx_gs, duv_dy_gs).xyz - 1;
+    vec3 normal = get_normal(uv_gs, duv_dx_gs, duv_dy_gs);
 
     // Fade out normal displacement with distance.
     float distance_to_camera = length(camera.model_transform.position - model_pos_gs);
@@ -0,0 +1,320 @@
+#include <api/cpu/fft.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include <api/cpu/simd.h>
+#include <util/error.h>
+
+using math::real;
+
+namespace cpu {
+namespace fft {
+
+namespace {
+
+bool is_power_of_two(int n) { return n > 0 && (n & (n - 1)) == 0; }
+
+// Number of columns the column pass transforms together. The rows of a block
+// are 64 bytes long, and the butterflies vectorize across the block.
+constexpr int column_block_width = 8;
+
+// Number of columns COLUMN_PASS_TRANSPOSED moves into contiguous rows at a
+// time; every row of the spectrum is read in 256 byte pieces.
+constexpr int transposed_strip_width = 32;
+
+// Avoids the NaN/inf handling of std::complex multiplication, which keeps
+// the butterflies from vectorizing.
+inline complex mul(const complex &a, const complex &b)
+{
+    return complex(a.real() * b.real() - a.imag() * b.imag(), a.real() * b.imag() + a.imag() * b.real());
+}
+
+// Multiplication by the imaginary unit.
+inline complex mul_i(const complex &a) { return complex(-a.imag(), a.real()); }
+
+// exp(+i*2*pi*k/length), the twiddle factors of the backward transform.
+complex twiddle(int k, int length)
+{
+    double phi = 2.0 * 3.14159265358979323846 * k / length;
+    return complex(real(std::cos(phi)), real(std::sin(phi)));
+}
+
+// In-place unnormalized backward FFT of width interleaved sequences: element
+// j of sequence c is data[j * Width + c]. The input is bit reversed first,
+// then an odd log2(length) gets one radix-2 stage, and the rest is done in
+// radix-4 stages.
+template <int Width>
+void inverse_fft(const fft_plan &plan, complex *data)
+{
+    const int length = plan.length;
+    for (int i = 0; i < length; ++i) {
+        int j = plan.bit_reverse[i];
+        if (i < j)
+            for (int c = 0; c < Width; ++c)
+                std::swap(data[i * Width + c], data[j * Width + c]);
+    }
+
+    int half = 1;
+    if (plan.has_radix2_stage) {
+        for (int start = 0; start < length; start += 2) {
+            complex *p0 = data + start * Width, *p1 = p0 + Width;
+            for (int c = 0; c < Width; ++c) {
+                complex a = p0[c], b = p1[c];
+                p0[c] = a + b;
+                p1[c] = a - b;
+            }
+        }
+        half = 2;
+    }
+
+    // Each radix-4 stage merges four transforms of length half into one of
+    // length 4 * half, using W(2h)^k, W(4h)^k and W(4h)^3k per k. The three
+    // twiddle arrays of a stage are stored one after the other.
+    const complex *twiddles = plan.twiddles.data();
+    for (; half < length; half *= 4) {
+        const complex *w1s = twiddles, *w2s = twiddles + half, *w3s = twiddles + 2 * half;
+        for (int start = 0; start < length; start += 4 * half) {
+            for (int k = 0; k < half; ++k) {
+                const complex w1 = w1s[k], w2 = w2s[k], w3 = w3s[k];
+                complex *p0 = data + (start + k) * Width;
+                complex *p1 = p0 + half * Width;
+                complex *p2 = p1 + half * Width;
+                complex *p3 = p2 + half * Width;
+                for (int c = 0; c < Width; ++c) {
+                    const complex q1 = mul(w1, p1[c]), q2 = mul(w2, p2[c]), q3 = mul(w3, p3[c]);
+                    const complex a0 = p0[c] + q1, a1 = p0[c] - q1;
+                    const complex s = q2 + q3, d = mul_i(q2 - q3);
+                    p0[c] = a0 + s;
+                    p1[c] = a1 + d;
+                    p2[c] = a0 - s;
+                    p3[c] = a1 - d;
+                }
+            }
+        }
+        twiddles += 3 * half;
+    }
+}
+
+// dst[c * dst_stride + r] = src[r * src_stride + c] for a rows x cols block.
+typedef void (*transpose_function)(
+    const complex *src,
+    size_t src_stride,
+    complex *dst,
+    size_t dst_stride,
+    int rows,
+    int cols);
+
+void transpose_scalar(
+    const complex *src,
+    size_t src_stride,
+    complex *dst,
+    size_t dst_stride,
+    int rows,
+    int cols)
+{
+    for (int r = 0; r < rows; ++r)
+        for (int c = 0; c < cols; ++c)
+            dst[c * dst_stride + r] = src[r * src_stride + c];
+}
+
+#if CPU_SIMD_X86
+
+// A complex number has the size of a double, so 4x4 tiles are transposed
+// with the 64-bit lane shuffles.
+CPU_SIMD_TARGET_AVX2 void transpose_avx2(
+    const complex *src,
+    size_t src_stride,
+    complex *dst,
+    size_t dst_stride,
+    int rows,
+    int cols)
+{
+    static_assert(sizeof(complex) == sizeof(double), "Complex has to fit a 64-bit lane.");
+    int r = 0;
+    for (; r + 4 <= rows; r += 4) {
+        int c = 0;
+        for (; c + 4 <= cols; c += 4) {
+            const double *s = reinterpret_cast<const double *>(src + r * src_stride + c);
+            const __m256d r0 = _mm256_loadu_pd(s);
+            const __m256d r1 = _mm256_loadu_pd(s + src_stride);
+            const __m256d r2 = _mm256_loadu_pd(s + 2 * src_stride);
+            const __m256d r3 = _mm256_loadu_pd(s + 3 * src_stride);
+            const __m256d t0 = _mm256_unpacklo_pd(r0, r1), t1 = _mm256_unpackhi_pd(r0, r1);
+            const __m256d t2 = _mm256_unpacklo_pd(r2, r3), t3 = _mm256_unpackhi_pd(r2, r3);
+            double *d = reinterpret_cast<double *>(dst + c * dst_stride + r);
+            _mm256_storeu_pd(d, _mm256_permute2f128_pd(t0, t2, 0x20));
+            _mm256_storeu_pd(d + dst_stride, _mm256_permute2f128_pd(t1, t3, 0x20));
+            _mm256_storeu_pd(d + 2 * dst_stride, _mm256_permute2f128_pd(t0, t2, 0x31));
+            _mm256_storeu_pd(d + 3 * dst_stride, _mm256_permute2f128_pd(t1, t3, 0x31));
+        }
+        if (c < cols)
+            transpose_scalar(src + r * src_stride + c, src_stride, dst + c * dst_stride + r,
+                             dst_stride, 4, cols - c);
+    }
+    if (r < rows)
+        transpose_scalar(src + r * src_stride, src_stride, dst + r, dst_stride, rows - r, cols);
+}
+
+#endif // CPU_SIMD_X86
+
+transpose_function get_transpose_function()
+{
+#if CPU_SIMD_X86
+    if (cpu::simd::get_instruction_set() >= cpu::simd::INSTRUCTION_SET_AVX2)
+        return transpose_avx2;
+#endif
+    return transpose_scalar;
+}
+
+} // unnamed namespace
+
+fft_plan::fft_plan(int length) : length(length)
+{
+    int log2_length = 0;
+    while ((1 << log2_length) < length)
+        ++log2_length;
+    bit_reverse.resize(length);
+    for (int i = 0; i < length; ++i) {
+        int r = 0;
+        for (int b = 0; b < log2_length; ++b)
+            r |= ((i >> b) & 1) << (log2_length - 1 - b);
+        bit_reverse[i] = r;
+    }
+
+    // Twiddles of all radix-4 stages, in the order they are used.
+    has_radix2_stage = (log2_length % 2) == 1;
+    for (int half = has_radix2_stage ? 2 : 1; half < length; half *= 4) {
+        for (int k = 0; k < half; ++k)
+            twiddles.push_back(twiddle(k, 2 * half));
+        for (int k = 0; k < half; ++k)
+            twiddles.push_back(twiddle(k, 4 * half));
+        for (int k = 0; k < half; ++k)
+            twiddles.push_back(twiddle(3 * k, 4 * half));
+    }
+}
+
+ifft2d_hermitian_inplace::ifft2d_hermitian_inplace(
+    util::thread_pool &pool,
+    const math::ivec2 &size,
+    size_t num_batches,
+    column_pass pass)
+    : pool(pool)
+    , size(size)
+    , num_batches(num_batches)
+    , pass(pass)
+    , row_plan(size.x / 2)
+    , column_plan(size.y)
+{
+    if (!is_power_of_two(size.x) || !is_power_of_two(size.y) || size.x < 2)
+        DIE("FFT size has to be a power of two, got %dx%d.\n", size.x, size.y);
+    row_twiddles.resize(size.x / 2);
+    for (int k = 0; k < size.x / 2; ++k)
+        row_twiddles[k] = twiddle(k, size.x);
+}
+
+void ifft2d_hermitian_inplace::transform(real *buffer)
+{
+    const int N = size.x, M = size.y;
+    const int num_columns = N / 2 + 1;
+    const bool transposed = pass == COLUMN_PASS_TRANSPOSED;
+    const int block_width = transposed ? transposed_strip_width : column_block_width;
+    const int num_blocks = (num_columns + block_width - 1) / block_width;
+    const size_t batch_stride = size_t(N + 2) * M;
+
+    // Complex transforms along y, a block of columns at a time.
+    pool.parallel_for(int(num_batches) * num_blocks, [&](int begin, int end) {
+        std::vector<complex> scratch(size_t(M) * block_width);
+        for (int idx = begin; idx < end; ++idx) {
+            auto batch = reinterpret_cast<complex *>(buffer + (idx / num_blocks) * batch_stride);
+            int first_column = (idx % num_blocks) * block_width;
+            int width = std::min(block_width, num_columns - first_column);
+            if (transposed)
+                transform_columns_transposed(batch, first_column, width, scratch.data());
+            else
+                transform_columns(batch, first_column, width, scratch.data());
+        }
+    });
+
+    // Hermitian to real transforms along x.
+    pool.parallel_for(int(num_batches) * M, [&](int begin, int end) {
+        for (int row = begin; row < end; ++row)
+            transform_row(buffer + size_t(row) * (N + 2));
+    }, 8);
+}
+
+void ifft2d_hermitian_inplace::transform_columns(
+    complex *batch,
+    int first_column,
+    int num_columns,
+    complex *scratch)
+{
+    // Gather the block into contiguous rows of column_block_width, so every
+    // row of the spectrum is read and written as a whole cache line.
+    const int M = size.y;
+    const int row_stride = size.x / 2 + 1;
+    if (num_columns == column_block_width) {
+        for (int j = 0; j < M; ++j)
+            std::copy_n(batch + size_t(j) * row_stride + first_column, column_block_width,
+                        scratch + j * column_block_width);
+        inverse_fft<column_block_width>(column_plan, scratch);
+        for (int j = 0; j < M; ++j)
+            std::copy_n(scratch + j * column_block_width, column_block_width,
+                        batch + size_t(j) * row_stride + first_column);
+        return;
+    }
+
+    for (int c = first_column; c < first_column + num_columns; ++c) {
+        for (int j = 0; j < M; ++j)
+            scratch[j] = batch[size_t(j) * row_stride + c];
+        inverse_fft<1>(column_plan, scratch);
+        for (int j = 0; j < M; ++j)
+            batch[size_t(j) * row_stride + c] = scratch[j];
+    }
+}
+
+void ifft2d_hermitian_inplace::transform_columns_transposed(
+    complex *batch,
+    int first_column,
+    int num_columns,
+    complex *scratch)
+{
+    // Strip of num_columns x M in scratch, one column per row.
+    static const transpose_function transpose = get_transpose_function();
+    const int M = size.y;
+    const int row_stride = size.x / 2 + 1;
+    transpose(batch + first_column, row_stride, scratch, M, M, num_columns);
+    for (int c = 0; c < num_columns; ++c)
+        inverse_fft<1>(column_plan, scratch + size_t(c) * M);
+    transpose(scratch, M, batch + first_column, row_stride, num_columns, M);
+}
+
+void ifft2d_hermitian_inplace::transform_row(real *row)
+{
+    // A real sequence of length N is computed as one complex transform of
+    // length N / 2, z = x_even + i * x_odd, with the spectrum
+    //   Z[k] = E[k] + i * O[k],
+    //   E[k] = X[k] + conj(X[N/2 - k]),
+    //   O[k] = (X[k] - conj(X[N/2 - k])) * exp(+i*2*pi*k/N).
+    // Z[k] and Z[N/2 - k] only depend on X[k] and X[N/2 - k], so the spectrum
+    // is rewritten in place, and z in memory is exactly x.
+    // Only the real parts of X[0] and X[N/2] contribute to a real sequence.
+    const int half = size.x / 2;
+    auto X = reinterpret_cast<complex *>(row);
+    const real dc = X[0].real(), nyquist = X[half].real();
+    X[0] = complex(dc + nyquist, dc - nyquist);
+    for (int k = 1; k <= half / 2; ++k) {
+        const int l = half - k;
+        const complex a = X[k], b = X[l];
+        const complex e_k = a + std::conj(b), o_k = a - std::conj(b);
+        X[k] = e_k + mul_i(mul(o_k, row_twiddles[k]));
+        if (l != k) {
+            const complex e_l = b + std::conj(a), o_l = b - std::conj(a);
+            X[l] = e_l + mul_i(mul(o_l, row_twiddles[l]));
+        }
+    }
+    inverse_fft<1>(row_plan, X);
+}
+
+} // namespace fft
+} // namespace cpu
@@ -0,0 +1,86 @@
+#include <api/cpu/simd.h>
+
+#include <cstdlib>
+#include <cstring>
+
+#if CPU_SIMD_X86 && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include <util/log.h>
+
+namespace cpu {
+namespace simd {
+
+namespace {
+
+instruction_set detect_instruction_set()
+{
+#if CPU_SIMD_X86 && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx2") &&
+        __builtin_cpu_supports("fma"))
+        return INSTRUCTION_SET_AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return INSTRUCTION_SET_AVX2;
+#elif CPU_SIMD_X86 && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return INSTRUCTION_SET_SCALAR;
+    __cpuid(info, 1);
+    const bool has_fma = (info[2] & (1 << 12)) != 0;
+    const bool has_osxsave = (info[2] & (1 << 27)) != 0;
+    if (!has_fma || !has_osxsave)
+        return INSTRUCTION_SET_SCALAR;
+    // The OS has to save the ymm (and zmm) registers on context switch.
+    unsigned long long xcr0 = _xgetbv(0);
+    const bool has_ymm_state = (xcr0 & 0x6) == 0x6;
+    const bool has_zmm_state = (xcr0 & 0xe6) == 0xe6;
+    __cpuidex(info, 7, 0);
+    const bool has_avx2 = (info[1] & (1 << 5)) != 0;
+    const bool has_avx512f = (info[1] & (1 << 16)) != 0;
+    if (has_avx2 && has_avx512f && has_zmm_state)
+        return INSTRUCTION_SET_AVX512;
+    if (has_avx2 && has_ymm_state)
+        return INSTRUCTION_SET_AVX2;
+#endif
+    return INSTRUCTION_SET_SCALAR;
+}
+
+instruction_set apply_override(instruction_set detected)
+{
+    const char *requested = getenv("OCEAN_SIMD");
+    if (!requested)
+        return detected;
+    for (int set = INSTRUCTION_SET_SCALAR; set <= detected; ++set) {
+        if (strcmp(requested, get_instruction_set_name(instruction_set(set))) == 0)
+            return instruction_set(set);
+    }
+    LOG("OCEAN_SIMD=%s is not supported, using %s.\n", requested, get_instruction_set_name(detected));
+    return detected;
+}
+
+} // unnamed namespace
+
+instruction_set get_instruction_set()
+{
+    static instruction_set set = apply_override(detect_instruction_set());
+    return set;
+}
+
+const char *get_instruction_set_name(instruction_set set)
+{
+    switch (set) {
+    case INSTRUCTION_SET_AVX2:
+        return "avx2";
+    case INSTRUCTION_SET_AVX512:
+        return "avx512";
+    case INSTRUCTION_SET_SCALAR:
+    default:
+        return "scalar";
+    }
+}
+
+} // namespace simd
+} // namespace cpu
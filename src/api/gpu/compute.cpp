@@ -1,6 +1,10 @@
 #include <api/gpu/compute.h>
 
 #include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
 #include <iterator>
 #include <sstream>
 #include <string>
@@ -45,7 +49,6 @@ std::string extension_set::to_string() const
     return ss.str();
 }
 
-namespace {
 compute::device get_device(cl_device_type device_type, const extension_set &required_extensions)
 {
     std::vector<compute::platform> platforms;
@@ -75,59 +78,167 @@ compute::device get_device(cl_device_type device_type, const extension_set &requ
     return compute::device();
 }
 
-} // unnamed namespace
+command_queue init_headless(cl_device_type device_type)
+{
+    auto c_device = get_device(device_type, extension_set());
+    auto c_context = context(c_device);
+    return command_queue(c_context, c_device, cl::QueueProperties::Profiling);
+}
 
-command_queue init(const os::window &window)
+bool has_device(cl_device_type device_type)
 {
-    extension_set required_extensions = { "cl_khr_gl_sharing" };
+    // Without an ICD or a device of the type, the queries throw.
+    std::vector<platform> platforms;
+    try {
+        platform::get(&platforms);
+    } catch (const cl::Error &) {
+        return false;
+    }
+    for (auto &platform : platforms) {
+        std::vector<device> devices;
+        try {
+            platform.getDevices(device_type, &devices);
+        } catch (const cl::Error &) {
+            continue;
+        }
+        if (!devices.empty())
+            return true;
+    }
+    return false;
+}
 
-    auto c_device = get_device(CL_DEVICE_TYPE_GPU, required_extensions);
-    auto c_platform_id = c_device.getInfo<CL_DEVICE_PLATFORM>();
+namespace {
 
-    cl_context_properties display_handle = window.get_display_handle();
+void log_build_errors(program &res, const std::vector<device> &devices)
+{
+    for (auto device : devices) {
+        auto device_name = device.getInfo<CL_DEVICE_NAME>();
+        auto build_log = res.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device);
+        LOG("%s: %s\n", device_name.c_str(), build_log.c_str());
+    }
+}
 
-    cl_context_properties display_property;
-    switch (window.get_wm_type()) {
-    case os::window::WM_TYPE_WINDOWS:
-        display_property = CL_WGL_HDC_KHR;
-        break;
-    case os::window::WM_TYPE_X11:
-        display_property = CL_GLX_DISPLAY_KHR;
-        break;
-    default:
-        DIE("Unsupported windowing system\n.");
+// 64-bit FNV-1a.
+uint64_t hash_string(const std::string &str, uint64_t hash = 14695981039346656037ull)
+{
+    for (unsigned char c : str) {
+        hash ^= c;
+        hash *= 1099511628211ull;
     }
+    return hash;
+}
 
-    cl_context_properties context_properties[] = { CL_CONTEXT_PLATFORM,
-                                                   reinterpret_cast<cl_context_properties>(c_platform_id),
-                                                   CL_GL_CONTEXT_KHR,
-                                                   reinterpret_cast<cl_context_properties>(
-                                                       window.get_graphics_context()),
-                                                   display_property,
-                                                   display_handle,
-                                                   0 };
-    auto c_context = context(c_device, context_properties, nullptr, nullptr);
+// Binaries are only valid for the exact source, options, device and driver
+// they were built with, so all of these go into the file name.
+std::string get_binary_cache_path(
+    const char *file_name,
+    const std::string &source,
+    const std::string &options,
+    const device &compute_device)
+{
+    uint64_t hash = hash_string(source);
+    hash = hash_string(options, hash);
+    hash = hash_string(compute_device.getInfo<CL_DEVICE_NAME>(), hash);
+    hash = hash_string(compute_device.getInfo<CL_DRIVER_VERSION>(), hash);
 
-    return command_queue(c_context, c_device, cl::QueueProperties::Profiling);
+    std::string base_name = file_name;
+    auto sep = base_name.find_last_of("/\\");
+    if (sep != std::string::npos)
+        base_name = base_name.substr(sep + 1);
+
+    char hash_str[17];
+    snprintf(hash_str, sizeof(hash_str), "%016llx", static_cast<unsigned long long>(hash));
+    return util::get_cache_directory("kernels") + "/" + base_name + "." + hash_str + ".bin";
 }
 
-program create_program_from_file(context c_context, const char *file_name)
+bool read_binary(const std::string &path, std::vector<unsigned char> &binary)
 {
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return false;
+    binary.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return !binary.empty();
+}
+
+void write_binary(const std::string &path, const std::vector<unsigned char> &binary)
+{
+    // Write to a temporary file first so that a concurrent start never
+    // reads a partially written binary.
+    std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios::binary);
+        out.write(reinterpret_cast<const char *>(binary.data()), binary.size());
+        if (!out) {
+            LOG("Cannot write program binary %s.\n", tmp_path.c_str());
+            return;
+        }
+    }
+    std::remove(path.c_str());
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0)
+        std::remove(tmp_path.c_str());
+}
+
+bool load_program_binary(
+    context c_context,
+    const device &compute_device,
+    const std::string &cache_path,
+    const std::string &options,
+    program &res)
+{
+    std::vector<unsigned char> binary;
+    if (!read_binary(cache_path, binary))
+        return false;
+
+    try {
+        std::vector<device> devices = { compute_device };
+        res = program(c_context, devices, program::Binaries{ binary });
+        res.build(devices, options.c_str());
+    } catch (const cl::Error &e) {
+        LOG("Discarding stale program binary %s: %s.\n", cache_path.c_str(),
+            get_error_string(e.err()));
+        std::remove(cache_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+} // unnamed namespace
+
+program create_program_from_file(context c_context, const char *file_name, const std::string &options)
+{
+    auto start_time = std::chrono::steady_clock::now();
     auto source = util::read_file_contents(file_name);
-    auto res = program(c_context, source, false);
     auto devices = c_context.getInfo<CL_CONTEXT_DEVICES>();
 
-    try {
-        res.build(devices);
-    } catch (cl::Error e) {
-        for (auto device : devices) {
-            auto device_name = device.getInfo<CL_DEVICE_NAME>();
-            auto build_log = res.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device);
-            LOG("%s: %s\n", device_name.c_str(), build_log.c_str());
+    // The binary cache is used for the usual single device contexts only.
+    std::string cache_path;
+    if (devices.size() == 1)
+        cache_path = get_binary_cache_path(file_name, source, options, devices[0]);
+
+    program res;
+    bool from_cache =
+        !cache_path.empty() && load_program_binary(c_context, devices[0], cache_path, options, res);
+
+    if (!from_cache) {
+        res = program(c_context, source, false);
+        try {
+            res.build(devices, options.c_str());
+        } catch (const cl::Error &) {
+            log_build_errors(res, devices);
+            throw;
+        }
+
+        if (!cache_path.empty()) {
+            auto binaries = res.getInfo<CL_PROGRAM_BINARIES>();
+            if (!binaries.empty() && !binaries[0].empty())
+                write_binary(cache_path, binaries[0]);
         }
-        throw;
     }
 
+    auto build_time = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start_time);
+    LOG("%s %s in %.1f ms.\n", from_cache ? "Loaded cached binary of" : "Built", file_name,
+        build_time.count());
     return res;
 }
 
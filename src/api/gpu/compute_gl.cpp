@@ -0,0 +1,44 @@
+#include <api/gpu/compute.h>
+
+#include <api/os/window.h>
+#include <util/error.h>
+
+namespace gpu {
+namespace compute {
+
+command_queue init(const os::window &window)
+{
+    extension_set required_extensions = { "cl_khr_gl_sharing" };
+
+    auto c_device = get_device(CL_DEVICE_TYPE_GPU, required_extensions);
+    auto c_platform_id = c_device.getInfo<CL_DEVICE_PLATFORM>();
+
+    cl_context_properties display_handle = window.get_display_handle();
+
+    cl_context_properties display_property;
+    switch (window.get_wm_type()) {
+    case os::window::WM_TYPE_WINDOWS:
+        display_property = CL_WGL_HDC_KHR;
+        break;
+    case os::window::WM_TYPE_X11:
+        display_property = CL_GLX_DISPLAY_KHR;
+        break;
+    default:
+        DIE("Unsupported windowing system\n.");
+    }
+
+    cl_context_properties context_properties[] = { CL_CONTEXT_PLATFORM,
+                                                   reinterpret_cast<cl_context_properties>(c_platform_id),
+                                                   CL_GL_CONTEXT_KHR,
+                                                   reinterpret_cast<cl_context_properties>(
+                                                       window.get_graphics_context()),
+                                                   display_property,
+                                                   display_handle,
+                                                   0 };
+    auto c_context = context(c_device, context_properties, nullptr, nullptr);
+
+    return command_queue(c_context, c_device, cl::QueueProperties::Profiling);
+}
+
+} // namespace compute
+} // namespace gpu
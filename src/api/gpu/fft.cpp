@@ -1,7 +1,14 @@
 #include <api/gpu/fft.h>
 
 #include <api/math.h>
+#include <chrono>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <tuple>
 #include <util/error.h>
+#include <util/log.h>
+#include <util/util.h>
 
 namespace gpu {
 namespace fft {
@@ -48,6 +55,12 @@ class fft_api {
 public:
     fft_api()
     {
+        // clFFT stores the binaries of the kernels it generates in
+        // CLFFT_CACHE_PATH and loads them from there instead of compiling
+        // them again on the next run.
+        if (!getenv("CLFFT_CACHE_PATH"))
+            util::set_environment_variable("CLFFT_CACHE_PATH", util::get_cache_directory("clfft"));
+
         clfftSetupData setupData;
         CLFFT_CHECK(clfftInitSetupData(&setupData));
         CLFFT_CHECK(clfftSetup(&setupData));
@@ -68,41 +81,125 @@ struct clfft_precision<double> {
     static constexpr auto value = CLFFT_DOUBLE;
 };
 
-} // namespace detail
+// Baked plans shared by all transforms of the process, so recreating the
+// surface (e.g. switching back to an FFT size used before) skips the bake.
+// Plans live until the clFFT teardown at exit.
+class plan_cache {
+public:
+    enum layout { LAYOUT_HERMITIAN_TO_REAL, LAYOUT_COMPLEX };
 
-ifft2d_hermitian_inplace::ifft2d_hermitian_inplace(
-    gpu::compute::command_queue queue,
-    const math::ivec2 &size,
-    size_t num_batches)
-{
-    static detail::fft_api fft_api;
-    size_t N = size.x;
-    size_t M = size.y;
-    size_t lenghts[] = { N, M };
-    size_t in_stride[] = { 1, N / 2 + 1 };
-    size_t out_stride[] = { 1, N + 2 };
-
-    auto context = queue.getInfo<CL_QUEUE_CONTEXT>();
-    CLFFT_CHECK(clfftCreateDefaultPlan(&fft_plan, context(), CLFFT_2D, lenghts));
-    CLFFT_CHECK(clfftSetPlanBatchSize(fft_plan, num_batches));
-    CLFFT_CHECK(clfftSetPlanPrecision(fft_plan, detail::clfft_precision<math::real>::value));
-    CLFFT_CHECK(clfftSetResultLocation(fft_plan, CLFFT_INPLACE));
-    CLFFT_CHECK(clfftSetLayout(fft_plan, CLFFT_HERMITIAN_INTERLEAVED, CLFFT_REAL));
-    CLFFT_CHECK(clfftSetPlanInStride(fft_plan, CLFFT_2D, in_stride));
-    CLFFT_CHECK(clfftSetPlanOutStride(fft_plan, CLFFT_2D, out_stride));
-    CLFFT_CHECK(clfftSetPlanScale(fft_plan, CLFFT_BACKWARD, cl_float(1)));
-    CLFFT_CHECK(clfftSetPlanDistance(fft_plan, M * (N / 2 + 1), M * (N + 2)));
-
-    CLFFT_CHECK(clfftBakePlan(fft_plan, 1, &queue(), nullptr, nullptr));
+    plan_cache() = default;
+    ~plan_cache()
+    {
+        for (auto &entry : plans)
+            clfftDestroyPlan(&entry.second.plan);
+    }
+    plan_cache(const plan_cache &) = delete;
+    plan_cache &operator=(const plan_cache &) = delete;
 
-    size_t tmp_sz;
-    CLFFT_CHECK(clfftGetTmpBufSize(fft_plan, &tmp_sz));
-    tmp_buf = gpu::compute::buffer(context, CL_MEM_READ_WRITE, tmp_sz);
-}
+    api::plan_handle get_plan(
+        gpu::compute::command_queue queue,
+        const math::ivec2 &size,
+        size_t num_batches,
+        layout plan_layout)
+    {
+        auto context = queue.getInfo<CL_QUEUE_CONTEXT>();
+        auto device = queue.getInfo<CL_QUEUE_DEVICE>();
+        plan_key key = { context(),
+                         device(),
+                         size_t(size.x),
+                         size_t(size.y),
+                         num_batches,
+                         clfft_precision<math::real>::value,
+                         plan_layout };
 
-ifft2d_hermitian_inplace::~ifft2d_hermitian_inplace() { clfftDestroyPlan(&fft_plan); }
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = plans.find(key);
+        if (it != plans.end())
+            return it->second.plan;
 
-gpu::compute::event ifft2d_hermitian_inplace::enqueue_transform(
+        auto start_time = std::chrono::steady_clock::now();
+        api::plan_handle plan = create_plan(queue, key);
+        auto bake_time = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start_time);
+        LOG("Baked %dx%d FFT plan with %d batches in %.1f ms.\n", size.x, size.y,
+            int(num_batches), bake_time.count());
+
+        // Keep the context alive while its plans are cached, so that its
+        // handle cannot be reused by another context.
+        plans[key] = { context, plan };
+        return plan;
+    }
+
+private:
+    struct plan_key {
+        cl_context context;
+        cl_device_id device;
+        size_t N, M;
+        size_t num_batches;
+        clfftPrecision precision;
+        layout plan_layout;
+
+        bool operator<(const plan_key &rhs) const
+        {
+            return std::tie(context, device, N, M, num_batches, precision, plan_layout) <
+                   std::tie(rhs.context, rhs.device, rhs.N, rhs.M, rhs.num_batches,
+                            rhs.precision, rhs.plan_layout);
+        }
+    };
+
+    struct plan_entry {
+        gpu::compute::context context;
+        api::plan_handle plan;
+    };
+
+    static api::plan_handle create_plan(gpu::compute::command_queue queue, const plan_key &key)
+    {
+        size_t N = key.N;
+        size_t M = key.M;
+        size_t lenghts[] = { N, M };
+
+        api::plan_handle plan;
+        CLFFT_CHECK(clfftCreateDefaultPlan(&plan, key.context, CLFFT_2D, lenghts));
+        CLFFT_CHECK(clfftSetPlanBatchSize(plan, key.num_batches));
+        CLFFT_CHECK(clfftSetPlanPrecision(plan, key.precision));
+        CLFFT_CHECK(clfftSetResultLocation(plan, CLFFT_INPLACE));
+        CLFFT_CHECK(clfftSetPlanScale(plan, CLFFT_BACKWARD, cl_float(1)));
+
+        if (key.plan_layout == LAYOUT_HERMITIAN_TO_REAL) {
+            size_t in_stride[] = { 1, N / 2 + 1 };
+            size_t out_stride[] = { 1, N + 2 };
+            CLFFT_CHECK(clfftSetLayout(plan, CLFFT_HERMITIAN_INTERLEAVED, CLFFT_REAL));
+            CLFFT_CHECK(clfftSetPlanInStride(plan, CLFFT_2D, in_stride));
+            CLFFT_CHECK(clfftSetPlanOutStride(plan, CLFFT_2D, out_stride));
+            CLFFT_CHECK(clfftSetPlanDistance(plan, M * (N / 2 + 1), M * (N + 2)));
+        } else {
+            size_t stride[] = { 1, N };
+            CLFFT_CHECK(clfftSetLayout(plan, CLFFT_COMPLEX_INTERLEAVED, CLFFT_COMPLEX_INTERLEAVED));
+            CLFFT_CHECK(clfftSetPlanInStride(plan, CLFFT_2D, stride));
+            CLFFT_CHECK(clfftSetPlanOutStride(plan, CLFFT_2D, stride));
+            CLFFT_CHECK(clfftSetPlanDistance(plan, M * N, M * N));
+        }
+
+        CLFFT_CHECK(clfftBakePlan(plan, 1, &queue(), nullptr, nullptr));
+        return plan;
+    }
+
+    std::map<plan_key, plan_entry> plans;
+    std::mutex mutex;
+};
+
+plan_cache &get_plan_cache()
+{
+    // The cache is destroyed before the library is torn down.
+    static fft_api fft_api;
+    static plan_cache cache;
+    return cache;
+}
+
+gpu::compute::event enqueue_backward_transform(
+    api::plan_handle fft_plan,
+    gpu::compute::memory_object tmp_buf,
     gpu::compute::command_queue queue,
     gpu::compute::memory_object buffer,
     gpu::compute::event_vector *wait_events)
@@ -120,5 +217,55 @@ gpu::compute::event ifft2d_hermitian_inplace::enqueue_transform(
     return cl::Event(res_event);
 }
 
+} // namespace detail
+
+ifft2d_hermitian_inplace::ifft2d_hermitian_inplace(
+    gpu::compute::command_queue queue,
+    const math::ivec2 &size,
+    size_t num_batches)
+{
+    fft_plan = detail::get_plan_cache().get_plan(
+        queue, size, num_batches, detail::plan_cache::LAYOUT_HERMITIAN_TO_REAL);
+
+    size_t tmp_sz;
+    CLFFT_CHECK(clfftGetTmpBufSize(fft_plan, &tmp_sz));
+    if (tmp_sz > 0) {
+        auto context = queue.getInfo<CL_QUEUE_CONTEXT>();
+        tmp_buf = gpu::compute::buffer(context, CL_MEM_READ_WRITE, tmp_sz);
+    }
+}
+
+gpu::compute::event ifft2d_hermitian_inplace::enqueue_transform(
+    gpu::compute::command_queue queue,
+    gpu::compute::memory_object buffer,
+    gpu::compute::event_vector *wait_events)
+{
+    return detail::enqueue_backward_transform(fft_plan, tmp_buf, queue, buffer, wait_events);
+}
+
+ifft2d_complex_inplace::ifft2d_complex_inplace(
+    gpu::compute::command_queue queue,
+    const math::ivec2 &size,
+    size_t num_batches)
+{
+    fft_plan = detail::get_plan_cache().get_plan(
+        queue, size, num_batches, detail::plan_cache::LAYOUT_COMPLEX);
+
+    size_t tmp_sz;
+    CLFFT_CHECK(clfftGetTmpBufSize(fft_plan, &tmp_sz));
+    if (tmp_sz > 0) {
+        auto context = queue.getInfo<CL_QUEUE_CONTEXT>();
+        tmp_buf = gpu::compute::buffer(context, CL_MEM_READ_WRITE, tmp_sz);
+    }
+}
+
+gpu::compute::event ifft2d_complex_inplace::enqueue_transform(
+    gpu::compute::command_queue queue,
+    gpu::compute::memory_object buffer,
+    gpu::compute::event_vector *wait_events)
+{
+    return detail::enqueue_backward_transform(fft_plan, tmp_buf, queue, buffer, wait_events);
+}
+
 } // namespace fft
 } // namespace gpu
@@ -0,0 +1,60 @@
+#include <api/gpu/mapped_buffer.h>
+
+#include <algorithm>
+
+namespace gpu {
+namespace compute {
+
+mapped_buffer_ring::mapped_buffer_ring(command_queue queue, size_t size, int num_buffers)
+    : queue(queue)
+    , size(size)
+    , slots(std::max(num_buffers, 2))
+    , next_slot(0)
+{
+    auto context = queue.getInfo<CL_QUEUE_CONTEXT>();
+    for (auto &s : slots) {
+        s.host_buffer = buffer(
+            context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR | CL_MEM_HOST_READ_ONLY, size);
+        s.data = nullptr;
+    }
+}
+
+mapped_buffer_ring::~mapped_buffer_ring()
+{
+    for (auto &s : slots)
+        if (s.data)
+            queue.enqueueUnmapMemObject(s.host_buffer, s.data);
+    queue.finish();
+}
+
+int mapped_buffer_ring::enqueue_copy(const buffer &src, const event_vector *wait_events)
+{
+    const int i = next_slot;
+    next_slot = (next_slot + 1) % int(slots.size());
+    auto &s = slots[i];
+
+    // The queue is in-order, so the unmap precedes the copy.
+    if (s.data) {
+        queue.enqueueUnmapMemObject(s.host_buffer, s.data);
+        s.data = nullptr;
+    }
+    queue.enqueueCopyBuffer(src, s.host_buffer, 0, 0, size, wait_events);
+    s.data = queue.enqueueMapBuffer(
+        s.host_buffer, CL_FALSE, CL_MAP_READ, 0, size, nullptr, &s.map_event);
+    return i;
+}
+
+bool mapped_buffer_ring::is_ready(int i) const
+{
+    return slots[i].data &&
+        slots[i].map_event.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>() == CL_COMPLETE;
+}
+
+const void *mapped_buffer_ring::get_data(int i) const
+{
+    slots[i].map_event.wait();
+    return slots[i].data;
+}
+
+} // namespace compute
+} // namespace gpu
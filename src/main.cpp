@@ -8,13 +8,7 @@ int main(int argc, char *argv[])
     rendering_params.multisampling_sample_count = 4;
     rendering_params.tile_size_pixels = math::vec2(4, 4);
 
-    ocean::surface_params ocean_params;
-    ocean_params.fft_size = math::ivec2(512, 512);
-    ocean_params.tile_size_logical = math::vec3(100, 100, 100); // For rendering.
-    ocean_params.tile_size_physical = math::vec3(200, 200, 200); // For heightmap generation.
-    ocean_params.amplitude = 2.0;
-    ocean_params.wavelength_low_threshold = math::real(0.7);
-    ocean_params.set_wind_vector(math::vec2(15, 0));
+    const auto ocean_params = ocean::surface_params::get_defaults();
 
     main_window main_window(rendering_params, ocean_params);
 
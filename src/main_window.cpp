@@ -1,27 +1,91 @@
 #include <main_window.h>
 
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
 #include <sstream>
-#include <util/timing.h>
+#include <util/log.h>
+#include <util/graphics_timer.h>
+#include <util/trace.h>
+
+namespace {
+
+const char *const stage_names[] = { "frame",   "phase shift", "FFT",
+                                    "export",  "mipmaps",     "render",
+                                    "ocean drawcall", "resolve" };
+
+const char *get_record_file()
+{
+    const char *record_file = getenv("OCEAN_RECORD");
+    return record_file && *record_file ? record_file : nullptr;
+}
+
+// Recording needs the displacement in host memory.
+ocean::surface_params get_surface_params(const ocean::surface_params &params)
+{
+    ocean::surface_params res = params;
+    if (get_record_file())
+        res.map_displacement = true;
+    return res;
+}
+
+ocean::recording_format get_record_format()
+{
+    const char *format = getenv("OCEAN_RECORD_FORMAT");
+    const std::string name = format ? format : "float16";
+    if (name == "float32")
+        return ocean::RECORDING_FORMAT_FLOAT32;
+    if (name == "unorm8")
+        return ocean::RECORDING_FORMAT_UNORM8;
+    if (name != "float16")
+        LOG("Unknown OCEAN_RECORD_FORMAT %s, recording float16.\n", name.c_str());
+    return ocean::RECORDING_FORMAT_FLOAT16;
+}
+
+} // unnamed namespace
 
 main_window::main_window(
     const rendering::rendering_params &rendering_params,
     const ocean::surface_params &ocean_params)
     : window("ocean demo", util::extent(1024, 768), SDL_WINDOW_MAXIMIZED)
-    , queue(gpu::compute::init(window))
+    , queue(
+          ocean_params.backend == ocean::SIMULATION_BACKEND_OPENCL ? gpu::compute::init(window)
+                                                                   : gpu::compute::command_queue())
     , framebuffer(window.get_extent().width, window.get_extent().height, rendering_params.multisampling_sample_count)
-    , ocean_scene(queue, ocean_params, rendering_params)
+    , ocean_scene(queue, get_surface_params(ocean_params), rendering_params)
     , camera_controller(ocean_scene.get_main_camera())
     , run_state(RUN_STATE_RUNNING)
+    , stage_statistics(NUM_STAGES)
+    , histogram_stage(STAGE_FRAME)
 {
     camera_controller.set_viewport_size(get_extent());
+
+    // Tracing is enabled by naming the file the trace is written to.
+    const char *trace_file = getenv("OCEAN_TRACE");
+    if (trace_file && *trace_file) {
+        trace_file_name = trace_file;
+        util::trace::set_enabled(true);
+    }
+
+    // So is recording the surface.
+    if (const char *record_file = get_record_file())
+        recorder.reset(
+            new ocean::surface_recorder(record_file, ocean_params, get_record_format()));
 }
 
 void main_window::main_loop()
 {
     double multisample_resolve_milliseconds;
-    util::graphics_timer timer;
+    util::graphics_timer timer("resolve framebuffer");
+    util::cpu_timer frame_timer;
+    frame_timer.start();
+    auto start_time = std::chrono::steady_clock::now();
 
     while (run_state == RUN_STATE_RUNNING) {
+        util::trace::scope trace_scope("frame");
+
         os::event event;
         while (window.poll_event(event)) {
             handle_event(event);
@@ -31,17 +95,36 @@ void main_window::main_loop()
         window.begin_frame();
 
         framebuffer.activate();
-        ocean_scene.render();
+        auto current_time = std::chrono::steady_clock::now();
+        float time = 0.001f * std::chrono::duration_cast<std::chrono::milliseconds>(
+                                  current_time - start_time)
+                                  .count();
+        ocean_scene.render(time);
+        if (recorder) {
+            const auto &displacement = ocean_scene.get_host_displacement();
+            if (displacement.dx.data)
+                recorder->append(displacement.time, displacement.dx, displacement.dy,
+                                 displacement.dz);
+        }
         {
             auto resolve_timer = util::scoped_timer(timer, multisample_resolve_milliseconds);
             framebuffer.resolve_to_backbuffer();
         }
 
         // Render performance metrics.
-        render_performance_metrics(multisample_resolve_milliseconds);
+        render_performance_metrics();
+        render_statistics_panel();
 
         window.end_frame();
+
+        double frame_milliseconds = frame_timer.stop_and_get_milliseconds();
+        frame_timer.start();
+        update_statistics(frame_milliseconds, multisample_resolve_milliseconds);
     }
+
+    write_trace();
+    if (recorder)
+        recorder->close();
 }
 
 void main_window::handle_event(const os::event &event)
@@ -68,20 +151,133 @@ void main_window::handle_keyboard_event(const os::keyboard_event &event)
     const char KEY_ESCAPE = '\033';
     if (event.get_keysym() == KEY_ESCAPE)
         handle_quit_event();
+    else if (event.get_keysym() == 't' && event.is_key_down())
+        write_trace();
 }
 
-void main_window::render_performance_metrics(double multisample_resolve_milliseconds)
+void main_window::write_trace()
 {
+    if (trace_file_name.empty())
+        return;
+    if (util::trace::write_json(trace_file_name))
+        LOG("Trace written to %s.\n", trace_file_name.c_str());
+    else
+        LOG("Cannot write trace to %s.\n", trace_file_name.c_str());
+}
+
+void main_window::update_statistics(
+    double frame_milliseconds,
+    double multisample_resolve_milliseconds)
+{
+    const auto &scene_timings = ocean_scene.get_timing_data();
+    const auto &surface_timings = scene_timings.surface_geometry_timing_data;
+    stage_statistics[STAGE_FRAME].add(frame_milliseconds);
+    stage_statistics[STAGE_PHASE_SHIFT].add(surface_timings.phase_shift_milliseconds);
+    stage_statistics[STAGE_FFT].add(surface_timings.fft_milliseconds);
+    stage_statistics[STAGE_EXPORT].add(surface_timings.export_milliseconds);
+    stage_statistics[STAGE_MIPMAPS].add(surface_timings.mipmap_generation_milliseconds);
+    stage_statistics[STAGE_RENDER].add(scene_timings.render_milliseconds);
+    stage_statistics[STAGE_OCEAN_DRAWCALL].add(scene_timings.ocean_drawcall_milliseconds);
+    stage_statistics[STAGE_RESOLVE].add(multisample_resolve_milliseconds);
+}
+
+void main_window::render_performance_metrics()
+{
+    // Window means, which unlike the last values do not flicker.
+    auto mean = [this](stage s) { return stage_statistics[s].get_summary().mean; };
     auto ocean_timing_data = ocean_scene.get_timing_data();
     std::stringstream ss;
     ss.setf(std::ios::fixed);
     ss.precision(2);
-    ss << "compute spectrum: "
-       << ocean_timing_data.surface_geometry_timing_data.phase_shift_milliseconds << " ms\n";
-    ss << "compute FFT: " << ocean_timing_data.surface_geometry_timing_data.fft_milliseconds << " ms\n";
-    ss << "generate mipmaps: "
-       << ocean_timing_data.surface_geometry_timing_data.mipmap_generation_milliseconds << " ms\n";
-    ss << "render ocean surface: " << ocean_timing_data.ocean_drawcall_milliseconds << " ms\n";
-    ss << "resolve framebuffer: " << multisample_resolve_milliseconds << " ms\n";
+    ss << "compute spectrum: " << mean(STAGE_PHASE_SHIFT) << " ms\n";
+    ss << "compute FFT: " << mean(STAGE_FFT) << " ms ("
+       << ocean_timing_data.surface_geometry_timing_data.fft_transform_count << " transforms)\n";
+    // The split over the cascades is that of the last frame.
+    const auto &surface_timings = ocean_timing_data.surface_geometry_timing_data;
+    for (int i = 0; surface_timings.num_cascades > 1 && i < surface_timings.num_cascades; ++i) {
+        const auto &cascade_timings = surface_timings.cascades[i];
+        ss << "  cascade " << i << ": spectrum " << cascade_timings.phase_shift_milliseconds
+           << " ms, export " << cascade_timings.export_milliseconds << " ms\n";
+    }
+    ss << "generate mipmaps: " << mean(STAGE_MIPMAPS) << " ms\n";
+    ss << "render ocean surface: " << mean(STAGE_OCEAN_DRAWCALL) << " ms\n";
+    ss << "resolve framebuffer: " << mean(STAGE_RESOLVE) << " ms\n";
     text_renderer.render_text(ss.str(), util::offset(10, 10));
 }
+
+void main_window::render_statistics_panel()
+{
+    ImGui::Begin("frame statistics");
+
+    ImGui::Text(
+        "%-16s %8s %8s %8s %8s %8s %8s", "ms", "min", "mean", "p50", "p95", "p99", "max");
+    for (int i = 0; i < NUM_STAGES; ++i) {
+        auto summary = stage_statistics[i].get_summary();
+        ImGui::Text(
+            "%-16s %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f", stage_names[i], summary.min, summary.mean,
+            summary.p50, summary.p95, summary.p99, summary.max);
+    }
+
+    // Histogram of all samples of one stage, limited to the occupied buckets.
+    ImGui::Combo("stage", &histogram_stage, stage_names, NUM_STAGES);
+    const auto &histogram = stage_statistics[histogram_stage].get_histogram();
+    int first_bucket = histogram.get_num_buckets(), last_bucket = -1;
+    for (int bucket = 0; bucket < histogram.get_num_buckets(); ++bucket) {
+        if (histogram.get_bucket_count(bucket) > 0) {
+            first_bucket = std::min(first_bucket, bucket);
+            last_bucket = bucket;
+        }
+    }
+    if (last_bucket >= 0) {
+        std::vector<float> counts;
+        for (int bucket = first_bucket; bucket <= last_bucket; ++bucket)
+            counts.push_back(float(histogram.get_bucket_count(bucket)));
+        double range_begin =
+            first_bucket > 0 ? histogram.get_bucket_upper_bound(first_bucket - 1) : 0;
+        double range_end = histogram.get_bucket_upper_bound(last_bucket);
+        char overlay[64];
+        snprintf(overlay, sizeof(overlay), "%.3f - %.3f ms", range_begin, range_end);
+        ImGui::PlotHistogram(
+            "##histogram", counts.data(), int(counts.size()), 0, overlay, 0.0f, FLT_MAX,
+            ImVec2(0, 80));
+    }
+
+    if (ImGui::Button("write CSV"))
+        write_statistics_csv();
+    ImGui::SameLine();
+    if (ImGui::Button("reset")) {
+        for (auto &statistics : stage_statistics)
+            statistics.clear();
+    }
+
+    ImGui::End();
+}
+
+void main_window::write_statistics_csv() const
+{
+    // Summaries of the window and the full histograms, one row per
+    // occupied bucket.
+    const char *summary_file_name = "frame_statistics.csv";
+    const char *histogram_file_name = "frame_histograms.csv";
+    std::ofstream summary_file(summary_file_name), histogram_file(histogram_file_name);
+    summary_file << "stage,count,min_ms,mean_ms,p50_ms,p95_ms,p99_ms,max_ms\n";
+    histogram_file << "stage,bucket_upper_bound_ms,count\n";
+    for (int i = 0; i < NUM_STAGES; ++i) {
+        auto summary = stage_statistics[i].get_summary();
+        summary_file << stage_names[i] << ',' << summary.count << ',' << summary.min << ','
+                     << summary.mean << ',' << summary.p50 << ',' << summary.p95 << ','
+                     << summary.p99 << ',' << summary.max << '\n';
+
+        const auto &histogram = stage_statistics[i].get_histogram();
+        for (int bucket = 0; bucket < histogram.get_num_buckets(); ++bucket) {
+            if (histogram.get_bucket_count(bucket) > 0)
+                histogram_file << stage_names[i] << ',' << histogram.get_bucket_upper_bound(bucket)
+                               << ',' << histogram.get_bucket_count(bucket) << '\n';
+        }
+    }
+
+    if (summary_file && histogram_file)
+        LOG("Frame statistics written to %s and %s.\n", summary_file_name, histogram_file_name);
+    else
+        LOG("Cannot write frame statistics.\n");
+}
@@ -0,0 +1,160 @@
+#include <ocean/baked_loop.h>
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include <ocean/spectrum.h>
+#include <util/error.h>
+#include <util/timing.h>
+#include <util/trace.h>
+
+using math::real;
+
+namespace ocean {
+
+// Identifies the frames stored in a backing file. The magic is written last,
+// so an interrupted bake is not mistaken for a complete one.
+struct baked_loop::file_header {
+    char magic[8];
+    int32_t fft_size[2];
+    int32_t num_frames;
+    float tile_size_physical[3];
+    float amplitude;
+    float wavelength_low_threshold;
+    float wind_direction[2];
+    float wind_speed;
+    int32_t model;
+    int32_t spreading;
+    float fetch;
+    float peak_enhancement;
+    float depth;
+};
+
+namespace {
+
+// Version 2: spectra drawn with the counter-based generator of spectrum.cpp.
+// Version 3: spectrum models.
+const char header_magic[8] = { 'O', 'C', 'N', 'L', 'O', 'O', 'P', '3' };
+
+// Frames start at this offset in the backing file.
+constexpr size_t header_size = 128;
+static_assert(header_size % sizeof(baked_loop::texel) == 0, "Frames have to stay aligned.");
+
+// Blends two RGBA8 rows bytewise with weight w in [0, 256].
+void blend_texels(const uint8_t *a, const uint8_t *b, int w, uint8_t *out, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+        out[i] = uint8_t(a[i] + (((int(b[i]) - int(a[i])) * w) >> 8));
+}
+
+} // unnamed namespace
+
+baked_loop::baked_loop(
+    util::thread_pool &pool,
+    const surface_params &params,
+    int num_frames,
+    const std::string &file_path)
+    : pool(pool), fft_size(params.fft_size), num_frames(num_frames), is_baked(false), header(nullptr)
+{
+    static_assert(sizeof(file_header) <= header_size, "Header does not fit.");
+    if (num_frames < 2)
+        DIE("A baked loop needs at least two frames, got %d.\n", num_frames);
+
+    const size_t frames_size = sizeof(texel) * 2 * get_frame_texel_count() * num_frames;
+    if (file_path.empty()) {
+        memory.resize(frames_size / sizeof(texel));
+        frames = memory.data();
+    } else {
+        file = util::mapped_file(file_path, header_size + frames_size);
+        header = static_cast<file_header *>(file.data());
+        frames = reinterpret_cast<texel *>(static_cast<char *>(file.data()) + header_size);
+    }
+}
+
+void baked_loop::bake(const spectrum &wave_spectrum)
+{
+    const auto &params = wave_spectrum.get_params();
+
+    // Memset first, so that the padding compares equal too.
+    file_header expected;
+    std::memset(&expected, 0, sizeof(expected));
+    std::memcpy(expected.magic, header_magic, sizeof(header_magic));
+    expected.fft_size[0] = params.fft_size.x;
+    expected.fft_size[1] = params.fft_size.y;
+    expected.num_frames = num_frames;
+    expected.tile_size_physical[0] = params.tile_size_physical.x;
+    expected.tile_size_physical[1] = params.tile_size_physical.y;
+    expected.tile_size_physical[2] = params.tile_size_physical.z;
+    expected.amplitude = params.amplitude;
+    expected.wavelength_low_threshold = params.wavelength_low_threshold;
+    expected.wind_direction[0] = params.wind_direction.x;
+    expected.wind_direction[1] = params.wind_direction.y;
+    expected.wind_speed = params.wind_speed;
+    expected.model = params.model;
+    expected.spreading = params.spreading;
+    expected.fetch = params.fetch;
+    expected.peak_enhancement = params.peak_enhancement;
+    expected.depth = params.depth;
+    if (header && std::memcmp(header, &expected, sizeof(expected)) == 0) {
+        is_baked = true;
+        return;
+    }
+
+    util::trace::scope trace_scope("bake loop");
+    util::cpu_timer timer;
+    timer.start();
+    if (header)
+        std::memset(header, 0, header_size);
+
+    // Frames are independent, so each chunk of frames gets its own simulation;
+    // the nested parallel loops inside host_simulation run serially.
+    const size_t frame_texels = get_frame_texel_count();
+    pool.parallel_for(num_frames, [&](int begin, int end) {
+        host_simulation sim(pool, params);
+        for (int i = begin; i < end; ++i) {
+            sim.generate(wave_spectrum, spectrum::period * i / num_frames);
+            texel *frame = get_frame(i);
+            std::memcpy(frame, sim.get_displacement_map().data(), sizeof(texel) * frame_texels);
+            std::memcpy(
+                frame + frame_texels, sim.get_normal_map().data(), sizeof(texel) * frame_texels);
+        }
+    });
+
+    if (header) {
+        file.flush();
+        std::memcpy(header, &expected, sizeof(expected));
+        file.flush();
+    }
+    is_baked = true;
+    LOG("Baked %d frames of %dx%d in %.1f ms.\n", num_frames, fft_size.x, fft_size.y,
+        timer.stop_and_get_milliseconds());
+}
+
+void baked_loop::sample(real time, texel *displacement_map, texel *normal_map) const
+{
+    const double position = std::fmod(double(time), double(spectrum::period)) /
+                            spectrum::period * num_frames;
+    const double position_floor = std::floor(position);
+    const int i0 = (int(position_floor) % num_frames + num_frames) % num_frames;
+    const int i1 = (i0 + 1) % num_frames;
+    const int w = int((position - position_floor) * 256 + 0.5);
+
+    const size_t frame_texels = get_frame_texel_count();
+    const auto *frame0 = reinterpret_cast<const uint8_t *>(get_frame(i0));
+    const auto *frame1 = reinterpret_cast<const uint8_t *>(get_frame(i1));
+    const size_t row_bytes = sizeof(texel) * fft_size.x;
+    const size_t normal_offset = sizeof(texel) * frame_texels;
+    auto *displacement_out = reinterpret_cast<uint8_t *>(displacement_map);
+    auto *normal_out = reinterpret_cast<uint8_t *>(normal_map);
+
+    pool.parallel_for(fft_size.y, [&](int begin, int end) {
+        const size_t offset = row_bytes * begin;
+        const size_t count = row_bytes * (end - begin);
+        blend_texels(frame0 + offset, frame1 + offset, w, displacement_out + offset, count);
+        blend_texels(frame0 + normal_offset + offset, frame1 + normal_offset + offset, w,
+                     normal_out + offset, count);
+    }, 16);
+}
+
+} // namespace ocean
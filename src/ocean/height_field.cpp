@@ -0,0 +1,682 @@
+#include <ocean/height_field.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include <util/trace.h>
+
+using math::real;
+
+namespace ocean {
+
+namespace detail {
+
+// Fields of the current frame and the outputs of one batch of queries.
+struct sample_args {
+    const float *dx, *dy, *dz;
+    const float *nx, *ny, *nz; // Not normalized.
+    const float *previous_dx, *previous_dy, *previous_dz;
+    int N, M;
+    float texels_per_unit_x, texels_per_unit_z;
+    float inv_dt; // Zero without a previous frame.
+
+    const math::vec2 *xz;
+    real *heights;
+    math::vec3 *normals;
+    math::vec3 *velocities;
+};
+
+} // namespace detail
+
+namespace {
+
+// Keep in sync with kernels/export_to_texture.cl.
+constexpr real max_displacement = real(5);
+
+// Fixed-point steps of the horizontal displacement inversion. Each one
+// shrinks the error by the horizontal slope of the displacement, which
+// stays well below one unless the surface folds over.
+constexpr int num_inversion_steps = 4;
+
+// Queries per thread pool task.
+constexpr int block_size = 1024;
+
+// Rays per thread pool task, a ray costs far more than a height query.
+constexpr int ray_block_size = 64;
+
+// Bisection steps refining a hit between two march steps half a cell apart.
+constexpr int num_bisection_steps = 10;
+
+static_assert(sizeof(math::vec2) == 2 * sizeof(float), "vec2 has to be two packed floats");
+
+typedef detail::sample_args sample_args;
+
+// Bilinear filtering with repeat wrapping, matching the texture sampling in
+// shaders/ocean.glsl: texel i is centered at (i + 0.5) / N.
+struct bilinear_coords {
+    size_t i00, i01, i10, i11;
+    float fu, fv;
+};
+
+inline void wrap_axis(float g, int n, int &i0, int &i1, float &f)
+{
+    g -= n * std::floor(g / n);
+    const float g0 = std::floor(g);
+    i0 = int(g0);
+    i0 = i0 >= n ? 0 : i0;
+    i1 = i0 + 1 >= n ? 0 : i0 + 1;
+    f = g - g0;
+}
+
+inline bilinear_coords get_coords(const sample_args &a, float x, float z)
+{
+    int i0, i1, j0, j1;
+    bilinear_coords c;
+    wrap_axis(x * a.texels_per_unit_x - 0.5f, a.N, i0, i1, c.fu);
+    wrap_axis(z * a.texels_per_unit_z - 0.5f, a.M, j0, j1, c.fv);
+    c.i00 = size_t(j0) * a.N + i0;
+    c.i01 = size_t(j0) * a.N + i1;
+    c.i10 = size_t(j1) * a.N + i0;
+    c.i11 = size_t(j1) * a.N + i1;
+    return c;
+}
+
+inline float bilinear(const float *plane, const bilinear_coords &c)
+{
+    const float top = plane[c.i00] + (plane[c.i01] - plane[c.i00]) * c.fu;
+    const float bottom = plane[c.i10] + (plane[c.i11] - plane[c.i10]) * c.fu;
+    return top + (bottom - top) * c.fv;
+}
+
+// Coordinates of the grid point p0 displaced to xz.
+inline bilinear_coords find_grid_point(const sample_args &a, float x, float z)
+{
+    float px = x, pz = z;
+    for (int step = 0; step < num_inversion_steps; ++step) {
+        const bilinear_coords c = get_coords(a, px, pz);
+        px = x - bilinear(a.dx, c);
+        pz = z - bilinear(a.dz, c);
+    }
+    return get_coords(a, px, pz);
+}
+
+inline math::vec3 get_normal(const sample_args &a, const bilinear_coords &c)
+{
+    math::vec3 n(bilinear(a.nx, c), bilinear(a.ny, c), bilinear(a.nz, c));
+    return n / std::sqrt(math::dot(n, n));
+}
+
+void sample_scalar(const sample_args &a, int begin, int end)
+{
+    for (int k = begin; k < end; ++k) {
+        const bilinear_coords c = find_grid_point(a, a.xz[k].x, a.xz[k].y);
+        if (a.heights)
+            a.heights[k] = bilinear(a.dy, c);
+        if (a.normals)
+            a.normals[k] = get_normal(a, c);
+        if (a.velocities) {
+            a.velocities[k] = math::vec3(
+                (bilinear(a.dx, c) - bilinear(a.previous_dx, c)) * a.inv_dt,
+                (bilinear(a.dy, c) - bilinear(a.previous_dy, c)) * a.inv_dt,
+                (bilinear(a.dz, c) - bilinear(a.previous_dz, c)) * a.inv_dt);
+        }
+    }
+}
+
+#if CPU_SIMD_X86
+
+struct bilinear_coords_avx2 {
+    __m256i i00, i01, i10, i11;
+    __m256 fu, fv;
+};
+
+CPU_SIMD_TARGET_AVX2 inline void wrap_axis_avx2(
+    __m256 g,
+    int n,
+    __m256i &i0,
+    __m256i &i1,
+    __m256 &f)
+{
+    const __m256 n_f = _mm256_set1_ps(float(n));
+    const __m256i n_i = _mm256_set1_epi32(n);
+    g = _mm256_fnmadd_ps(n_f, _mm256_floor_ps(_mm256_div_ps(g, n_f)), g);
+    const __m256 g0 = _mm256_floor_ps(g);
+    i0 = _mm256_cvttps_epi32(g0);
+    i0 = _mm256_andnot_si256(_mm256_cmpeq_epi32(i0, n_i), i0);
+    i1 = _mm256_add_epi32(i0, _mm256_set1_epi32(1));
+    i1 = _mm256_andnot_si256(_mm256_cmpeq_epi32(i1, n_i), i1);
+    f = _mm256_sub_ps(g, g0);
+}
+
+CPU_SIMD_TARGET_AVX2 inline bilinear_coords_avx2
+get_coords_avx2(const sample_args &a, __m256 x, __m256 z)
+{
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256i N = _mm256_set1_epi32(a.N);
+    __m256i i0, i1, j0, j1;
+    bilinear_coords_avx2 c;
+    const __m256 gu = _mm256_fmsub_ps(x, _mm256_set1_ps(a.texels_per_unit_x), half);
+    const __m256 gv = _mm256_fmsub_ps(z, _mm256_set1_ps(a.texels_per_unit_z), half);
+    wrap_axis_avx2(gu, a.N, i0, i1, c.fu);
+    wrap_axis_avx2(gv, a.M, j0, j1, c.fv);
+    const __m256i row0 = _mm256_mullo_epi32(j0, N), row1 = _mm256_mullo_epi32(j1, N);
+    c.i00 = _mm256_add_epi32(row0, i0);
+    c.i01 = _mm256_add_epi32(row0, i1);
+    c.i10 = _mm256_add_epi32(row1, i0);
+    c.i11 = _mm256_add_epi32(row1, i1);
+    return c;
+}
+
+CPU_SIMD_TARGET_AVX2 inline __m256 bilinear_avx2(const float *plane, const bilinear_coords_avx2 &c)
+{
+    const __m256 v00 = _mm256_i32gather_ps(plane, c.i00, 4);
+    const __m256 v01 = _mm256_i32gather_ps(plane, c.i01, 4);
+    const __m256 v10 = _mm256_i32gather_ps(plane, c.i10, 4);
+    const __m256 v11 = _mm256_i32gather_ps(plane, c.i11, 4);
+    const __m256 top = _mm256_fmadd_ps(_mm256_sub_ps(v01, v00), c.fu, v00);
+    const __m256 bottom = _mm256_fmadd_ps(_mm256_sub_ps(v11, v10), c.fu, v10);
+    return _mm256_fmadd_ps(_mm256_sub_ps(bottom, top), c.fv, top);
+}
+
+// Eight queries per iteration; the rest goes to sample_scalar.
+CPU_SIMD_TARGET_AVX2 void sample_avx2(const sample_args &a, int begin, int end)
+{
+    const __m256 inv_dt = _mm256_set1_ps(a.inv_dt);
+
+    int k = begin;
+    for (; k + 8 <= end; k += 8) {
+        // Deinterleave the xz pairs.
+        const float *in = &a.xz[k].x;
+        const __m256 lo = _mm256_loadu_ps(in), hi = _mm256_loadu_ps(in + 8);
+        const __m256 x = _mm256_castpd_ps(
+            _mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(lo, hi, 0x88)), 0xd8));
+        const __m256 z = _mm256_castpd_ps(
+            _mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(lo, hi, 0xdd)), 0xd8));
+
+        __m256 px = x, pz = z;
+        for (int step = 0; step < num_inversion_steps; ++step) {
+            const bilinear_coords_avx2 c = get_coords_avx2(a, px, pz);
+            px = _mm256_sub_ps(x, bilinear_avx2(a.dx, c));
+            pz = _mm256_sub_ps(z, bilinear_avx2(a.dz, c));
+        }
+        const bilinear_coords_avx2 c = get_coords_avx2(a, px, pz);
+
+        if (a.heights)
+            _mm256_storeu_ps(a.heights + k, bilinear_avx2(a.dy, c));
+        if (a.normals) {
+            const __m256 nx = bilinear_avx2(a.nx, c);
+            const __m256 ny = bilinear_avx2(a.ny, c);
+            const __m256 nz = bilinear_avx2(a.nz, c);
+            const __m256 inv_mag = _mm256_div_ps(
+                _mm256_set1_ps(1.0f),
+                _mm256_sqrt_ps(
+                    _mm256_fmadd_ps(nx, nx, _mm256_fmadd_ps(ny, ny, _mm256_mul_ps(nz, nz)))));
+            alignas(32) float out[3][8];
+            _mm256_store_ps(out[0], _mm256_mul_ps(nx, inv_mag));
+            _mm256_store_ps(out[1], _mm256_mul_ps(ny, inv_mag));
+            _mm256_store_ps(out[2], _mm256_mul_ps(nz, inv_mag));
+            for (int l = 0; l < 8; ++l)
+                a.normals[k + l] = math::vec3(out[0][l], out[1][l], out[2][l]);
+        }
+        if (a.velocities) {
+            const __m256 vx =
+                _mm256_sub_ps(bilinear_avx2(a.dx, c), bilinear_avx2(a.previous_dx, c));
+            const __m256 vy =
+                _mm256_sub_ps(bilinear_avx2(a.dy, c), bilinear_avx2(a.previous_dy, c));
+            const __m256 vz =
+                _mm256_sub_ps(bilinear_avx2(a.dz, c), bilinear_avx2(a.previous_dz, c));
+            alignas(32) float out[3][8];
+            _mm256_store_ps(out[0], _mm256_mul_ps(vx, inv_dt));
+            _mm256_store_ps(out[1], _mm256_mul_ps(vy, inv_dt));
+            _mm256_store_ps(out[2], _mm256_mul_ps(vz, inv_dt));
+            for (int l = 0; l < 8; ++l)
+                a.velocities[k + l] = math::vec3(out[0][l], out[1][l], out[2][l]);
+        }
+    }
+    sample_scalar(a, k, end);
+}
+
+#endif
+
+typedef void (*sample_function)(const sample_args &a, int begin, int end);
+
+// AVX-512 gathers are not faster than two AVX2 ones here, so AVX2 serves
+// both.
+sample_function get_sample_function(cpu::simd::instruction_set set)
+{
+#if CPU_SIMD_X86
+    if (set != cpu::simd::INSTRUCTION_SET_SCALAR)
+        return sample_avx2;
+#endif
+    return sample_scalar;
+}
+
+// Ray in grid coordinates too (cells between texel centers, as in the
+// pyramid), for walking the pyramid.
+struct ray_args {
+    const sample_args *field;
+    const detail::pyramid_level *levels;
+    math::vec3 origin, direction;
+    float grid_origin_x, grid_origin_z;
+    float grid_direction_x, grid_direction_z;
+    float march_step; // Half a cell along the ray, infinite for vertical rays.
+};
+
+inline int wrap(int i, int n)
+{
+    i %= n;
+    return i < 0 ? i + n : i;
+}
+
+inline float get_height_above_surface(const ray_args &r, float t)
+{
+    const math::vec3 p = r.origin + t * r.direction;
+    return p.y - bilinear(r.field->dy, find_grid_point(*r.field, p.x, p.z));
+}
+
+// First point of [t0, t1] below the surface, found in half cell steps and
+// refined by bisection.
+bool march(const ray_args &r, float t0, float t1, float &t_hit)
+{
+    if (get_height_above_surface(r, t0) <= 0) {
+        t_hit = t0;
+        return true;
+    }
+    for (float t_prev = t0; t_prev < t1;) {
+        const float t = std::min(t_prev + r.march_step, t1);
+        if (get_height_above_surface(r, t) <= 0) {
+            float lo = t_prev, hi = t;
+            for (int step = 0; step < num_bisection_steps; ++step) {
+                const float mid = 0.5f * (lo + hi);
+                if (get_height_above_surface(r, mid) <= 0)
+                    hi = mid;
+                else
+                    lo = mid;
+            }
+            t_hit = hi;
+            return true;
+        }
+        t_prev = t;
+    }
+    return false;
+}
+
+// Visits the nodes of a level along [t0, t1] front to back (a 2D DDA over
+// the repeating tile) and descends into those whose bounds overlap the
+// heights of the ray over the node.
+bool walk_level(const ray_args &r, int level, float t0, float t1, float &t_hit)
+{
+    const detail::pyramid_level &l = r.levels[level];
+    const float node_size = float(l.node_size);
+    const float inf = std::numeric_limits<float>::infinity();
+
+    int ix = int(std::floor((r.grid_origin_x + t0 * r.grid_direction_x) / node_size));
+    int iz = int(std::floor((r.grid_origin_z + t0 * r.grid_direction_z) / node_size));
+    const int step_x = r.grid_direction_x < 0 ? -1 : 1;
+    const int step_z = r.grid_direction_z < 0 ? -1 : 1;
+    const float t_delta_x =
+        r.grid_direction_x != 0 ? node_size / std::abs(r.grid_direction_x) : inf;
+    const float t_delta_z =
+        r.grid_direction_z != 0 ? node_size / std::abs(r.grid_direction_z) : inf;
+    float t_next_x = r.grid_direction_x != 0
+        ? ((ix + (step_x > 0)) * node_size - r.grid_origin_x) / r.grid_direction_x
+        : inf;
+    float t_next_z = r.grid_direction_z != 0
+        ? ((iz + (step_z > 0)) * node_size - r.grid_origin_z) / r.grid_direction_z
+        : inf;
+
+    for (float t = t0;;) {
+        const float t_end = std::min(std::min(t_next_x, t_next_z), t1);
+        const detail::height_bounds &b =
+            l.nodes[wrap(iz, l.size.y) * l.size.x + wrap(ix, l.size.x)];
+        const float y0 = r.origin.y + t * r.direction.y;
+        const float y1 = r.origin.y + t_end * r.direction.y;
+        if (std::min(y0, y1) <= b.max && std::max(y0, y1) >= b.min) {
+            const bool is_hit =
+                level == 0 ? march(r, t, t_end, t_hit) : walk_level(r, level - 1, t, t_end, t_hit);
+            if (is_hit)
+                return true;
+        }
+        if (t_end >= t1)
+            return false;
+        if (t_next_x < t_next_z) {
+            ix += step_x;
+            t_next_x += t_delta_x;
+        } else {
+            iz += step_z;
+            t_next_z += t_delta_z;
+        }
+        t = t_end;
+    }
+}
+
+} // unnamed namespace
+
+height_field::height_field(util::thread_pool &pool, const surface_params &params)
+    : pool(pool)
+    , size(params.fft_size)
+    , plane_size(size_t(params.fft_size.x) * params.fft_size.y)
+    , units_per_meter(params.tile_size_logical / params.tile_size_physical)
+    , texels_per_unit(
+          math::vec2(params.fft_size) /
+          math::vec2(params.tile_size_logical.x, params.tile_size_logical.z))
+    , instruction_set(cpu::simd::get_instruction_set())
+    , planes(NUM_PLANES * plane_size, 0.0f)
+    , has_frame(false)
+    , has_previous_frame(false)
+    , time(0)
+    , previous_time(0)
+{
+    update_pyramid();
+}
+
+void height_field::begin_update(real new_time)
+{
+    if (has_frame) {
+        std::memcpy(
+            get_plane(PLANE_PREVIOUS_DX), get_plane(PLANE_DX), 3 * plane_size * sizeof(float));
+        previous_time = time;
+        has_previous_frame = true;
+    }
+    time = new_time;
+    has_frame = true;
+}
+
+void height_field::update(
+    real new_time,
+    const field_view &dx,
+    const field_view &dy,
+    const field_view &dz)
+{
+    util::trace::scope trace_scope("update height field");
+    begin_update(new_time);
+
+    const field_view fields[] = { dx, dy, dz };
+    const int N = size.x;
+    pool.parallel_for(size.y, [&](int begin, int end) {
+        for (int c = 0; c < 3; ++c) {
+            const field_view &src = fields[c];
+            float *dst = get_plane(plane(PLANE_DX + c));
+            const float scale = units_per_meter[c];
+            for (int j = begin; j < end; ++j) {
+                const float *src_row = src.data + j * src.row_stride;
+                float *dst_row = dst + size_t(j) * N;
+                for (int i = 0; i < N; ++i)
+                    dst_row[i] = src_row[i * src.element_stride] * scale;
+            }
+        }
+    });
+    update_normals();
+    update_pyramid();
+}
+
+void height_field::update(real new_time, const uint32_t *displacement_map)
+{
+    util::trace::scope trace_scope("update height field");
+    begin_update(new_time);
+
+    float *dst[] = { get_plane(PLANE_DX), get_plane(PLANE_DY), get_plane(PLANE_DZ) };
+    const math::vec3 scale = units_per_meter * max_displacement;
+    pool.parallel_for(size.y, [&](int begin, int end) {
+        for (size_t idx = size_t(begin) * size.x; idx < size_t(end) * size.x; ++idx) {
+            const uint32_t texel = displacement_map[idx];
+            for (int c = 0; c < 3; ++c) {
+                const float unorm = float((texel >> (8 * c)) & 0xff) / 255.0f;
+                dst[c][idx] = (2.0f * unorm - 1.0f) * scale[c];
+            }
+        }
+    });
+    update_normals();
+    update_pyramid();
+}
+
+void height_field::update_normals()
+{
+    // Central differences of the displaced grid, in rendering units.
+    const int N = size.x, M = size.y;
+    const math::vec2 cell_size = real(1) / texels_per_unit;
+    const float *dx = get_plane(PLANE_DX), *dy = get_plane(PLANE_DY), *dz = get_plane(PLANE_DZ);
+    float *nx = get_plane(PLANE_NX), *ny = get_plane(PLANE_NY), *nz = get_plane(PLANE_NZ);
+
+    pool.parallel_for(M, [&](int begin, int end) {
+        for (int j = begin; j < end; ++j) {
+            const size_t row = size_t(j) * N;
+            const size_t row_prev = size_t(j == 0 ? M - 1 : j - 1) * N;
+            const size_t row_next = size_t(j == M - 1 ? 0 : j + 1) * N;
+            for (int i = 0; i < N; ++i) {
+                const int i_prev = i == 0 ? N - 1 : i - 1;
+                const int i_next = i == N - 1 ? 0 : i + 1;
+                const math::vec3 du(
+                    2 * cell_size.x + dx[row + i_next] - dx[row + i_prev],
+                    dy[row + i_next] - dy[row + i_prev],
+                    dz[row + i_next] - dz[row + i_prev]);
+                const math::vec3 dv(
+                    dx[row_next + i] - dx[row_prev + i],
+                    dy[row_next + i] - dy[row_prev + i],
+                    2 * cell_size.y + dz[row_next + i] - dz[row_prev + i]);
+                const math::vec3 n = math::cross(dv, du);
+                nx[row + i] = n.x;
+                ny[row + i] = n.y;
+                nz[row + i] = n.z;
+            }
+        }
+    });
+}
+
+detail::sample_args height_field::get_sample_args() const
+{
+    sample_args args;
+    args.dx = get_plane(PLANE_DX);
+    args.dy = get_plane(PLANE_DY);
+    args.dz = get_plane(PLANE_DZ);
+    args.nx = get_plane(PLANE_NX);
+    args.ny = get_plane(PLANE_NY);
+    args.nz = get_plane(PLANE_NZ);
+    args.previous_dx = get_plane(PLANE_PREVIOUS_DX);
+    args.previous_dy = get_plane(PLANE_PREVIOUS_DY);
+    args.previous_dz = get_plane(PLANE_PREVIOUS_DZ);
+    args.N = size.x;
+    args.M = size.y;
+    args.texels_per_unit_x = texels_per_unit.x;
+    args.texels_per_unit_z = texels_per_unit.y;
+    args.inv_dt = has_previous_frame && time != previous_time ? 1 / (time - previous_time) : 0;
+    args.xz = nullptr;
+    args.heights = nullptr;
+    args.normals = nullptr;
+    args.velocities = nullptr;
+    return args;
+}
+
+void height_field::sample(
+    const math::vec2 *xz,
+    size_t count,
+    real *heights,
+    math::vec3 *normals,
+    math::vec3 *velocities) const
+{
+    sample_args args = get_sample_args();
+    args.xz = xz;
+    args.heights = heights;
+    args.normals = normals;
+    args.velocities = velocities;
+
+    const sample_function sample_fn = get_sample_function(instruction_set);
+    const int num_blocks = int((count + block_size - 1) / block_size);
+    pool.parallel_for(num_blocks, [&](int begin, int end) {
+        sample_fn(args, begin * block_size, int(std::min(size_t(end) * block_size, count)));
+    });
+}
+
+void height_field::intersect(
+    const math::vec3 *origins,
+    const math::vec3 *directions,
+    size_t count,
+    real max_distance,
+    ray_hit *hits) const
+{
+    intersect_rays(origins, directions, count, max_distance, hits, true);
+}
+
+void height_field::intersect_brute_force(
+    const math::vec3 *origins,
+    const math::vec3 *directions,
+    size_t count,
+    real max_distance,
+    ray_hit *hits) const
+{
+    intersect_rays(origins, directions, count, max_distance, hits, false);
+}
+
+void height_field::intersect_rays(
+    const math::vec3 *origins,
+    const math::vec3 *directions,
+    size_t count,
+    real max_distance,
+    ray_hit *hits,
+    bool use_pyramid) const
+{
+    const sample_args field = get_sample_args();
+
+    // The top level bounds the whole surface.
+    float min_height = std::numeric_limits<float>::infinity();
+    float max_height = -min_height;
+    for (const auto &b : pyramid.back().nodes) {
+        min_height = std::min(min_height, b.min);
+        max_height = std::max(max_height, b.max);
+    }
+
+    auto intersect_ray = [&](size_t k) {
+        ray_args r;
+        r.field = &field;
+        r.levels = pyramid.data();
+        r.origin = origins[k];
+        r.direction = directions[k];
+        r.grid_origin_x = r.origin.x * texels_per_unit.x - 0.5f;
+        r.grid_origin_z = r.origin.z * texels_per_unit.y - 0.5f;
+        r.grid_direction_x = r.direction.x * texels_per_unit.x;
+        r.grid_direction_z = r.direction.z * texels_per_unit.y;
+        r.march_step =
+            0.5f / std::max(std::abs(r.grid_direction_x), std::abs(r.grid_direction_z));
+
+        float t_hit = -1;
+        if (!use_pyramid) {
+            march(r, 0, max_distance, t_hit);
+            return t_hit;
+        }
+
+        // Only the part of the ray between the lowest and highest point of
+        // the surface can hit it.
+        if (r.origin.y < min_height)
+            return 0.0f;
+        float t0 = 0, t1 = max_distance;
+        if (r.direction.y != 0) {
+            const float t_min = (min_height - r.origin.y) / r.direction.y;
+            const float t_max = (max_height - r.origin.y) / r.direction.y;
+            t0 = std::max(t0, std::min(t_min, t_max));
+            t1 = std::min(t1, std::max(t_min, t_max));
+        } else if (r.origin.y > max_height) {
+            return -1.0f;
+        }
+        if (t0 <= t1)
+            walk_level(r, int(pyramid.size()) - 1, t0, t1, t_hit);
+        return t_hit;
+    };
+
+    const int num_blocks = int((count + ray_block_size - 1) / ray_block_size);
+    pool.parallel_for(num_blocks, [&](int begin, int end) {
+        const size_t k_end = std::min(size_t(end) * ray_block_size, count);
+        for (size_t k = size_t(begin) * ray_block_size; k < k_end; ++k) {
+            hits[k].distance = intersect_ray(k);
+            hits[k].normal = math::vec3(0, 1, 0);
+            if (hits[k].distance >= 0) {
+                const math::vec3 p = origins[k] + hits[k].distance * directions[k];
+                hits[k].normal = get_normal(field, find_grid_point(field, p.x, p.z));
+            }
+        }
+    });
+}
+
+void height_field::update_pyramid()
+{
+    const int N = size.x, M = size.y;
+    const float *dx = get_plane(PLANE_DX), *dy = get_plane(PLANE_DY), *dz = get_plane(PLANE_DZ);
+
+    // Finest level: the cells between four texel centers, which bilinear
+    // filtering interpolates. Also the largest horizontal displacement.
+    std::vector<detail::height_bounds> nodes(plane_size);
+    std::vector<float> row_margins(M);
+    pool.parallel_for(M, [&](int begin, int end) {
+        for (int j = begin; j < end; ++j) {
+            const size_t row = size_t(j) * N;
+            const size_t row_next = size_t(j == M - 1 ? 0 : j + 1) * N;
+            float margin = 0;
+            for (int i = 0; i < N; ++i) {
+                const int i_next = i == N - 1 ? 0 : i + 1;
+                const float h00 = dy[row + i], h01 = dy[row + i_next];
+                const float h10 = dy[row_next + i], h11 = dy[row_next + i_next];
+                nodes[row + i].min = std::min(std::min(h00, h01), std::min(h10, h11));
+                nodes[row + i].max = std::max(std::max(h00, h01), std::max(h10, h11));
+                margin = std::max(margin, std::abs(dx[row + i]) * texels_per_unit.x);
+                margin = std::max(margin, std::abs(dz[row + i]) * texels_per_unit.y);
+            }
+            row_margins[j] = margin;
+        }
+    });
+
+    // The surface over a node comes from grid points at most the margin
+    // away, so levels with nodes at least that large bound it when grown by
+    // their neighbours. Finer levels are not kept.
+    const float margin = *std::max_element(row_margins.begin(), row_margins.end());
+    math::ivec2 level_size(N, M);
+    int node_size = 1;
+    pyramid.clear();
+    for (;;) {
+        const bool is_top = level_size.x % 2 != 0 || level_size.y % 2 != 0;
+        if (node_size >= margin || is_top) {
+            detail::pyramid_level level;
+            level.size = level_size;
+            level.node_size = node_size;
+            level.nodes.resize(nodes.size());
+            pool.parallel_for(level_size.y, [&](int begin, int end) {
+                for (int j = begin; j < end; ++j) {
+                    for (int i = 0; i < level_size.x; ++i) {
+                        detail::height_bounds b = nodes[size_t(j) * level_size.x + i];
+                        for (int dj = -1; dj <= 1; ++dj) {
+                            for (int di = -1; di <= 1; ++di) {
+                                const auto &n =
+                                    nodes[wrap(j + dj, level_size.y) * level_size.x +
+                                          wrap(i + di, level_size.x)];
+                                b.min = std::min(b.min, n.min);
+                                b.max = std::max(b.max, n.max);
+                            }
+                        }
+                        level.nodes[size_t(j) * level_size.x + i] = b;
+                    }
+                }
+            });
+            pyramid.push_back(std::move(level));
+        }
+        if (is_top)
+            break;
+
+        // Next level: 2x2 nodes each.
+        const math::ivec2 parent_size(level_size.x / 2, level_size.y / 2);
+        std::vector<detail::height_bounds> parents(size_t(parent_size.x) * parent_size.y);
+        for (int j = 0; j < parent_size.y; ++j) {
+            for (int i = 0; i < parent_size.x; ++i) {
+                const auto *c0 = &nodes[size_t(2 * j) * level_size.x + 2 * i];
+                const auto *c1 = c0 + level_size.x;
+                auto &p = parents[size_t(j) * parent_size.x + i];
+                p.min = std::min(std::min(c0[0].min, c0[1].min), std::min(c1[0].min, c1[1].min));
+                p.max = std::max(std::max(c0[0].max, c0[1].max), std::max(c1[0].max, c1[1].max));
+            }
+        }
+        nodes.swap(parents);
+        level_size = parent_size;
+        node_size *= 2;
+    }
+}
+
+} // namespace ocean
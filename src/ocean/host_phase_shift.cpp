@@ -0,0 +1,264 @@
+#include <ocean/host_phase_shift.h>
+
+#include <cmath>
+
+#include <api/cpu/simd_math.h>
+#include <ocean/spectrum.h>
+
+using cpu::simd::sincos_poly;
+using math::real;
+
+namespace ocean {
+
+namespace {
+
+// Output spectra, in the order of kernels/phase_shift.cl. With reduced fields
+// FIELD_DDZ_DU holds ddz_dv and there is no FIELD_DDZ_DV.
+enum field {
+    FIELD_DX,
+    FIELD_DY,
+    FIELD_DZ,
+    FIELD_DDX_DU,
+    FIELD_DDX_DV,
+    FIELD_DDY_DU,
+    FIELD_DDY_DV,
+    FIELD_DDZ_DU,
+    FIELD_DDZ_DV
+};
+
+struct row_args {
+    const real *h0_re, *h0_im;
+    const real *k_x;
+    real k_z;
+    const real *inv_k, *omega;
+    real amplitude;
+    real time; // Reduced modulo spectrum::period.
+    real *out; // Row start in the first output field.
+    size_t field_stride;
+    bool reduced_fields; // Skip ddz_du and store ddz_dv in its place.
+    int count;
+};
+
+inline field get_ddz_dv_field(const row_args &a)
+{
+    return a.reduced_fields ? FIELD_DDZ_DU : FIELD_DDZ_DV;
+}
+
+inline void store_complex(const row_args &a, field f, int x, real re, real im)
+{
+    real *dst = a.out + f * a.field_stride + 2 * x;
+    dst[0] = re;
+    dst[1] = im;
+}
+
+inline void phase_shift_scalar(const row_args &a, int x)
+{
+    float s, c;
+    sincos_poly(a.omega[x] * a.time, s, c);
+    s *= a.amplitude;
+    c *= a.amplitude;
+
+    // h_tilde_shifted = A * h_tilde * exp(i*omega*t)
+    const real h_re = a.h0_re[x], h_im = a.h0_im[x];
+    const real hs_re = h_re * c - h_im * s;
+    const real hs_im = h_im * c + h_re * s;
+
+    const real k_x = a.k_x[x], k_z = a.k_z;
+    const real kx_ik = k_x * a.inv_k[x], kz_ik = k_z * a.inv_k[x];
+
+    store_complex(a, FIELD_DY, x, hs_re, hs_im);
+    store_complex(a, FIELD_DX, x, -kx_ik * hs_im, kx_ik * hs_re);
+    store_complex(a, FIELD_DZ, x, -kz_ik * hs_im, kz_ik * hs_re);
+    store_complex(a, FIELD_DDY_DU, x, -k_x * hs_im, k_x * hs_re);
+    store_complex(a, FIELD_DDY_DV, x, -k_z * hs_im, k_z * hs_re);
+    store_complex(a, FIELD_DDX_DU, x, k_x * kx_ik * hs_re, k_x * kx_ik * hs_im);
+    store_complex(a, FIELD_DDX_DV, x, k_x * kz_ik * hs_re, k_x * kz_ik * hs_im);
+    if (!a.reduced_fields)
+        store_complex(a, FIELD_DDZ_DU, x, k_x * kz_ik * hs_re, k_x * kz_ik * hs_im);
+    store_complex(a, get_ddz_dv_field(a), x, k_z * kz_ik * hs_re, k_z * kz_ik * hs_im);
+}
+
+void phase_shift_row_scalar(const row_args &a)
+{
+    for (int x = 0; x < a.count; ++x)
+        phase_shift_scalar(a, x);
+}
+
+#if CPU_SIMD_X86
+
+using cpu::simd::sincos_avx2;
+using cpu::simd::sincos_avx512;
+
+CPU_SIMD_TARGET_AVX2 inline void store_complex_avx2(const row_args &a, field f, int x, __m256 re, __m256 im)
+{
+    real *dst = a.out + f * a.field_stride + 2 * x;
+    __m256 lo = _mm256_unpacklo_ps(re, im), hi = _mm256_unpackhi_ps(re, im);
+    _mm256_storeu_ps(dst, _mm256_permute2f128_ps(lo, hi, 0x20));
+    _mm256_storeu_ps(dst + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+}
+
+CPU_SIMD_TARGET_AVX2 void phase_shift_row_avx2(const row_args &a)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 amplitude = _mm256_set1_ps(a.amplitude);
+    const __m256 time = _mm256_set1_ps(a.time);
+    const __m256 k_z = _mm256_set1_ps(a.k_z);
+    const field ddz_dv_field = get_ddz_dv_field(a);
+
+    int x = 0;
+    for (; x + 8 <= a.count; x += 8) {
+        __m256 s, c;
+        sincos_avx2(_mm256_mul_ps(_mm256_loadu_ps(a.omega + x), time), s, c);
+        s = _mm256_mul_ps(s, amplitude);
+        c = _mm256_mul_ps(c, amplitude);
+
+        const __m256 h_re = _mm256_loadu_ps(a.h0_re + x), h_im = _mm256_loadu_ps(a.h0_im + x);
+        const __m256 hs_re = _mm256_fmsub_ps(h_re, c, _mm256_mul_ps(h_im, s));
+        const __m256 hs_im = _mm256_fmadd_ps(h_im, c, _mm256_mul_ps(h_re, s));
+
+        const __m256 k_x = _mm256_loadu_ps(a.k_x + x);
+        const __m256 inv_k = _mm256_loadu_ps(a.inv_k + x);
+        const __m256 kx_ik = _mm256_mul_ps(k_x, inv_k), kz_ik = _mm256_mul_ps(k_z, inv_k);
+        const __m256 kxx = _mm256_mul_ps(k_x, kx_ik), kxz = _mm256_mul_ps(k_x, kz_ik),
+                     kzz = _mm256_mul_ps(k_z, kz_ik);
+
+        store_complex_avx2(a, FIELD_DY, x, hs_re, hs_im);
+        store_complex_avx2(
+            a, FIELD_DX, x, _mm256_fnmadd_ps(kx_ik, hs_im, zero), _mm256_mul_ps(kx_ik, hs_re));
+        store_complex_avx2(
+            a, FIELD_DZ, x, _mm256_fnmadd_ps(kz_ik, hs_im, zero), _mm256_mul_ps(kz_ik, hs_re));
+        store_complex_avx2(
+            a, FIELD_DDY_DU, x, _mm256_fnmadd_ps(k_x, hs_im, zero), _mm256_mul_ps(k_x, hs_re));
+        store_complex_avx2(
+            a, FIELD_DDY_DV, x, _mm256_fnmadd_ps(k_z, hs_im, zero), _mm256_mul_ps(k_z, hs_re));
+        store_complex_avx2(a, FIELD_DDX_DU, x, _mm256_mul_ps(kxx, hs_re), _mm256_mul_ps(kxx, hs_im));
+        store_complex_avx2(a, FIELD_DDX_DV, x, _mm256_mul_ps(kxz, hs_re), _mm256_mul_ps(kxz, hs_im));
+        if (!a.reduced_fields)
+            store_complex_avx2(a, FIELD_DDZ_DU, x, _mm256_mul_ps(kxz, hs_re), _mm256_mul_ps(kxz, hs_im));
+        store_complex_avx2(a, ddz_dv_field, x, _mm256_mul_ps(kzz, hs_re), _mm256_mul_ps(kzz, hs_im));
+    }
+    for (; x < a.count; ++x)
+        phase_shift_scalar(a, x);
+}
+
+CPU_SIMD_TARGET_AVX512 inline void store_complex_avx512(const row_args &a, field f, int x, __m512 re, __m512 im)
+{
+    const __m512i first = _mm512_setr_epi32(0, 1, 2, 3, 16, 17, 18, 19, 4, 5, 6, 7, 20, 21, 22, 23);
+    const __m512i second = _mm512_setr_epi32(8, 9, 10, 11, 24, 25, 26, 27, 12, 13, 14, 15, 28, 29, 30, 31);
+    real *dst = a.out + f * a.field_stride + 2 * x;
+    __m512 lo = _mm512_unpacklo_ps(re, im), hi = _mm512_unpackhi_ps(re, im);
+    _mm512_storeu_ps(dst, _mm512_permutex2var_ps(lo, first, hi));
+    _mm512_storeu_ps(dst + 16, _mm512_permutex2var_ps(lo, second, hi));
+}
+
+CPU_SIMD_TARGET_AVX512 void phase_shift_row_avx512(const row_args &a)
+{
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 amplitude = _mm512_set1_ps(a.amplitude);
+    const __m512 time = _mm512_set1_ps(a.time);
+    const __m512 k_z = _mm512_set1_ps(a.k_z);
+    const field ddz_dv_field = get_ddz_dv_field(a);
+
+    int x = 0;
+    for (; x + 16 <= a.count; x += 16) {
+        __m512 s, c;
+        sincos_avx512(_mm512_mul_ps(_mm512_loadu_ps(a.omega + x), time), s, c);
+        s = _mm512_mul_ps(s, amplitude);
+        c = _mm512_mul_ps(c, amplitude);
+
+        const __m512 h_re = _mm512_loadu_ps(a.h0_re + x), h_im = _mm512_loadu_ps(a.h0_im + x);
+        const __m512 hs_re = _mm512_fmsub_ps(h_re, c, _mm512_mul_ps(h_im, s));
+        const __m512 hs_im = _mm512_fmadd_ps(h_im, c, _mm512_mul_ps(h_re, s));
+
+        const __m512 k_x = _mm512_loadu_ps(a.k_x + x);
+        const __m512 inv_k = _mm512_loadu_ps(a.inv_k + x);
+        const __m512 kx_ik = _mm512_mul_ps(k_x, inv_k), kz_ik = _mm512_mul_ps(k_z, inv_k);
+        const __m512 kxx = _mm512_mul_ps(k_x, kx_ik), kxz = _mm512_mul_ps(k_x, kz_ik),
+                     kzz = _mm512_mul_ps(k_z, kz_ik);
+
+        store_complex_avx512(a, FIELD_DY, x, hs_re, hs_im);
+        store_complex_avx512(
+            a, FIELD_DX, x, _mm512_fnmadd_ps(kx_ik, hs_im, zero), _mm512_mul_ps(kx_ik, hs_re));
+        store_complex_avx512(
+            a, FIELD_DZ, x, _mm512_fnmadd_ps(kz_ik, hs_im, zero), _mm512_mul_ps(kz_ik, hs_re));
+        store_complex_avx512(
+            a, FIELD_DDY_DU, x, _mm512_fnmadd_ps(k_x, hs_im, zero), _mm512_mul_ps(k_x, hs_re));
+        store_complex_avx512(
+            a, FIELD_DDY_DV, x, _mm512_fnmadd_ps(k_z, hs_im, zero), _mm512_mul_ps(k_z, hs_re));
+        store_complex_avx512(a, FIELD_DDX_DU, x, _mm512_mul_ps(kxx, hs_re), _mm512_mul_ps(kxx, hs_im));
+        store_complex_avx512(a, FIELD_DDX_DV, x, _mm512_mul_ps(kxz, hs_re), _mm512_mul_ps(kxz, hs_im));
+        if (!a.reduced_fields)
+            store_complex_avx512(a, FIELD_DDZ_DU, x, _mm512_mul_ps(kxz, hs_re), _mm512_mul_ps(kxz, hs_im));
+        store_complex_avx512(a, ddz_dv_field, x, _mm512_mul_ps(kzz, hs_re), _mm512_mul_ps(kzz, hs_im));
+    }
+    for (; x < a.count; ++x)
+        phase_shift_scalar(a, x);
+}
+
+#endif // CPU_SIMD_X86
+
+typedef void (*row_function)(const row_args &);
+
+row_function get_row_function(cpu::simd::instruction_set set)
+{
+#if CPU_SIMD_X86
+    switch (set) {
+    case cpu::simd::INSTRUCTION_SET_AVX512:
+        return phase_shift_row_avx512;
+    case cpu::simd::INSTRUCTION_SET_AVX2:
+        return phase_shift_row_avx2;
+    default:
+        break;
+    }
+#endif
+    return phase_shift_row_scalar;
+}
+
+} // unnamed namespace
+
+host_phase_shift::host_phase_shift(const surface_params &params)
+    : fft_size(params.fft_size)
+    , reduced_fields(params.reduced_fields)
+    , instruction_set(cpu::simd::get_instruction_set())
+{
+}
+
+void host_phase_shift::apply(
+    util::thread_pool &pool,
+    const spectrum &wave_spectrum,
+    real time,
+    real *output) const
+{
+    const int N = fft_size.x, M = fft_size.y;
+    const int size_x = N / 2 + 1;
+    const size_t row_stride = N + 2;
+    const auto &h0 = wave_spectrum.get_host_data();
+    const auto &tables = wave_spectrum.get_wave_tables();
+
+    // All frequencies are multiples of 2*pi/period, so reducing the time keeps
+    // the phases small without changing the result.
+    row_args args;
+    args.k_x = tables.k_x.data();
+    args.amplitude = wave_spectrum.get_current_amplitude();
+    args.time = real(std::fmod(double(time), double(spectrum::period)));
+    args.field_stride = row_stride * M;
+    args.reduced_fields = reduced_fields;
+    args.count = size_x;
+
+    const row_function row_fn = get_row_function(instruction_set);
+    pool.parallel_for(M, [&](int begin, int end) {
+        row_args row = args;
+        for (int z_i = begin; z_i < end; ++z_i) {
+            const size_t offset = size_t(z_i) * size_x;
+            row.h0_re = h0.re.data() + offset;
+            row.h0_im = h0.im.data() + offset;
+            row.k_z = tables.k_z[z_i];
+            row.inv_k = tables.inv_k.data() + offset;
+            row.omega = tables.omega.data() + offset;
+            row.out = output + z_i * row_stride;
+            row_fn(row);
+        }
+    });
+}
+
+} // namespace ocean
@@ -0,0 +1,105 @@
+#include <ocean/host_simulation.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include <ocean/spectrum.h>
+#include <util/trace.h>
+
+using math::real;
+
+namespace ocean {
+
+namespace {
+
+// Keep in sync with kernels/export_to_texture.cl.
+constexpr real max_displacement = real(5);
+
+inline uint32_t unorm8(real x, real max_mag)
+{
+    real v = (x + max_mag) / (real(2) * max_mag);
+    v = std::min(std::max(v, real(0)), real(1));
+    return uint32_t(v * real(255) + real(0.5));
+}
+
+inline uint32_t pack_rgba8(real x, real y, real z, real max_mag)
+{
+    return unorm8(x, max_mag) | (unorm8(y, max_mag) << 8) | (unorm8(z, max_mag) << 16);
+}
+
+} // unnamed namespace
+
+host_simulation::host_simulation(util::thread_pool &pool, const surface_params &params)
+    : pool(pool)
+    , fft_size(params.fft_size)
+    , cascade_max_displacement(max_displacement / spectrum::get_cascade_ratio(params))
+    , num_fields(spectrum::get_num_output_fields(params))
+    , phase_shift(params)
+    , fft_algorithm(pool, params.fft_size, num_fields)
+    , fft_buffer(num_fields * size_t(params.fft_size.x + 2) * params.fft_size.y)
+    , displacement_map(size_t(params.fft_size.x) * params.fft_size.y)
+    , normal_map(size_t(params.fft_size.x) * params.fft_size.y)
+{
+}
+
+void host_simulation::generate(const spectrum &wave_spectrum, real time)
+{
+    {
+        auto phase_shift_timer = util::scoped_timer(timer, timings.phase_shift_milliseconds);
+        util::trace::scope trace_scope("host phase shift");
+        phase_shift.apply(pool, wave_spectrum, time, fft_buffer.data());
+    }
+    {
+        auto fft_timer = util::scoped_timer(timer, timings.fft_milliseconds);
+        util::trace::scope trace_scope("host FFT");
+        fft_algorithm.transform(fft_buffer.data());
+    }
+    {
+        auto export_timer = util::scoped_timer(timer, timings.export_milliseconds);
+        util::trace::scope trace_scope("host export");
+        export_maps();
+    }
+}
+
+void host_simulation::export_maps()
+{
+    const int N = fft_size.x, M = fft_size.y;
+    const size_t row_stride = N + 2;
+    const size_t buf_stride = row_stride * M;
+    const real *in = fft_buffer.data();
+    const bool reduced_fields = num_fields == spectrum::num_reduced_output_fields;
+
+    pool.parallel_for(M, [&](int begin, int end) {
+        for (int j = begin; j < end; ++j) {
+            for (int i = 0; i < N; ++i) {
+                const size_t lin_idx = j * row_stride + i;
+
+                // Displacement.
+                real dx = in[0 * buf_stride + lin_idx];
+                real dy = in[1 * buf_stride + lin_idx];
+                real dz = in[2 * buf_stride + lin_idx];
+
+                // Jacobian.
+                real ddx_du = in[3 * buf_stride + lin_idx] + 1;
+                real ddx_dv = in[4 * buf_stride + lin_idx];
+                real ddy_du = in[5 * buf_stride + lin_idx];
+                real ddy_dv = in[6 * buf_stride + lin_idx];
+                real ddz_du = reduced_fields ? ddx_dv : in[7 * buf_stride + lin_idx];
+                real ddz_dv = in[(num_fields - 1) * buf_stride + lin_idx] + 1;
+
+                // Normal.
+                real nx = ddy_dv * ddz_du - ddz_dv * ddy_du;
+                real ny = ddz_dv * ddx_du - ddx_dv * ddz_du;
+                real nz = ddx_dv * ddy_du - ddy_dv * ddx_du;
+                real inv_n_mag = real(1) / std::sqrt(nx * nx + ny * ny + nz * nz);
+
+                const size_t texel_idx = size_t(j) * N + i;
+                displacement_map[texel_idx] = pack_rgba8(dx, dy, dz, cascade_max_displacement);
+                normal_map[texel_idx] =
+                    pack_rgba8(nx * inv_n_mag, ny * inv_n_mag, nz * inv_n_mag, real(1));
+            }
+        }
+    });
+}
+
+} // namespace ocean
@@ -1,20 +1,524 @@
 #include <ocean/spectrum.h>
 
-#include <random>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <string>
 #include <vector>
 
+#include <api/cpu/simd_math.h>
 #include <api/math.h>
 #include <util/error.h>
+#include <util/thread_pool.h>
+#include <util/trace.h>
 #include <util/util.h>
 
 using math::real;
 
 namespace ocean {
 
-spectrum::spectrum(gpu::compute::context context, const surface_params &params) : params(params)
+constexpr int spectrum::num_output_fields;
+constexpr int spectrum::num_reduced_output_fields;
+constexpr real spectrum::period;
+
+namespace {
+
+real periodize_omega(real omega, real period)
+{
+    real omega_0 = math::two_pi / period;
+    return std::floor(omega / omega_0) * omega_0;
+}
+
+real dispersion_relation(real k, real g, real period)
+{
+    return periodize_omega(std::sqrt(g * k), period);
+}
+
+// Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2,
+// 3"), a counter-based generator: the random numbers of a coefficient only
+// depend on its index, so rows can be generated in any order and on any
+// number of threads. Each cascade has its own key.
+constexpr uint32_t philox_m0 = 0xd2511f53, philox_m1 = 0xcd9e8d57;
+constexpr uint32_t philox_w0 = 0x9e3779b9, philox_w1 = 0xbb67ae85;
+constexpr int philox_rounds = 10;
+
+// First two outputs for the counter (index, 0, 0, 0).
+inline void philox(uint32_t index, uint32_t key, uint32_t &x0, uint32_t &x1)
+{
+    uint32_t c0 = index, c1 = 0, c2 = 0, c3 = 0;
+    uint32_t key0 = key, key1 = 0;
+    for (int round = 0; round < philox_rounds; ++round) {
+        const uint64_t p0 = uint64_t(philox_m0) * c0, p1 = uint64_t(philox_m1) * c2;
+        c0 = uint32_t(p1 >> 32) ^ c1 ^ key0;
+        c1 = uint32_t(p1);
+        c2 = uint32_t(p0 >> 32) ^ c3 ^ key1;
+        c3 = uint32_t(p0);
+        key0 += philox_w0;
+        key1 += philox_w1;
+    }
+    x0 = c0;
+    x1 = c1;
+}
+
+// Two independent standard normal numbers from two random words by the
+// Box-Muller transform.
+inline void gaussian_pair(uint32_t x0, uint32_t x1, real &g0, real &g1)
+{
+    const real u0 = (real(x0 >> 8) + real(0.5)) * real(1.0 / 16777216); // In (0, 1).
+    const real u1 = real(x1 >> 8) * real(1.0 / 16777216); // In [0, 1).
+    const real r = std::sqrt(real(-2) * cpu::simd::log_poly(u0));
+    real s, c;
+    cpu::simd::sincos_poly(math::two_pi * u1, s, c);
+    g0 = r * c;
+    g1 = r * s;
+}
+
+struct noise_row_args {
+    uint32_t first_index; // Of the row in the half spectrum.
+    uint32_t key;
+    real *re, *im;
+    int count;
+};
+
+inline void noise_scalar(const noise_row_args &a, int i)
+{
+    uint32_t x0, x1;
+    philox(a.first_index + uint32_t(i), a.key, x0, x1);
+    gaussian_pair(x0, x1, a.re[i], a.im[i]);
+}
+
+void noise_row_scalar(const noise_row_args &a)
+{
+    for (int i = 0; i < a.count; ++i)
+        noise_scalar(a, i);
+}
+
+// Parameters of the spectrum models other than Phillips, from the wind.
+struct model_args {
+    real g;
+    real wind_speed; // At 10 m.
+    real alpha; // Phillips constant of the high frequency tail.
+    real omega_p; // Peak angular frequency.
+    real gamma; // Peak enhancement.
+    real depth;
+    real s_p; // Mitsuyasu spreading exponent at the peak.
+    real cell_area; // Of a coefficient in the wavenumber plane.
+};
+
+struct envelope_row_args {
+    const real *k_x;
+    real k_z;
+    math::vec2 wind_direction;
+    real inv_L_sqr; // 1 / L^2, L is the largest wave from the wind speed.
+    real l_sqr; // Square of surface_params::wavelength_low_threshold.
+    const model_args *model; // For the spectrum models.
+    const real *noise_re, *noise_im;
+    real *re, *im;
+    int count;
+};
+
+// Magnitude of the coefficient from the Phillips spectrum, Tessendorf
+// (2001), eq. 40 and 41. Mirrored by kernels/initial_spectrum.cl.
+inline real phillips_magnitude(const envelope_row_args &a, real k_x)
+{
+    const real k_sqr = k_x * k_x + a.k_z * a.k_z;
+    if (k_sqr < real(1e-10))
+        return real(0);
+    const real w = k_x * a.wind_direction.x + a.k_z * a.wind_direction.y;
+    const real damp = cpu::simd::exp_poly(-a.inv_L_sqr / k_sqr - k_sqr * a.l_sqr);
+    const real p = damp * w * w / (k_sqr * k_sqr * k_sqr);
+    return real(1e-3) * std::sqrt(p * real(0.5));
+}
+
+inline void envelope_scalar(const envelope_row_args &a, int i)
+{
+    const real mag = phillips_magnitude(a, a.k_x[i]);
+    a.re[i] = mag * a.noise_re[i];
+    a.im[i] = mag * a.noise_im[i];
+}
+
+void envelope_row_scalar(const envelope_row_args &a)
+{
+    for (int i = 0; i < a.count; ++i)
+        envelope_scalar(a, i);
+}
+
+#if CPU_SIMD_X86
+
+// 32x32 -> 64 bit products of the lanes of a with m.
+CPU_SIMD_TARGET_AVX2 inline void mulhilo_avx2(__m256i a, __m256i m, __m256i &hi, __m256i &lo)
+{
+    const __m256i even = _mm256_mul_epu32(a, m);
+    const __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), m);
+    hi = _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xaa);
+    lo = _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xaa);
+}
+
+CPU_SIMD_TARGET_AVX2 inline void philox_avx2(
+    __m256i index,
+    uint32_t key,
+    __m256i &x0,
+    __m256i &x1)
+{
+    const __m256i m0 = _mm256_set1_epi32(int(philox_m0)), m1 = _mm256_set1_epi32(int(philox_m1));
+    __m256i c0 = index, c1 = _mm256_setzero_si256(), c2 = c1, c3 = c1;
+    uint32_t key0 = key, key1 = 0;
+    for (int round = 0; round < philox_rounds; ++round) {
+        __m256i hi0, lo0, hi1, lo1;
+        mulhilo_avx2(c0, m0, hi0, lo0);
+        mulhilo_avx2(c2, m1, hi1, lo1);
+        c0 = _mm256_xor_si256(_mm256_xor_si256(hi1, c1), _mm256_set1_epi32(int(key0)));
+        c1 = lo1;
+        c2 = _mm256_xor_si256(_mm256_xor_si256(hi0, c3), _mm256_set1_epi32(int(key1)));
+        c3 = lo0;
+        key0 += philox_w0;
+        key1 += philox_w1;
+    }
+    x0 = c0;
+    x1 = c1;
+}
+
+CPU_SIMD_TARGET_AVX2 void noise_row_avx2(const noise_row_args &a)
+{
+    const __m256 unorm_scale = _mm256_set1_ps(real(1.0 / 16777216));
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    int i = 0;
+    for (; i + 8 <= a.count; i += 8) {
+        __m256i x0, x1;
+        philox_avx2(
+            _mm256_add_epi32(_mm256_set1_epi32(int(a.first_index + uint32_t(i))), lane), a.key,
+            x0, x1);
+        const __m256 u0 = _mm256_mul_ps(
+            _mm256_add_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(x0, 8)), _mm256_set1_ps(0.5f)),
+            unorm_scale);
+        const __m256 u1 = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(x1, 8)), unorm_scale);
+        const __m256 r = _mm256_sqrt_ps(
+            _mm256_mul_ps(_mm256_set1_ps(-2.0f), cpu::simd::log_avx2(u0)));
+        __m256 s, c;
+        cpu::simd::sincos_avx2(_mm256_mul_ps(_mm256_set1_ps(math::two_pi), u1), s, c);
+        _mm256_storeu_ps(a.re + i, _mm256_mul_ps(r, c));
+        _mm256_storeu_ps(a.im + i, _mm256_mul_ps(r, s));
+    }
+    for (; i < a.count; ++i)
+        noise_scalar(a, i);
+}
+
+CPU_SIMD_TARGET_AVX2 void envelope_row_avx2(const envelope_row_args &a)
+{
+    const __m256 k_z_sqr = _mm256_set1_ps(a.k_z * a.k_z);
+    const __m256 wind_x = _mm256_set1_ps(a.wind_direction.x);
+    const __m256 k_z_wind = _mm256_set1_ps(a.k_z * a.wind_direction.y);
+    const __m256 neg_inv_L_sqr = _mm256_set1_ps(-a.inv_L_sqr);
+    const __m256 l_sqr = _mm256_set1_ps(a.l_sqr);
+
+    int i = 0;
+    for (; i + 8 <= a.count; i += 8) {
+        const __m256 k_x = _mm256_loadu_ps(a.k_x + i);
+        const __m256 k_sqr = _mm256_fmadd_ps(k_x, k_x, k_z_sqr);
+        const __m256 w = _mm256_fmadd_ps(k_x, wind_x, k_z_wind);
+        const __m256 damp = cpu::simd::exp_avx2(
+            _mm256_fnmadd_ps(k_sqr, l_sqr, _mm256_div_ps(neg_inv_L_sqr, k_sqr)));
+        const __m256 k_6 = _mm256_mul_ps(_mm256_mul_ps(k_sqr, k_sqr), k_sqr);
+        const __m256 p = _mm256_div_ps(_mm256_mul_ps(_mm256_mul_ps(damp, w), w), k_6);
+        __m256 mag = _mm256_mul_ps(
+            _mm256_set1_ps(1e-3f), _mm256_sqrt_ps(_mm256_mul_ps(p, _mm256_set1_ps(0.5f))));
+        mag = _mm256_and_ps(mag, _mm256_cmp_ps(k_sqr, _mm256_set1_ps(1e-10f), _CMP_GE_OQ));
+
+        _mm256_storeu_ps(a.re + i, _mm256_mul_ps(mag, _mm256_loadu_ps(a.noise_re + i)));
+        _mm256_storeu_ps(a.im + i, _mm256_mul_ps(mag, _mm256_loadu_ps(a.noise_im + i)));
+    }
+    for (; i < a.count; ++i)
+        envelope_scalar(a, i);
+}
+
+#endif // CPU_SIMD_X86
+
+// The models are frequency spectra S(omega), in m^2 s. All have the
+// Pierson-Moskowitz shape, alpha g^2 omega^-5 exp(-5/4 (omega_p / omega)^4).
+inline real pierson_moskowitz_shape(const model_args &m, real omega)
+{
+    const real inv_omega = real(1) / omega;
+    const real inv_omega_2 = inv_omega * inv_omega;
+    const real r = m.omega_p * inv_omega;
+    const real r_2 = r * r;
+    return m.alpha * m.g * m.g * inv_omega_2 * inv_omega_2 * inv_omega *
+           std::exp(real(-1.25) * r_2 * r_2);
+}
+
+// Pierson and Moskowitz (1964), with omega_p = 0.877 g / U_19.5.
+struct pierson_moskowitz_model {
+    static real evaluate(const model_args &m, real omega)
+    {
+        return pierson_moskowitz_shape(m, omega);
+    }
+};
+
+// Hasselmann et al. (1973), with alpha and omega_p from the fetch.
+struct jonswap_model {
+    static real evaluate(const model_args &m, real omega)
+    {
+        const real sigma = (omega <= m.omega_p) ? real(0.07) : real(0.09);
+        const real d = (omega - m.omega_p) / (sigma * m.omega_p);
+        const real r = std::exp(real(-0.5) * d * d);
+        return pierson_moskowitz_shape(m, omega) * std::pow(m.gamma, r);
+    }
+};
+
+// Bouws et al. (1985): JONSWAP times the depth function of Kitaigorodskii et
+// al. (1975), in the approximation of Thompson and Vincent.
+struct tma_model {
+    static real evaluate(const model_args &m, real omega)
+    {
+        const real omega_h = omega * std::sqrt(m.depth / m.g);
+        real phi = real(1);
+        if (omega_h <= real(1))
+            phi = real(0.5) * omega_h * omega_h;
+        else if (omega_h < real(2))
+            phi = real(1) - real(0.5) * (real(2) - omega_h) * (real(2) - omega_h);
+        return jonswap_model::evaluate(m, omega) * phi;
+    }
+};
+
+// The spreading functions D(theta) integrate to one over all directions.
+// Since the half spectrum stands for both k and -k, they are evaluated as
+// (D(theta) + D(theta + pi)) / 2, which keeps the variance.
+
+// 2 / pi cos^2(theta) downwind, zero upwind.
+struct cosine_squared_spreading {
+    static real evaluate(const model_args &, real cos_theta, real)
+    {
+        return cos_theta * cos_theta / math::pi;
+    }
+};
+
+// Mitsuyasu et al. (1975): N(s) cos^2s(theta / 2), with s falling off from
+// s_p at the peak.
+struct mitsuyasu_spreading {
+    static real evaluate(const model_args &m, real cos_theta, real omega)
+    {
+        const real ratio = omega / m.omega_p;
+        const real s = m.s_p * ((ratio <= real(1)) ? std::pow(ratio, real(5))
+                                                   : std::pow(ratio, real(-2.5)));
+        const real norm = std::exp(std::lgamma(s + real(1)) - std::lgamma(s + real(0.5))) /
+                          (real(2) * std::sqrt(math::pi));
+        const real c = real(0.5) * (real(1) + cos_theta); // cos^2(theta / 2)
+        return real(0.5) * norm * (std::pow(c, s) + std::pow(real(1) - c, s));
+    }
+};
+
+// Donelan, Hamilton and Hui (1985) with the extension of Banner (1990) above
+// 1.6 omega_p: beta / (2 tanh(beta pi)) sech^2(beta theta).
+struct donelan_banner_spreading {
+    static real evaluate(const model_args &m, real cos_theta, real omega)
+    {
+        const real ratio = std::max(omega / m.omega_p, real(0.56));
+        real beta;
+        if (ratio < real(0.95))
+            beta = real(2.61) * std::pow(ratio, real(1.3));
+        else if (ratio < real(1.6))
+            beta = real(2.28) * std::pow(ratio, real(-0.65));
+        else
+            beta = std::pow(real(10), real(-0.4) + real(0.8393) * std::pow(ratio, real(-1.134)));
+        const real theta = std::acos(std::min(std::max(cos_theta, real(-1)), real(1)));
+        const real sech_0 = real(1) / std::cosh(beta * theta);
+        const real sech_1 = real(1) / std::cosh(beta * (math::pi - theta));
+        return real(0.25) * beta / std::tanh(beta * math::pi) *
+               (sech_0 * sech_0 + sech_1 * sech_1);
+    }
+};
+
+// Magnitude of the coefficient with energy S(omega) D(theta) omega / (2 k^2)
+// dk_x dk_z, for deep water omega. A policy pair per instantiation keeps the
+// loop free of branches on the model.
+template <typename Model, typename Spreading>
+void envelope_row_model(const envelope_row_args &a)
+{
+    const model_args &m = *a.model;
+    for (int i = 0; i < a.count; ++i) {
+        const real k_x = a.k_x[i];
+        const real k_sqr = k_x * k_x + a.k_z * a.k_z;
+        real mag = real(0);
+        if (k_sqr >= real(1e-10)) {
+            const real k = std::sqrt(k_sqr);
+            const real omega = std::sqrt(m.g * k);
+            const real cos_theta = (k_x * a.wind_direction.x + a.k_z * a.wind_direction.y) / k;
+            const real energy = Model::evaluate(m, omega) *
+                                Spreading::evaluate(m, cos_theta, omega) * omega /
+                                (real(2) * k_sqr) * std::exp(-k_sqr * a.l_sqr);
+            mag = std::sqrt(real(0.5) * energy * m.cell_area);
+        }
+        a.re[i] = mag * a.noise_re[i];
+        a.im[i] = mag * a.noise_im[i];
+    }
+}
+
+model_args get_model_args(const surface_params &params, real g)
+{
+    model_args m;
+    const real U = params.wind_speed;
+    m.g = g;
+    m.wind_speed = U;
+    m.gamma = params.peak_enhancement;
+    m.depth = params.depth;
+    m.cell_area = math::two_pi * math::two_pi /
+                  (params.tile_size_physical.x * params.tile_size_physical.y);
+    if (U <= real(0)) {
+        // Calm sea.
+        m.alpha = real(0);
+        m.omega_p = real(1);
+        m.s_p = real(1);
+        return m;
+    }
+    if (params.model == SPECTRUM_MODEL_PIERSON_MOSKOWITZ) {
+        const real U_19_5 = real(1.026) * U;
+        m.alpha = real(8.1e-3);
+        m.omega_p = real(0.877) * g / U_19_5;
+        m.gamma = real(1);
+    } else {
+        const real F = params.fetch;
+        m.alpha = real(0.076) * std::pow(U * U / (F * g), real(0.22));
+        m.omega_p = real(22) * std::cbrt(g * g / (U * F));
+    }
+    m.s_p = real(11.5) * std::pow(m.omega_p * U / g, real(-2.5));
+    return m;
+}
+
+typedef void (*noise_row_function)(const noise_row_args &);
+typedef void (*envelope_row_function)(const envelope_row_args &);
+
+// AVX-512 machines use the AVX2 rows, the spectrum is not rebuilt often
+// enough to need a third version.
+noise_row_function get_noise_row_function(cpu::simd::instruction_set set)
+{
+#if CPU_SIMD_X86
+    if (set >= cpu::simd::INSTRUCTION_SET_AVX2)
+        return noise_row_avx2;
+#endif
+    return noise_row_scalar;
+}
+
+template <typename Model>
+envelope_row_function get_model_row_function(directional_spreading spreading)
+{
+    switch (spreading) {
+    case DIRECTIONAL_SPREADING_MITSUYASU:
+        return envelope_row_model<Model, mitsuyasu_spreading>;
+    case DIRECTIONAL_SPREADING_DONELAN_BANNER:
+        return envelope_row_model<Model, donelan_banner_spreading>;
+    case DIRECTIONAL_SPREADING_COSINE_SQUARED:
+    default:
+        return envelope_row_model<Model, cosine_squared_spreading>;
+    }
+}
+
+// Only the Phillips spectrum, which the demo rebuilds interactively, has SIMD
+// rows.
+envelope_row_function get_envelope_row_function(
+    cpu::simd::instruction_set set,
+    const surface_params &params)
+{
+    switch (params.model) {
+    case SPECTRUM_MODEL_PIERSON_MOSKOWITZ:
+        return get_model_row_function<pierson_moskowitz_model>(params.spreading);
+    case SPECTRUM_MODEL_JONSWAP:
+        return get_model_row_function<jonswap_model>(params.spreading);
+    case SPECTRUM_MODEL_TMA:
+        return get_model_row_function<tma_model>(params.spreading);
+    case SPECTRUM_MODEL_PHILLIPS:
+    default:
+        break;
+    }
+#if CPU_SIMD_X86
+    if (set >= cpu::simd::INSTRUCTION_SET_AVX2)
+        return envelope_row_avx2;
+#endif
+    return envelope_row_scalar;
+}
+
+real get_largest_wave_inv_sqr(const surface_params &params, real g)
+{
+    const real L = params.wind_speed * params.wind_speed / g;
+    return real(1) / (L * L);
+}
+
+// Of the waves a cascade is the first to fit, see spectrum::get_cascade_band.
+constexpr real cascade_band_waves = 4;
+
+// Factor of the magnitudes of a cascade. The Phillips amplitude is relative to
+// the cells of the first tile, the cells of the others are larger by the ratio
+// of the tiles in either dimension; the other models scale with the cell area.
+real get_cascade_gain(const surface_params &params)
+{
+    return params.model == SPECTRUM_MODEL_PHILLIPS ? spectrum::get_cascade_ratio(params) : real(1);
+}
+
+// Leaves out the waves of the other cascades and scales the rest by gain.
+void band_row(const envelope_row_args &a, math::vec2 band, real gain)
+{
+    for (int i = 0; i < a.count; ++i) {
+        const real k = std::sqrt(a.k_x[i] * a.k_x[i] + a.k_z * a.k_z);
+        const real s = (k >= band.x && k < band.y) ? gain : real(0);
+        a.re[i] *= s;
+        a.im[i] *= s;
+    }
+}
+
+} // unnamed namespace
+
+void spectrum::fade::update(real time, real duration)
+{
+    if (is_settled() && !is_starting)
+        return;
+    if (is_starting) {
+        start = time;
+        is_starting = false;
+    }
+    // Time running backwards, as when a tool restarts, ends the blend.
+    if (duration <= 0 || time < start)
+        weight = 1;
+    else
+        weight = std::min((time - start) / duration, real(1));
+}
+
+spectrum::spectrum(gpu::compute::context context, const surface_params &params)
+    : params(params)
+    , instruction_set(cpu::simd::get_instruction_set())
+    , context(context)
+    , target_slot(0)
+    , amplitude_from(params.amplitude)
+    , is_fade_skipped(true)
+    , is_target_built(false)
+    , is_rebuild_pending(false)
+    , is_envelope_dirty(false)
+{
+    tables.set(build_wave_tables(params));
+    if (context()) {
+        load_kernels();
+        upload_wave_table();
+        const size_t size = 2 * sizeof(real) * (params.fft_size.x / 2 + 1) * params.fft_size.y;
+        for (auto &buffer : initial_spectra)
+            buffer = gpu::compute::buffer(context, CL_MEM_READ_WRITE, size);
+    }
+    draw_noise();
+    rebuild();
+    finish_transition();
+}
+
+spectrum::~spectrum()
 {
-    rebuild(context);
-    load_phase_shift_kernel(context);
+    if (builder.joinable())
+        builder.join();
+}
+
+void spectrum::set_amplitude(float amplitude)
+{
+    if (amplitude == params.amplitude)
+        return;
+    amplitude_from = get_current_amplitude();
+    params.amplitude = amplitude;
+    amplitude_fade.restart();
 }
 
 gpu::compute::event spectrum::enqueue_generate(
@@ -23,69 +527,376 @@ gpu::compute::event spectrum::enqueue_generate(
     gpu::compute::memory_object output_buffer,
     const gpu::compute::event_vector *wait_events)
 {
-    phase_shift_kernel.setArg(0, initial_spectrum);
-    phase_shift_kernel.setArg(1, params.tile_size_physical.x);
-    phase_shift_kernel.setArg(2, params.tile_size_physical.z);
-    phase_shift_kernel.setArg(3, params.fft_size.x);
-    phase_shift_kernel.setArg(4, params.fft_size.y);
-    phase_shift_kernel.setArg(5, time);
-    phase_shift_kernel.setArg(6, params.amplitude);
-    phase_shift_kernel.setArg(7, output_buffer);
-
-    auto offset = gpu::compute::nd_range(0);
-    auto global_size = gpu::compute::nd_range((params.fft_size.x + 2) * params.fft_size.y);
-    auto local_size = gpu::compute::nd_range(64);
+    // A rebuild since the last call is applied here, where a queue is at hand.
+    gpu::compute::event install_event;
+    gpu::compute::event_vector install_events;
+    if (is_envelope_dirty) {
+        enqueue_install_target(queue, wait_events, install_event);
+        install_events.push_back(install_event);
+        wait_events = &install_events;
+    }
+    update(time);
+
+    // The surface is periodic in time, reducing t keeps the phases small.
+    real reduced_time = real(std::fmod(double(time), double(period)));
+
+    // Once settled, both inputs are the target.
+    const auto &to = initial_spectra[target_slot];
+    const auto &from = spectrum_fade.is_settled() ? to : initial_spectra[1 - target_slot];
+    auto &kernel = params.packed_fft ? phase_shift_packed_kernel : phase_shift_kernel;
+    kernel.setArg(0, from);
+    kernel.setArg(1, to);
+    kernel.setArg(2, spectrum_fade.weight);
+    kernel.setArg(3, wave_table);
+    kernel.setArg(4, params.fft_size.x);
+    kernel.setArg(5, params.fft_size.y);
+    kernel.setArg(6, reduced_time);
+    kernel.setArg(7, get_current_amplitude());
+    kernel.setArg(8, output_buffer);
+    const int num_fields =
+        params.packed_fft ? get_num_packed_output_fields(params) : get_num_output_fields(params);
+    kernel.setArg(9, params.cascade * num_fields);
+
     gpu::compute::event event;
-    queue.enqueueNDRangeKernel(phase_shift_kernel, offset, global_size, local_size, wait_events, &event);
+    if (params.packed_fft) {
+        // One work item per coefficient of the full spectrum.
+        auto offset = gpu::compute::nd_range(0, 0);
+        auto global_size = gpu::compute::nd_range(params.fft_size.x, params.fft_size.y);
+        queue.enqueueNDRangeKernel(kernel, offset, global_size, cl::NullRange, wait_events, &event);
+    } else {
+        auto offset = gpu::compute::nd_range(0);
+        auto global_size = gpu::compute::nd_range((params.fft_size.x + 2) * params.fft_size.y);
+        auto local_size = gpu::compute::nd_range(64);
+        queue.enqueueNDRangeKernel(kernel, offset, global_size, local_size, wait_events, &event);
+    }
 
     return event;
 }
 
-void spectrum::rebuild(gpu::compute::context context)
+void spectrum::draw_noise()
+{
+    wait_for_rebuild();
+
+    util::trace::scope trace_scope("draw spectrum noise");
+    const int size_x = params.fft_size.x / 2 + 1;
+    const int M = params.fft_size.y;
+    const int elem_count = size_x * M;
+    noise_host.re.resize(elem_count);
+    noise_host.im.resize(elem_count);
+
+    noise_row_args args;
+    args.key = uint32_t(params.cascade);
+    args.count = size_x;
+    const noise_row_function row_fn = get_noise_row_function(instruction_set);
+    util::default_thread_pool().parallel_for(M, [&](int begin, int end) {
+        noise_row_args row = args;
+        for (int j = begin; j < end; ++j) {
+            const size_t offset = size_t(j) * size_x;
+            row.first_index = uint32_t(offset);
+            row.re = noise_host.re.data() + offset;
+            row.im = noise_host.im.data() + offset;
+            row_fn(row);
+        }
+    }, 4);
+
+    // Upload the noise once; the kernel expects interleaved real/imaginary
+    // pairs. The host copy is only needed by host-only spectra.
+    if (!context())
+        return;
+    std::vector<real> data(2 * elem_count);
+    for (int i = 0; i < elem_count; ++i) {
+        data[2 * i] = noise_host.re[i];
+        data[2 * i + 1] = noise_host.im[i];
+    }
+    noise = gpu::compute::buffer(context, data.begin(), data.end(), true);
+    noise_host = host_data();
+}
+
+void spectrum::rebuild()
+{
+    if (context())
+        is_envelope_dirty = true;
+    else if (builder.joinable())
+        is_rebuild_pending = true;
+    else
+        launch_rebuild();
+}
+
+void spectrum::update(real time)
+{
+    if (builder.joinable() && is_target_built) {
+        builder.join();
+        install_host_target();
+        if (is_rebuild_pending) {
+            is_rebuild_pending = false;
+            launch_rebuild();
+        }
+    }
+    spectrum_fade.update(time, params.transition_time);
+    amplitude_fade.update(time, params.transition_time);
+    if (context() || spectrum_fade.is_settled())
+        return;
+
+    // Blend the host copy for the phase shift.
+    util::trace::scope trace_scope("blend spectra");
+    const auto &from = host_spectra[1 - target_slot];
+    const auto &to = host_spectra[target_slot];
+    const real w = spectrum_fade.weight;
+    const int count = int(to.re.size());
+    host_blend.re.resize(count);
+    host_blend.im.resize(count);
+    util::default_thread_pool().parallel_for(count, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            host_blend.re[i] = from.re[i] + w * (to.re[i] - from.re[i]);
+            host_blend.im[i] = from.im[i] + w * (to.im[i] - from.im[i]);
+        }
+    }, 4096);
+}
+
+void spectrum::finish_transition()
+{
+    wait_for_rebuild();
+    spectrum_fade.settle();
+    amplitude_fade.settle();
+    if (is_envelope_dirty)
+        is_fade_skipped = true;
+}
+
+void spectrum::launch_rebuild()
 {
-    int elem_count = (params.fft_size.x / 2 + 1) * params.fft_size.y * 2;
-    std::vector<real> data(elem_count);
-    std::default_random_engine gen(0);
-    std::normal_distribution<real> dist;
+    is_target_built = false;
+    const surface_params target_params = params;
+    builder = std::thread([this, target_params] {
+        build_envelope(target_params, instruction_set, noise_host, host_target);
+        is_target_built = true;
+    });
+}
 
-    // Generate the 2D Fourier coefficients of the ocean heightfield.
-    int idx = 0;
-    for (int j = 0; j < params.fft_size.y; ++j) {
-        for (int i = 0; i <= params.fft_size.x / 2; ++i) {
-            real p = phillips_spectrum(i, j);
-            real mag = 1e-3f * sqrt(p * real(0.5));
-            data[idx++] = mag * dist(gen); // real part
-            data[idx++] = mag * dist(gen); // imaginary part
+void spectrum::wait_for_rebuild()
+{
+    while (builder.joinable()) {
+        builder.join();
+        install_host_target();
+        if (is_rebuild_pending) {
+            is_rebuild_pending = false;
+            launch_rebuild();
         }
     }
+}
+
+// Runs on the builder thread, serially: the frame keeps the thread pool.
+void spectrum::build_envelope(
+    const surface_params &p,
+    cpu::simd::instruction_set set,
+    const host_data &noise,
+    host_data &out)
+{
+    util::trace::scope trace_scope("rebuild spectrum");
+    const int N = p.fft_size.x, M = p.fft_size.y;
+    const int size_x = N / 2 + 1;
+    const int elem_count = size_x * M;
+    out.re.resize(elem_count);
+    out.im.resize(elem_count);
 
-    // Upload data to GPU.
-    int size_bytes = elem_count * sizeof(real);
-    initial_spectrum = gpu::compute::buffer(context, data.begin(), data.end(), true);
+    // Unlike the wave tables, the last column has the negative Nyquist
+    // frequency.
+    std::vector<real> k_x(size_x);
+    for (int i = 0; i < size_x; ++i)
+        k_x[i] = math::two_pi * real((i + N / 2) % N - N / 2) / p.tile_size_physical.x;
+    const model_args model = get_model_args(p, g);
+    envelope_row_args row;
+    row.k_x = k_x.data();
+    row.model = &model;
+    row.wind_direction = p.wind_direction;
+    row.inv_L_sqr = get_largest_wave_inv_sqr(p, g);
+    row.l_sqr = p.wavelength_low_threshold * p.wavelength_low_threshold;
+    row.count = size_x;
+
+    const envelope_row_function row_fn = get_envelope_row_function(set, p);
+    const math::vec2 band = get_cascade_band(p);
+    const real gain = get_cascade_gain(p);
+    for (int j = 0; j < M; ++j) {
+        const size_t offset = size_t(j) * size_x;
+        row.k_z = math::two_pi * real((j + M / 2) % M - M / 2) / p.tile_size_physical.y;
+        row.noise_re = noise.re.data() + offset;
+        row.noise_im = noise.im.data() + offset;
+        row.re = out.re.data() + offset;
+        row.im = out.im.data() + offset;
+        row_fn(row);
+        if (p.num_cascades > 1)
+            band_row(row, band, gain);
+    }
 }
 
-void spectrum::load_phase_shift_kernel(gpu::compute::context context)
+// A blend in progress continues from what was shown last, update left it in
+// host_blend; a settled spectrum becomes the start of the next blend.
+void spectrum::install_host_target()
 {
-    auto program = gpu::compute::create_program_from_file(context, "kernels/phase_shift.cl");
+    if (is_fade_skipped) {
+        is_fade_skipped = false;
+    } else {
+        if (spectrum_fade.is_settled())
+            target_slot = 1 - target_slot;
+        else
+            std::swap(host_spectra[1 - target_slot], host_blend);
+        spectrum_fade.restart();
+    }
+    std::swap(host_spectra[target_slot], host_target);
+}
+
+void spectrum::enqueue_install_target(
+    gpu::compute::command_queue queue,
+    const gpu::compute::event_vector *wait_events,
+    gpu::compute::event &event)
+{
+    const int size_x = params.fft_size.x / 2 + 1;
+    gpu::compute::event blend_event;
+    gpu::compute::event_vector blend_events;
+    if (is_fade_skipped) {
+        is_fade_skipped = false;
+    } else {
+        if (spectrum_fade.is_settled()) {
+            target_slot = 1 - target_slot;
+        } else {
+            // Bake the blend shown last into the start of the next one.
+            blend_kernel.setArg(0, initial_spectra[1 - target_slot]);
+            blend_kernel.setArg(1, initial_spectra[target_slot]);
+            blend_kernel.setArg(2, spectrum_fade.weight);
+            auto offset = gpu::compute::nd_range(0);
+            auto global_size = gpu::compute::nd_range(size_t(size_x) * params.fft_size.y);
+            queue.enqueueNDRangeKernel(
+                blend_kernel, offset, global_size, cl::NullRange, wait_events, &blend_event);
+            blend_events.push_back(blend_event);
+            wait_events = &blend_events;
+        }
+        spectrum_fade.restart();
+    }
+
+    envelope_kernel.setArg(0, noise);
+    envelope_kernel.setArg(1, params.fft_size.x);
+    envelope_kernel.setArg(2, params.fft_size.y);
+    const auto &tile = params.tile_size_physical;
+    const real l = params.wavelength_low_threshold;
+    envelope_kernel.setArg(3, math::vec2(tile.x, tile.y));
+    envelope_kernel.setArg(4, params.wind_direction);
+    envelope_kernel.setArg(5, get_largest_wave_inv_sqr(params, g));
+    envelope_kernel.setArg(6, l * l);
+    const model_args model = get_model_args(params, g);
+    envelope_kernel.setArg(7, model.alpha);
+    envelope_kernel.setArg(8, model.omega_p);
+    envelope_kernel.setArg(9, model.gamma);
+    envelope_kernel.setArg(10, model.depth);
+    envelope_kernel.setArg(11, model.s_p);
+    envelope_kernel.setArg(12, get_cascade_band(params));
+    envelope_kernel.setArg(13, get_cascade_gain(params));
+    envelope_kernel.setArg(14, initial_spectra[target_slot]);
+    auto offset = gpu::compute::nd_range(0, 0);
+    auto global_size = gpu::compute::nd_range(size_x, params.fft_size.y);
+    queue.enqueueNDRangeKernel(
+        envelope_kernel, offset, global_size, cl::NullRange, wait_events, &event);
+    is_envelope_dirty = false;
+}
+
+surface_params spectrum::get_cascade_params(const surface_params &params, int cascade)
+{
+    surface_params res = params;
+    res.cascade = cascade;
+    const real ratio = get_cascade_ratio(res);
+    res.tile_size_physical = res.tile_size_physical / ratio;
+    res.tile_size_logical = res.tile_size_logical / ratio;
+    return res;
+}
+
+math::vec2 spectrum::get_cascade_band(const surface_params &params)
+{
+    const real k_tile = math::two_pi / params.tile_size_physical.x;
+    math::vec2 band(real(0), std::numeric_limits<real>::max());
+    if (params.cascade > 0)
+        band.x = cascade_band_waves * k_tile;
+    if (params.cascade + 1 < params.num_cascades)
+        band.y = cascade_band_waves * params.cascade_scale * k_tile;
+    return band;
+}
+
+double spectrum::get_significant_wave_height(const surface_params &params)
+{
+    // The noise has a variance of two per coefficient; a unit real part gives
+    // the magnitudes themselves.
+    const size_t size_x = params.fft_size.x / 2 + 1;
+    const size_t elem_count = size_x * params.fft_size.y;
+    host_data unit_noise, mag;
+    unit_noise.re.assign(elem_count, real(1));
+    unit_noise.im.assign(elem_count, real(0));
+    build_envelope(params, cpu::simd::get_instruction_set(), unit_noise, mag);
+
+    // The columns between the first and the last stand for their mirror
+    // images too; the hermitian-to-real transform halves the variance of the
+    // first and the last.
+    double variance = 0;
+    for (size_t i = 0; i < elem_count; ++i) {
+        const size_t x_i = i % size_x;
+        const double weight = (x_i == 0 || x_i == size_x - 1) ? 1 : 2;
+        variance += weight * 2 * double(mag.re[i]) * mag.re[i];
+    }
+    return 4 * std::sqrt(variance);
+}
+
+spectrum::wave_tables spectrum::build_wave_tables(const surface_params &params)
+{
+    const int N = params.fft_size.x, M = params.fft_size.y;
+    const int size_x = N / 2 + 1;
+    const real Lx = params.tile_size_physical.x, Lz = params.tile_size_physical.z;
+
+    wave_tables t;
+    t.k_x.resize(size_x);
+    for (int x_i = 0; x_i < size_x; ++x_i)
+        t.k_x[x_i] = math::two_pi * x_i / Lx;
+    t.k_z.resize(M);
+    for (int z_i = 0; z_i < M; ++z_i)
+        t.k_z[z_i] = math::two_pi * ((z_i + M / 2) % M - M / 2) / Lz;
+
+    t.inv_k.resize(size_t(size_x) * M);
+    t.omega.resize(size_t(size_x) * M);
+    for (int z_i = 0; z_i < M; ++z_i) {
+        for (int x_i = 0; x_i < size_x; ++x_i) {
+            const size_t idx = size_t(z_i) * size_x + x_i;
+            const real k = std::sqrt(t.k_x[x_i] * t.k_x[x_i] + t.k_z[z_i] * t.k_z[z_i]);
+            t.inv_k[idx] = (k < real(1e-10)) ? real(0) : real(1) / k;
+            t.omega[idx] = dispersion_relation(k, g, period);
+        }
+    }
+    return t;
+}
+
+void spectrum::load_kernels()
+{
+    auto program = gpu::compute::create_program_from_file(
+        context, "kernels/phase_shift.cl", get_kernel_build_options(params));
     phase_shift_kernel = gpu::compute::kernel(program, "phase_shift");
+    phase_shift_packed_kernel = gpu::compute::kernel(program, "phase_shift_packed");
+    // The kernel is specialized for the spectrum model, like the host rows.
+    const std::string model_options = "-DSPECTRUM_MODEL=" + std::to_string(int(params.model)) +
+                                      " -DDIRECTIONAL_SPREADING=" +
+                                      std::to_string(int(params.spreading));
+    program = gpu::compute::create_program_from_file(
+        context, "kernels/initial_spectrum.cl", model_options);
+    envelope_kernel = gpu::compute::kernel(program, "apply_envelope");
+    blend_kernel = gpu::compute::kernel(program, "blend_spectra");
 }
 
-real spectrum::phillips_spectrum(int i, int j)
+void spectrum::upload_wave_table()
 {
-    int N = params.fft_size.x, M = params.fft_size.y;
-    int ii = (i + N / 2) % N - N / 2;
-    int jj = (j + M / 2) % M - M / 2;
-    real k_x = 2.0f * math::pi * real(ii) / params.tile_size_physical.x;
-    real k_z = 2.0f * math::pi * real(jj) / params.tile_size_physical.y;
-    real k = sqrt(k_x * k_x + k_z * k_z);
-    if (k < real(1e-5))
-        return real(0);
-    real w_cos = (k_x * params.wind_direction.x + k_z * params.wind_direction.y) / k;
-    real L = params.wind_speed * params.wind_speed / g;
-    real k_sqr = k * k;
-    real damp_large = exp(-real(1) / (k_sqr * L * L));
-    real damp_small = exp(-k_sqr * params.wavelength_low_threshold * params.wavelength_low_threshold);
-    return damp_large * damp_small * w_cos * w_cos / (k_sqr * k_sqr);
+    const auto &t = tables.get();
+    const int size_x = params.fft_size.x / 2 + 1;
+    const int elem_count = size_x * params.fft_size.y;
+    std::vector<real> table_data(4 * elem_count);
+    for (int i = 0; i < elem_count; ++i) {
+        table_data[4 * i + 0] = t.k_x[i % size_x];
+        table_data[4 * i + 1] = t.k_z[i / size_x];
+        table_data[4 * i + 2] = t.inv_k[i];
+        table_data[4 * i + 3] = t.omega[i];
+    }
+    wave_table = gpu::compute::buffer(context, table_data.begin(), table_data.end(), true);
 }
 
 } // namespace ocean
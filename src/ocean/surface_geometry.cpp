@@ -1,39 +1,209 @@
 #include <ocean/surface_geometry.h>
 
 #include <util/error.h>
+#include <util/trace.h>
 #include <util/util.h>
 
 namespace ocean {
 
-#define N_FFT_BATCHES 9
+namespace {
+
+gpu::compute::context get_context(gpu::compute::command_queue queue)
+{
+    return queue() ? queue.getInfo<CL_QUEUE_CONTEXT>() : gpu::compute::context();
+}
+
+// Baked loops are rendered on the host, and replays need no spectrum; only
+// the OpenCL simulation keeps it on the device.
+gpu::compute::context get_spectrum_context(
+    gpu::compute::command_queue queue, const surface_params &params)
+{
+    if (!params.replay_file.empty() || params.baked_loop_frames > 0)
+        return gpu::compute::context();
+    return get_context(queue);
+}
+
+// Baked loops and replays hold a single tile.
+int get_num_simulated_cascades(const surface_params &params)
+{
+    if (!params.replay_file.empty() || params.baked_loop_frames > 0)
+        return 1;
+    if (params.num_cascades < 1 || params.num_cascades > max_cascades)
+        DIE("The number of cascades has to be between 1 and %d.\n", max_cascades);
+    return params.num_cascades;
+}
+
+// Offset from device profiling time to trace time, estimated with a marker
+// whose completion is observed right away.
+int64_t get_trace_offset(gpu::compute::command_queue queue)
+{
+    gpu::compute::event marker;
+    queue.enqueueMarkerWithWaitList(nullptr, &marker);
+    marker.wait();
+    int64_t host_ns = util::trace::now();
+    return host_ns - int64_t(marker.getProfilingInfo<CL_PROFILING_COMMAND_END>());
+}
+
+double get_elapsed_milliseconds(const gpu::compute::event &event)
+{
+    int64_t start_ns = event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+    int64_t end_ns = event.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+    return (end_ns - start_ns) * 1e-6;
+}
+
+void record_compute_event(
+    const char *name,
+    const gpu::compute::event &event,
+    int64_t trace_offset_ns)
+{
+    int64_t start_ns = event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+    int64_t end_ns = event.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+    util::trace::record(
+        name, start_ns + trace_offset_ns, end_ns + trace_offset_ns,
+        util::trace::TRACK_COMPUTE_QUEUE);
+}
+
+} // unnamed namespace
 
 surface_geometry::surface_geometry(gpu::compute::command_queue queue, const surface_params &params)
-    : queue(queue)
-    , wave_spectrum(queue.getInfo<CL_QUEUE_CONTEXT>(), params)
-    , fft_algorithm(queue, params.fft_size, N_FFT_BATCHES)
-    , fft_buffer(
-          queue.getInfo<CL_QUEUE_CONTEXT>(),
-          CL_MEM_READ_ONLY,
-          N_FFT_BATCHES * (params.fft_size.x + 2) * params.fft_size.y * sizeof(float))
-    , displacement_map(queue.getInfo<CL_QUEUE_CONTEXT>(), params.fft_size, texture_format::TEXTURE_FORMAT_RGBA8)
-    , height_gradient_map(queue.getInfo<CL_QUEUE_CONTEXT>(), params.fft_size, texture_format::TEXTURE_FORMAT_RGBA8)
+    : backend(params.backend)
+    , is_gl_event_supported(false)
+    , queue(params.backend == SIMULATION_BACKEND_OPENCL ? queue : gpu::compute::command_queue())
+    , trace_offset_ns(0)
+    , displayed_frame(-1)
+    , upload_timer("upload maps")
+    , mipmap_timer("generate mipmaps")
 {
+    // The fields of all cascades are transformed together, one cascade after
+    // the other.
+    auto simulated_params = params;
+    simulated_params.num_cascades = get_num_simulated_cascades(params);
+    const int num_cascades = simulated_params.num_cascades;
+    const int n_fields = spectrum::get_num_output_fields(params);
+    const int n_packed_fields = spectrum::get_num_packed_output_fields(params);
+    const int n_fft_batches = num_cascades * n_fields;
+    const int n_packed_fft_batches = num_cascades * n_packed_fields;
+    timings = timing_data();
+    timings.fft_transform_count = n_fft_batches;
+    timings.num_cascades = num_cascades;
+    displayed_displacement = host_displacement();
+
+    for (int i = 0; i < num_cascades; ++i)
+        spectra.emplace_back(new spectrum(
+            get_spectrum_context(this->queue, params),
+            spectrum::get_cascade_params(simulated_params, i)));
+
+    if (!params.replay_file.empty()) {
+        replay.reset(new surface_replay(util::default_thread_pool(), params.replay_file));
+        const auto size = replay->get_params().fft_size;
+        if (size.x != params.fft_size.x || size.y != params.fft_size.y)
+            DIE("%s was recorded with an FFT size of %dx%d instead of %dx%d.\n",
+                params.replay_file.c_str(), size.x, size.y, params.fft_size.x, params.fft_size.y);
+    } else if (params.baked_loop_frames > 0) {
+        loop.reset(new baked_loop(
+            util::default_thread_pool(), simulated_params, params.baked_loop_frames,
+            params.baked_loop_file));
+    }
+    if (loop || replay) {
+        staging_displacement_map.resize(size_t(params.fft_size.x) * params.fft_size.y);
+        staging_normal_map.resize(size_t(params.fft_size.x) * params.fft_size.y);
+    }
+
+    // Only the OpenCL backend runs asynchronously, the others upload into the
+    // first set.
+    const bool is_pipelined = backend == SIMULATION_BACKEND_OPENCL && !loop && !replay;
+    const int num_frames = is_pipelined ? std::max(params.pipeline_depth, 1) : 1;
+    for (int i = 0; i < num_frames; ++i)
+        frames.emplace_back(
+            new frame_resources(get_context(this->queue), params.fft_size, num_cascades));
+
+    if (params.height_queries)
+        heights.reset(new height_field(util::default_thread_pool(), params));
+
+    if (backend == SIMULATION_BACKEND_HOST) {
+        for (auto &s : spectra)
+            host_sims.emplace_back(
+                new host_simulation(util::default_thread_pool(), s->get_params()));
+        return;
+    }
+
+    if (!queue())
+        DIE("The OpenCL simulation backend needs a command queue.\n");
+
+    if (params.packed_fft) {
+        packed_fft_algorithm.reset(
+            new gpu::fft::ifft2d_complex_inplace(queue, params.fft_size, n_packed_fft_batches));
+        fft_buffer = gpu::compute::buffer(
+            queue.getInfo<CL_QUEUE_CONTEXT>(),
+            CL_MEM_READ_ONLY,
+            n_packed_fft_batches * 2 * params.fft_size.x * params.fft_size.y * sizeof(float));
+        timings.fft_transform_count = n_packed_fft_batches;
+    } else {
+        fft_algorithm.reset(
+            new gpu::fft::ifft2d_hermitian_inplace(queue, params.fft_size, n_fft_batches));
+        fft_buffer = gpu::compute::buffer(
+            queue.getInfo<CL_QUEUE_CONTEXT>(),
+            CL_MEM_READ_ONLY,
+            n_fft_batches * (params.fft_size.x + 2) * params.fft_size.y * sizeof(float));
+    }
+
+    // The x, y and z displacement of the first cascade are the first three
+    // fields, or the first one and a half packed ones. The ring needs a buffer
+    // for each frame in flight and one for the displayed frame.
+    if (params.height_queries || params.map_displacement) {
+        const size_t displacement_size = params.packed_fft
+            ? 4 * size_t(params.fft_size.x) * params.fft_size.y
+            : 3 * size_t(params.fft_size.x + 2) * params.fft_size.y;
+        displacement_ring.reset(new gpu::compute::mapped_buffer_ring(
+            queue, displacement_size * sizeof(float), std::max(3, int(frames.size()) + 1)));
+    }
+
     // Check if device supports cl_khr_gl_event extension.
     auto device = queue.getInfo<CL_QUEUE_DEVICE>();
     auto extensions = gpu::compute::extension_set(device);
     is_gl_event_supported = extensions.has_extension("cl_khr_gl_event");
+    trace_offset_ns = get_trace_offset(queue);
 
     // Load export kernel.
     auto program = gpu::compute::create_program_from_file(
-        queue.getInfo<CL_QUEUE_CONTEXT>(), "kernels/export_to_texture.cl");
-    export_kernel = gpu::compute::kernel(program, "export_to_texture");
+        queue.getInfo<CL_QUEUE_CONTEXT>(), "kernels/export_to_texture.cl",
+        spectrum::get_kernel_build_options(params));
+    for (auto &frame : frames) {
+        for (int i = 0; i < num_cascades; ++i) {
+            auto &cascade = *frame->cascades[i];
+            auto &export_kernel = cascade.export_kernel;
+            export_kernel = gpu::compute::kernel(
+                program, params.packed_fft ? "export_to_texture_packed" : "export_to_texture");
 
-    // Set static export kernel parameters.
-    export_kernel.setArg(0, fft_buffer);
-    export_kernel.setArg(1, params.fft_size.x);
-    export_kernel.setArg(2, params.fft_size.y);
-    export_kernel.setArg(3, displacement_map.img);
-    export_kernel.setArg(4, height_gradient_map.img);
+            // Set static export kernel parameters.
+            export_kernel.setArg(0, fft_buffer);
+            export_kernel.setArg(1, params.fft_size.x);
+            export_kernel.setArg(2, params.fft_size.y);
+            export_kernel.setArg(3, cascade.displacement_map.img);
+            export_kernel.setArg(4, cascade.height_gradient_map.img);
+            export_kernel.setArg(5, i * (params.packed_fft ? n_packed_fields : n_fields));
+            export_kernel.setArg(6, get_cascade_ratio(i));
+        }
+    }
+}
+
+surface_geometry::cascade_resources::cascade_resources(
+    gpu::compute::context context,
+    math::ivec2 size)
+    : displacement_map(context, size, texture_format::TEXTURE_FORMAT_RGBA8)
+    , height_gradient_map(context, size, texture_format::TEXTURE_FORMAT_RGBA8)
+{
+}
+
+surface_geometry::frame_resources::frame_resources(
+    gpu::compute::context context,
+    math::ivec2 size,
+    int num_cascades)
+    : time(0)
+    , displacement_buffer(-1)
+{
+    for (int i = 0; i < num_cascades; ++i)
+        cascades.emplace_back(new cascade_resources(context, size));
 }
 
 surface_geometry::shared_texture::shared_texture(
@@ -46,58 +216,321 @@ surface_geometry::shared_texture::shared_texture(
     tex.set_mag_filter(rendering::texture_2d::MAG_FILTER_LINEAR);
     tex.set_min_filter(rendering::texture_2d::MIN_FILTER_MIPMAP);
     tex.generate_mipmap();
+    if (!context())
+        return;
     glFinish();
     auto gl_tex = tex.get_api_texture();
     img = gpu::compute::graphics_image(context, CL_MEM_WRITE_ONLY, GL_TEXTURE_2D, 0, gl_tex);
 }
 
+void surface_geometry::set_wave_amplitude(float a)
+{
+    for (auto &s : spectra)
+        s->set_amplitude(a);
+    if (loop)
+        loop->invalidate();
+}
+
+void surface_geometry::set_wind_vector(const glm::vec2 &v)
+{
+    for (auto &s : spectra) {
+        s->set_wind_vector(v);
+        s->rebuild();
+    }
+    if (loop)
+        loop->invalidate();
+}
+
 void surface_geometry::enqueue_generate(math::real time, const gpu::compute::event_vector *wait_events)
 {
-    gpu::compute::event event_spectrum, event_fft, event_export;
-    event_spectrum = wave_spectrum.enqueue_generate(queue, time, fft_buffer, wait_events);
-    auto event_vector_spectrum = gpu::compute::event_vector({ event_spectrum });
-    event_fft = fft_algorithm.enqueue_transform(queue, fft_buffer, &event_vector_spectrum);
-    auto event_vector_export = gpu::compute::event_vector({ event_fft });
-    event_export = enqueue_export_kernel(&event_vector_export);
-    event_export.wait();
+    util::trace::scope trace_scope("generate surface");
+    if (replay) {
+        generate_replay(time);
+    } else if (loop) {
+        generate_baked(time);
+    } else if (backend == SIMULATION_BACKEND_HOST) {
+        generate_host(time);
+    } else {
+        enqueue_generate_compute(time, wait_events);
+        return;
+    }
 
-    int64_t spectrum_start_ns = event_spectrum.getProfilingInfo<CL_PROFILING_COMMAND_START>();
-    int64_t spectrum_end_ns = event_spectrum.getProfilingInfo<CL_PROFILING_COMMAND_END>();
-    timings.phase_shift_milliseconds = (spectrum_end_ns - spectrum_start_ns) * 1e-6;
+    displayed_frame = 0;
+    generate_mipmaps(*frames[0]);
+}
+
+void surface_geometry::enqueue_generate_compute(math::real time, const gpu::compute::event_vector *wait_events)
+{
+    retire_frames(false);
+    int frame_index = get_free_frame();
+    if (frame_index < 0) {
+        // All sets are in flight or on screen: wait for the oldest one.
+        retire_frames(true);
+        frame_index = get_free_frame();
+    }
+
+    auto &frame = *frames[frame_index];
+    frame.time = time;
+    gpu::compute::event_vector event_vector_spectrum;
+    for (size_t i = 0; i < spectra.size(); ++i) {
+        auto &cascade = *frame.cascades[i];
+        cascade.event_spectrum = spectra[i]->enqueue_generate(queue, time, fft_buffer, wait_events);
+        event_vector_spectrum.push_back(cascade.event_spectrum);
+    }
+    // One transform for the fields of every cascade.
+    if (packed_fft_algorithm)
+        frame.event_fft =
+            packed_fft_algorithm->enqueue_transform(queue, fft_buffer, &event_vector_spectrum);
+    else
+        frame.event_fft = fft_algorithm->enqueue_transform(queue, fft_buffer, &event_vector_spectrum);
+    auto event_vector_export = gpu::compute::event_vector({ frame.event_fft });
+    // The next frame's phase shift overwrites the buffer only after this copy,
+    // the queue is in-order.
+    if (displacement_ring)
+        frame.displacement_buffer =
+            displacement_ring->enqueue_copy(fft_buffer, &event_vector_export);
+    frame.event_export = enqueue_export_kernel(frame, &event_vector_export);
+    pending_frames.push_back(frame_index);
+    queue.flush();
+
+    // Without a spare set, or before the first frame, there is nothing else
+    // to render.
+    if (frames.size() == 1 || displayed_frame < 0)
+        retire_frames(true);
+}
+
+int surface_geometry::get_free_frame() const
+{
+    for (int i = 0; i < int(frames.size()); ++i) {
+        bool is_pending =
+            std::find(pending_frames.begin(), pending_frames.end(), i) != pending_frames.end();
+        bool is_displayed = i == displayed_frame && frames.size() > 1;
+        if (!is_pending && !is_displayed)
+            return i;
+    }
+    return -1;
+}
+
+void surface_geometry::retire_frames(bool wait_for_oldest)
+{
+    // The queue is in-order, so frames complete in the order they were
+    // enqueued.
+    while (!pending_frames.empty()) {
+        auto &frame = *frames[pending_frames.front()];
+        if (wait_for_oldest) {
+            util::trace::scope trace_scope("wait for surface");
+            frame.event_export.wait();
+            wait_for_oldest = false;
+        } else if (frame.event_export.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>() != CL_COMPLETE) {
+            break;
+        }
+
+        timings.phase_shift_milliseconds = 0;
+        timings.export_milliseconds = 0;
+        for (size_t i = 0; i < frame.cascades.size(); ++i) {
+            const auto &cascade = *frame.cascades[i];
+            auto &cascade_timings = timings.cascades[i];
+            cascade_timings.phase_shift_milliseconds =
+                get_elapsed_milliseconds(cascade.event_spectrum);
+            cascade_timings.fft_milliseconds = 0;
+            cascade_timings.export_milliseconds =
+                get_elapsed_milliseconds(cascade.event_export_kernel);
+            timings.phase_shift_milliseconds += cascade_timings.phase_shift_milliseconds;
+            timings.export_milliseconds += cascade_timings.export_milliseconds;
+        }
+        timings.fft_milliseconds = get_elapsed_milliseconds(frame.event_fft);
+
+        if (util::trace::is_enabled()) {
+            for (const auto &cascade : frame.cascades)
+                record_compute_event("phase shift", cascade->event_spectrum, trace_offset_ns);
+            record_compute_event("FFT", frame.event_fft, trace_offset_ns);
+            record_compute_event("acquire GL objects", frame.event_acquire, trace_offset_ns);
+            for (const auto &cascade : frame.cascades)
+                record_compute_event("export", cascade->event_export_kernel, trace_offset_ns);
+            record_compute_event("release GL objects", frame.event_export, trace_offset_ns);
+        }
+
+        displayed_frame = pending_frames.front();
+        pending_frames.pop_front();
+        generate_mipmaps(frame);
+        if (displacement_ring)
+            set_displayed_displacement(get_mapped_displacement(frame));
+    }
+}
+
+surface_geometry::host_displacement
+surface_geometry::get_mapped_displacement(const frame_resources &frame) const
+{
+    const auto size = spectra.front()->get_params().fft_size;
+    const float *data =
+        static_cast<const float *>(displacement_ring->get_data(frame.displacement_buffer));
+    host_displacement res;
+    res.time = frame.time;
+    if (packed_fft_algorithm) {
+        // dx and dy are the real and imaginary part of the first field, dz the
+        // real part of the second one.
+        const size_t row_stride = 2 * size_t(size.x);
+        const size_t field_stride = row_stride * size.y;
+        res.dx = { data, 2, row_stride };
+        res.dy = { data + 1, 2, row_stride };
+        res.dz = { data + field_stride, 2, row_stride };
+    } else {
+        const size_t row_stride = size.x + 2;
+        const size_t field_stride = row_stride * size.y;
+        res.dx = { data, 1, row_stride };
+        res.dy = { data + field_stride, 1, row_stride };
+        res.dz = { data + 2 * field_stride, 1, row_stride };
+    }
+    return res;
+}
+
+void surface_geometry::set_displayed_displacement(const host_displacement &displacement)
+{
+    displayed_displacement = displacement;
+    if (heights)
+        heights->update(displacement.time, displacement.dx, displacement.dy, displacement.dz);
+}
+
+void surface_geometry::generate_mipmaps(frame_resources &frame)
+{
+    auto scoped_mipmap_timer =
+        util::scoped_timer(mipmap_timer, timings.mipmap_generation_milliseconds);
+    for (auto &cascade : frame.cascades) {
+        cascade->displacement_map.tex.generate_mipmap();
+        cascade->height_gradient_map.tex.generate_mipmap();
+    }
+}
+
+void surface_geometry::generate_host(math::real time)
+{
+    // Texture upload is accounted as part of the export step.
+    timings.phase_shift_milliseconds = 0;
+    timings.fft_milliseconds = 0;
+    timings.export_milliseconds = 0;
+    for (size_t i = 0; i < host_sims.size(); ++i) {
+        auto &sim = *host_sims[i];
+        spectra[i]->update(time);
+        sim.generate(*spectra[i], time);
 
-    int64_t fft_start_ns = event_fft.getProfilingInfo<CL_PROFILING_COMMAND_START>();
-    int64_t fft_end_ns = event_fft.getProfilingInfo<CL_PROFILING_COMMAND_END>();
-    timings.fft_milliseconds = (fft_end_ns - fft_start_ns) * 1e-6;
+        double upload_milliseconds;
+        {
+            auto scoped_upload_timer = util::scoped_timer(upload_timer, upload_milliseconds);
+            auto &cascade = *frames[0]->cascades[i];
+            cascade.displacement_map.tex.set_data(sim.get_displacement_map().data());
+            cascade.height_gradient_map.tex.set_data(sim.get_normal_map().data());
+        }
 
-    int64_t export_start_ns = event_export.getProfilingInfo<CL_PROFILING_COMMAND_START>();
-    int64_t export_end_ns = event_export.getProfilingInfo<CL_PROFILING_COMMAND_END>();
-    timings.export_milliseconds = (export_end_ns - export_start_ns) * 1e-6;
+        const auto host_timings = sim.get_timing_data();
+        auto &cascade_timings = timings.cascades[i];
+        cascade_timings.phase_shift_milliseconds = host_timings.phase_shift_milliseconds;
+        cascade_timings.fft_milliseconds = host_timings.fft_milliseconds;
+        cascade_timings.export_milliseconds =
+            host_timings.export_milliseconds + upload_milliseconds;
+        timings.phase_shift_milliseconds += cascade_timings.phase_shift_milliseconds;
+        timings.fft_milliseconds += cascade_timings.fft_milliseconds;
+        timings.export_milliseconds += cascade_timings.export_milliseconds;
+    }
+
+    const auto &sim = *host_sims.front();
+    const size_t row_stride = sim.get_field_row_stride();
+    host_displacement displacement;
+    displacement.dx = { sim.get_field(0), 1, row_stride };
+    displacement.dy = { sim.get_field(1), 1, row_stride };
+    displacement.dz = { sim.get_field(2), 1, row_stride };
+    displacement.time = time;
+    set_displayed_displacement(displacement);
+}
+
+void surface_geometry::generate_baked(math::real time)
+{
+    // Baking runs the whole simulation for every frame; the maps are only
+    // blended and uploaded afterwards.
+    auto &wave_spectrum = *spectra.front();
+    if (!loop->is_valid()) {
+        wave_spectrum.finish_transition();
+        loop->bake(wave_spectrum);
+    }
 
+    // Blending and upload are accounted as the export step.
+    double export_milliseconds;
     {
-        auto mipmap_timer = util::scoped_timer(timer, timings.mipmap_generation_milliseconds);
-        displacement_map.tex.generate_mipmap();
-        height_gradient_map.tex.generate_mipmap();
+        auto scoped_export_timer = util::scoped_timer(upload_timer, export_milliseconds);
+        loop->sample(time, staging_displacement_map.data(), staging_normal_map.data());
+        if (heights)
+            heights->update(time, staging_displacement_map.data());
+        auto &cascade = *frames[0]->cascades[0];
+        cascade.displacement_map.tex.set_data(staging_displacement_map.data());
+        cascade.height_gradient_map.tex.set_data(staging_normal_map.data());
     }
+
+    timings.phase_shift_milliseconds = 0;
+    timings.fft_milliseconds = 0;
+    timings.fft_transform_count = 0;
+    timings.export_milliseconds = export_milliseconds;
+    timings.cascades[0] = { 0, 0, export_milliseconds };
+}
+
+void surface_geometry::generate_replay(math::real time)
+{
+    // Decoding and upload are accounted as the export step.
+    double export_milliseconds;
+    {
+        auto scoped_export_timer = util::scoped_timer(upload_timer, export_milliseconds);
+        replay->sample(time, staging_displacement_map.data(), staging_normal_map.data());
+
+        // Float recordings are read in place, the others only through the maps.
+        const int i = replay->find_frame(time);
+        const size_t row_stride = spectra.front()->get_params().fft_size.x;
+        host_displacement displacement;
+        displacement.dx = { replay->get_mapped_plane(i, RECORDING_PLANE_DX), 1, row_stride };
+        displacement.dy = { replay->get_mapped_plane(i, RECORDING_PLANE_DY), 1, row_stride };
+        displacement.dz = { replay->get_mapped_plane(i, RECORDING_PLANE_DZ), 1, row_stride };
+        displacement.time = time;
+        if (displacement.dx.data)
+            set_displayed_displacement(displacement);
+        else if (heights)
+            heights->update(time, staging_displacement_map.data());
+
+        auto &cascade = *frames[0]->cascades[0];
+        cascade.displacement_map.tex.set_data(staging_displacement_map.data());
+        cascade.height_gradient_map.tex.set_data(staging_normal_map.data());
+    }
+
+    timings.phase_shift_milliseconds = 0;
+    timings.fft_milliseconds = 0;
+    timings.fft_transform_count = 0;
+    timings.export_milliseconds = export_milliseconds;
+    timings.cascades[0] = { 0, 0, export_milliseconds };
 }
 
-gpu::compute::event surface_geometry::enqueue_export_kernel(const gpu::compute::event_vector *wait_events)
+gpu::compute::event surface_geometry::enqueue_export_kernel(
+    frame_resources &frame,
+    const gpu::compute::event_vector *wait_events)
 {
     gpu::compute::event event;
-    std::vector<gpu::compute::memory_object> gl_objects = { displacement_map.img,
-                                                            height_gradient_map.img };
+    std::vector<gpu::compute::memory_object> gl_objects;
+    for (const auto &cascade : frame.cascades) {
+        gl_objects.push_back(cascade->displacement_map.img);
+        gl_objects.push_back(cascade->height_gradient_map.img);
+    }
 
     if (!is_gl_event_supported)
         glFinish();
-    queue.enqueueAcquireGLObjects(&gl_objects, wait_events, &event);
+    queue.enqueueAcquireGLObjects(&gl_objects, wait_events, &frame.event_acquire);
     gpu::compute::nd_range offset = { 0, 0 }, local_size = { 1, 1 };
-    auto size = wave_spectrum.get_params().fft_size;
+    auto size = spectra.front()->get_params().fft_size;
     gpu::compute::nd_range global_size = { cl::size_type(size.x), cl::size_type(size.y) };
-    auto event_vector_acquire = gpu::compute::event_vector({ event });
-    queue.enqueueNDRangeKernel(export_kernel, offset, global_size, local_size, &event_vector_acquire, &event);
-    auto event_vector_kernel = gpu::compute::event_vector({ event });
+    auto event_vector_acquire = gpu::compute::event_vector({ frame.event_acquire });
+    gpu::compute::event_vector event_vector_kernel;
+    for (auto &cascade : frame.cascades) {
+        queue.enqueueNDRangeKernel(
+            cascade->export_kernel, offset, global_size, local_size, &event_vector_acquire,
+            &cascade->event_export_kernel);
+        event_vector_kernel.push_back(cascade->event_export_kernel);
+    }
     queue.enqueueReleaseGLObjects(&gl_objects, &event_vector_kernel, &event);
-    if (!is_gl_event_supported)
-        queue.finish();
+    // GL only uses the textures of a frame after its release event completed
+    // (see retire_frames), which is all the synchronization GL needs.
     return event;
 }
 
@@ -0,0 +1,488 @@
+#include <ocean/surface_recording.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include <util/error.h>
+#include <util/log.h>
+#include <util/trace.h>
+
+using math::real;
+
+namespace ocean {
+
+namespace {
+
+using detail::recording_index_entry;
+
+// Identifies a recording and its layout. The magic is written last, see
+// surface_recorder::close.
+struct recording_header {
+    char magic[8];
+    int32_t fft_size[2];
+    int32_t format;
+    int32_t num_frames;
+    float tile_size_physical[3];
+    float tile_size_logical[3];
+    float amplitude;
+    float wavelength_low_threshold;
+    float wind_direction[2];
+    float wind_speed;
+    int32_t model;
+    int32_t spreading;
+    float fetch;
+    float peak_enhancement;
+    float depth;
+    uint64_t frame_stride;
+    uint64_t index_offset;
+};
+
+// Version 2: spectrum models.
+const char header_magic[8] = { 'O', 'C', 'N', 'R', 'E', 'C', '0', '2' };
+
+// The header takes the first page, frames start on page boundaries.
+constexpr size_t page_size = 4096;
+static_assert(sizeof(recording_header) <= page_size, "Header does not fit.");
+
+// Keep in sync with kernels/export_to_texture.cl.
+constexpr float max_displacement = 5.0f;
+
+float get_max_magnitude(int plane) { return plane < RECORDING_PLANE_NX ? max_displacement : 1.0f; }
+
+size_t get_element_size(recording_format format)
+{
+    switch (format) {
+    case RECORDING_FORMAT_FLOAT32:
+        return 4;
+    case RECORDING_FORMAT_FLOAT16:
+        return 2;
+    case RECORDING_FORMAT_UNORM8:
+        return 1;
+    }
+    DIE("Unknown recording format %d.\n", int(format));
+    return 0;
+}
+
+// Round to nearest even, overflowing to infinity.
+uint16_t float_to_half(float f)
+{
+    uint32_t x;
+    std::memcpy(&x, &f, sizeof(x));
+    const uint32_t sign = (x >> 16) & 0x8000;
+    x &= 0x7fffffff;
+    if (x >= 0x47800000) // Infinity or NaN, or too large.
+        return uint16_t(sign | (x > 0x7f800000 ? 0x7e00 : 0x7c00));
+    if (x < 0x38800000) { // Subnormal.
+        float a;
+        std::memcpy(&a, &x, sizeof(a));
+        return uint16_t(sign | uint32_t(std::nearbyint(a * 16777216.0f)));
+    }
+    // Rebias the exponent from 127 to 15 and round away the low 13 bits.
+    x += 0xc8000fff + ((x >> 13) & 1);
+    return uint16_t(sign | (x >> 13));
+}
+
+float half_to_float(uint16_t h)
+{
+    const uint32_t sign = uint32_t(h & 0x8000) << 16;
+    const uint32_t exponent = (h >> 10) & 0x1f, mantissa = h & 0x3ff;
+    if (exponent == 0) {
+        const float a = float(mantissa) / 16777216.0f;
+        return sign ? -a : a;
+    }
+    const uint32_t x = sign | (mantissa << 13) |
+                       (exponent == 0x1f ? 0x7f800000 : (exponent + 112) << 23);
+    float f;
+    std::memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+inline uint32_t unorm8(float x, float max_mag)
+{
+    float v = (x + max_mag) / (2.0f * max_mag);
+    v = std::min(std::max(v, 0.0f), 1.0f);
+    return uint32_t(v * 255.0f + 0.5f);
+}
+
+inline uint32_t pack_rgba8(float x, float y, float z, float max_mag)
+{
+    return unorm8(x, max_mag) | (unorm8(y, max_mag) << 8) | (unorm8(z, max_mag) << 16);
+}
+
+void encode_values(
+    recording_format format,
+    const float *values,
+    size_t count,
+    float max_mag,
+    uint8_t *out)
+{
+    switch (format) {
+    case RECORDING_FORMAT_FLOAT32:
+        std::memcpy(out, values, count * sizeof(float));
+        break;
+    case RECORDING_FORMAT_FLOAT16:
+        for (size_t i = 0; i < count; ++i) {
+            const uint16_t h = float_to_half(values[i]);
+            std::memcpy(out + 2 * i, &h, sizeof(h));
+        }
+        break;
+    case RECORDING_FORMAT_UNORM8:
+        for (size_t i = 0; i < count; ++i)
+            out[i] = uint8_t(unorm8(values[i], max_mag));
+        break;
+    }
+}
+
+void decode_values(
+    recording_format format,
+    const uint8_t *in,
+    size_t count,
+    float max_mag,
+    float *values)
+{
+    switch (format) {
+    case RECORDING_FORMAT_FLOAT32:
+        std::memcpy(values, in, count * sizeof(float));
+        break;
+    case RECORDING_FORMAT_FLOAT16:
+        for (size_t i = 0; i < count; ++i) {
+            uint16_t h;
+            std::memcpy(&h, in + 2 * i, sizeof(h));
+            values[i] = half_to_float(h);
+        }
+        break;
+    case RECORDING_FORMAT_UNORM8:
+        for (size_t i = 0; i < count; ++i)
+            values[i] = (2.0f * float(in[i]) / 255.0f - 1.0f) * max_mag;
+        break;
+    }
+}
+
+} // unnamed namespace
+
+surface_recorder::surface_recorder(
+    const std::string &path,
+    const surface_params &params,
+    recording_format format,
+    int num_buffers)
+    : file(fopen(path.c_str(), "wb"))
+    , path(path)
+    , params(params)
+    , format(format)
+    , last_time(-std::numeric_limits<double>::infinity())
+    , is_failed(false)
+    , num_written(0)
+    , num_dropped(0)
+    , is_finished(false)
+{
+    if (!file)
+        DIE("Cannot open %s for recording.\n", path.c_str());
+
+    const size_t plane_count = size_t(params.fft_size.x) * params.fft_size.y;
+    const size_t frame_size = NUM_RECORDING_PLANES * get_element_size(format) * plane_count;
+    frame_stride = (frame_size + page_size - 1) / page_size * page_size;
+
+    // The header is written on close, reserve its page.
+    frame_data.assign(page_size, 0);
+    write_data(frame_data.data(), page_size);
+    frame_data.assign(frame_stride, 0);
+    normals.resize(3 * plane_count);
+
+    free_frames.resize(std::max(num_buffers, 1));
+    for (auto &frame : free_frames)
+        frame.fields.resize(3 * plane_count);
+    thread = std::thread(&surface_recorder::writer_main, this);
+}
+
+bool surface_recorder::append(
+    real time,
+    const height_field::field_view &dx,
+    const height_field::field_view &dy,
+    const height_field::field_view &dz)
+{
+    if (!file || time <= last_time)
+        return true;
+    last_time = time;
+
+    pending_frame frame;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (free_frames.empty()) {
+            ++num_dropped;
+            return false;
+        }
+        frame = std::move(free_frames.back());
+        free_frames.pop_back();
+    }
+
+    util::trace::scope trace_scope("record surface");
+    const int N = params.fft_size.x, M = params.fft_size.y;
+    const height_field::field_view fields[] = { dx, dy, dz };
+    frame.time = time;
+    float *dst = frame.fields.data();
+    for (const auto &src : fields) {
+        for (int j = 0; j < M; ++j) {
+            const float *src_row = src.data + j * src.row_stride;
+            for (int i = 0; i < N; ++i)
+                *dst++ = src_row[i * src.element_stride];
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queued_frames.push_back(std::move(frame));
+    }
+    queue_changed.notify_all();
+    return true;
+}
+
+void surface_recorder::close()
+{
+    if (!file)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        is_finished = true;
+    }
+    queue_changed.notify_all();
+    thread.join();
+
+    // Memset first, so that the padding is written as zeros.
+    recording_header header;
+    std::memset(&header, 0, sizeof(header));
+    header.fft_size[0] = params.fft_size.x;
+    header.fft_size[1] = params.fft_size.y;
+    header.format = format;
+    header.num_frames = int32_t(index.size());
+    for (int c = 0; c < 3; ++c) {
+        header.tile_size_physical[c] = params.tile_size_physical[c];
+        header.tile_size_logical[c] = params.tile_size_logical[c];
+    }
+    header.amplitude = params.amplitude;
+    header.wavelength_low_threshold = params.wavelength_low_threshold;
+    header.wind_direction[0] = params.wind_direction.x;
+    header.wind_direction[1] = params.wind_direction.y;
+    header.wind_speed = params.wind_speed;
+    header.model = params.model;
+    header.spreading = params.spreading;
+    header.fetch = params.fetch;
+    header.peak_enhancement = params.peak_enhancement;
+    header.depth = params.depth;
+    header.frame_stride = frame_stride;
+    header.index_offset = page_size + index.size() * frame_stride;
+
+    // The index follows the last frame.
+    write_data(index.data(), index.size() * sizeof(recording_index_entry));
+    if (fflush(file) != 0)
+        is_failed = true;
+    if (!is_failed && fseek(file, 0, SEEK_SET) == 0) {
+        std::memcpy(header.magic, header_magic, sizeof(header_magic));
+        write_data(&header, sizeof(header));
+    }
+    if (fclose(file) != 0)
+        is_failed = true;
+    file = nullptr;
+
+    if (is_failed)
+        LOG("Recording %s is incomplete.\n", path.c_str());
+    else
+        LOG("Recorded %d frames to %s, dropped %d.\n", int(num_written), path.c_str(),
+            int(num_dropped));
+}
+
+void surface_recorder::writer_main()
+{
+    for (;;) {
+        pending_frame frame;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            queue_changed.wait(lock, [this] { return is_finished || !queued_frames.empty(); });
+            if (queued_frames.empty())
+                return;
+            frame = std::move(queued_frames.front());
+            queued_frames.pop_front();
+        }
+        write_frame(frame);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            free_frames.push_back(std::move(frame));
+        }
+    }
+}
+
+void surface_recorder::write_frame(const pending_frame &frame)
+{
+    if (is_failed)
+        return;
+
+    // Central differences of the displaced grid, in meters, like
+    // height_field::update_normals.
+    const int N = params.fft_size.x, M = params.fft_size.y;
+    const size_t plane_count = size_t(N) * M;
+    const math::vec2 cell_size =
+        math::vec2(params.tile_size_physical.x, params.tile_size_physical.z) /
+        math::vec2(params.fft_size);
+    const float *dx = frame.fields.data();
+    const float *dy = dx + plane_count;
+    const float *dz = dy + plane_count;
+    float *nx = normals.data();
+    float *ny = nx + plane_count;
+    float *nz = ny + plane_count;
+    for (int j = 0; j < M; ++j) {
+        const size_t row = size_t(j) * N;
+        const size_t row_prev = size_t(j == 0 ? M - 1 : j - 1) * N;
+        const size_t row_next = size_t(j == M - 1 ? 0 : j + 1) * N;
+        for (int i = 0; i < N; ++i) {
+            const int i_prev = i == 0 ? N - 1 : i - 1;
+            const int i_next = i == N - 1 ? 0 : i + 1;
+            const math::vec3 du(
+                2 * cell_size.x + dx[row + i_next] - dx[row + i_prev],
+                dy[row + i_next] - dy[row + i_prev],
+                dz[row + i_next] - dz[row + i_prev]);
+            const math::vec3 dv(
+                dx[row_next + i] - dx[row_prev + i],
+                dy[row_next + i] - dy[row_prev + i],
+                2 * cell_size.y + dz[row_next + i] - dz[row_prev + i]);
+            const math::vec3 n = math::normalize(math::cross(dv, du));
+            nx[row + i] = n.x;
+            ny[row + i] = n.y;
+            nz[row + i] = n.z;
+        }
+    }
+
+    const size_t plane_size = get_element_size(format) * plane_count;
+    for (int p = 0; p < NUM_RECORDING_PLANES; ++p) {
+        const float *values = p < RECORDING_PLANE_NX ? frame.fields.data() + p * plane_count
+                                                      : nx + (p - RECORDING_PLANE_NX) * plane_count;
+        encode_values(format, values, plane_count, get_max_magnitude(p),
+                      frame_data.data() + p * plane_size);
+    }
+
+    recording_index_entry entry;
+    entry.time = frame.time;
+    entry.offset = page_size + index.size() * frame_stride;
+    write_data(frame_data.data(), frame_stride);
+    if (is_failed)
+        return;
+    index.push_back(entry);
+    ++num_written;
+}
+
+void surface_recorder::write_data(const void *data, size_t size)
+{
+    if (is_failed)
+        return;
+    if (fwrite(data, 1, size, file) != size) {
+        LOG("Cannot write to %s, recording stopped.\n", path.c_str());
+        is_failed = true;
+    }
+}
+
+surface_replay::surface_replay(util::thread_pool &pool, const std::string &path) : pool(pool)
+{
+    file = util::mapped_file(path);
+    const size_t file_size = file.size();
+    if (file_size < page_size)
+        DIE("%s is not a surface recording.\n", path.c_str());
+
+    recording_header header;
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.magic, header_magic, sizeof(header_magic)) != 0)
+        DIE("%s is not a complete surface recording.\n", path.c_str());
+
+    params = surface_params();
+    params.fft_size = math::ivec2(header.fft_size[0], header.fft_size[1]);
+    for (int c = 0; c < 3; ++c) {
+        params.tile_size_physical[c] = header.tile_size_physical[c];
+        params.tile_size_logical[c] = header.tile_size_logical[c];
+    }
+    params.amplitude = header.amplitude;
+    params.wavelength_low_threshold = header.wavelength_low_threshold;
+    params.num_cascades = 1;
+    params.cascade_scale = 1;
+    params.wind_direction = math::vec2(header.wind_direction[0], header.wind_direction[1]);
+    params.wind_speed = header.wind_speed;
+    params.model = spectrum_model(header.model);
+    params.spreading = directional_spreading(header.spreading);
+    params.fetch = header.fetch;
+    params.peak_enhancement = header.peak_enhancement;
+    params.depth = header.depth;
+    params.backend = SIMULATION_BACKEND_HOST;
+    params.pipeline_depth = 1;
+
+    format = recording_format(header.format);
+    plane_size = get_element_size(format) * params.fft_size.x * params.fft_size.y;
+    const size_t index_size = header.num_frames * sizeof(recording_index_entry);
+    if (header.num_frames < 1 || header.index_offset + index_size > file_size)
+        DIE("%s is truncated.\n", path.c_str());
+    index.resize(header.num_frames);
+    std::memcpy(
+        index.data(), static_cast<const char *>(file.data()) + header.index_offset, index_size);
+    for (const auto &entry : index)
+        if (entry.offset + NUM_RECORDING_PLANES * plane_size > header.index_offset)
+            DIE("%s is truncated.\n", path.c_str());
+}
+
+int surface_replay::find_frame(real time) const
+{
+    const int n = get_num_frames();
+    if (n == 1)
+        return 0;
+
+    // The recording starts over one mean frame interval after its last frame.
+    const double first = index.front().time;
+    const double duration = (index.back().time - first) * n / (n - 1);
+    double t = std::fmod(double(time) - first, duration);
+    if (t < 0)
+        t += duration;
+    t += first;
+    auto it = std::upper_bound(
+        index.begin(), index.end(), t,
+        [](double t, const recording_index_entry &entry) { return t < entry.time; });
+    return std::max(int(it - index.begin()) - 1, 0);
+}
+
+const uint8_t *surface_replay::get_plane(int i, recording_plane p) const
+{
+    return static_cast<const uint8_t *>(file.data()) + index[i].offset + p * plane_size;
+}
+
+void surface_replay::read_plane(int i, recording_plane p, float *values) const
+{
+    const size_t count = size_t(params.fft_size.x) * params.fft_size.y;
+    decode_values(format, get_plane(i, p), count, get_max_magnitude(p), values);
+}
+
+const float *surface_replay::get_mapped_plane(int i, recording_plane p) const
+{
+    if (format != RECORDING_FORMAT_FLOAT32)
+        return nullptr;
+    return reinterpret_cast<const float *>(get_plane(i, p));
+}
+
+void surface_replay::sample(real time, texel *displacement_map, texel *normal_map) const
+{
+    const int frame = find_frame(time);
+    const int N = params.fft_size.x;
+    const size_t element_size = get_element_size(format);
+
+    pool.parallel_for(params.fft_size.y, [&](int begin, int end) {
+        std::vector<float> values(NUM_RECORDING_PLANES * N);
+        for (int j = begin; j < end; ++j) {
+            const size_t row = size_t(j) * N;
+            for (int p = 0; p < NUM_RECORDING_PLANES; ++p)
+                decode_values(format, get_plane(frame, recording_plane(p)) + row * element_size,
+                              N, get_max_magnitude(p), values.data() + p * N);
+            const float *v = values.data();
+            for (int i = 0; i < N; ++i) {
+                displacement_map[row + i] =
+                    pack_rgba8(v[i], v[N + i], v[2 * N + i], max_displacement);
+                normal_map[row + i] = pack_rgba8(v[3 * N + i], v[4 * N + i], v[5 * N + i], 1.0f);
+            }
+        }
+    }, 16);
+}
+
+} // namespace ocean
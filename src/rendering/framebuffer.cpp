@@ -50,11 +50,11 @@ void multisample_framebuffer::resize(int new_width, int new_height)
 
 void multisample_framebuffer::activate() { glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo); }
 
-void multisample_framebuffer::resolve_to_backbuffer()
+void multisample_framebuffer::resolve_to(gpu::graphics::framebuffer target)
 {
-    // Blit from framebuffer to backbuffer.
+    // Blit from framebuffer to target.
     glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
-    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target);
     glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
 }
 
@@ -0,0 +1,64 @@
+#include <rendering/pixel_readback.h>
+
+#include <algorithm>
+#include <util/error.h>
+
+namespace rendering {
+
+pixel_readback::pixel_readback(int width, int height, int num_buffers)
+    : width(width)
+    , height(height)
+    , buffers(std::max(num_buffers, 1))
+    , next_buffer(0)
+    , num_pending(0)
+{
+    glGenBuffers(GLsizei(buffers.size()), buffers.data());
+    for (auto buffer : buffers) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, get_frame_size(), nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    GL_CHECK();
+}
+
+pixel_readback::~pixel_readback() { glDeleteBuffers(GLsizei(buffers.size()), buffers.data()); }
+
+void pixel_readback::read(const consumer &consume)
+{
+    if (num_pending == int(buffers.size()))
+        complete_oldest(consume);
+
+    // With a pack buffer bound this only enqueues the copy.
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[next_buffer]);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    GL_CHECK();
+
+    next_buffer = (next_buffer + 1) % int(buffers.size());
+    ++num_pending;
+}
+
+void pixel_readback::flush(const consumer &consume)
+{
+    while (num_pending > 0)
+        complete_oldest(consume);
+}
+
+void pixel_readback::complete_oldest(const consumer &consume)
+{
+    const int n = int(buffers.size());
+    const int oldest = (next_buffer - num_pending + n) % n;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[oldest]);
+    auto pixels = static_cast<const uint8_t *>(
+        glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, get_frame_size(), GL_MAP_READ_BIT));
+    if (!pixels)
+        DIE("Cannot map pixel buffer.\n");
+    consume(pixels);
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    --num_pending;
+}
+
+} // namespace rendering
@@ -20,6 +20,7 @@ std::map<texture_2d::texture_format, texture_format_traits> format_traits =
 } // unnamed namespace
 
 texture_2d::texture_2d(const util::extent &extent, texture_format format, const void *data)
+    : extent(extent), format(format)
 {
     glGenTextures(1, &tex);
     glActiveTexture(GL_TEXTURE5);
@@ -32,4 +33,13 @@ texture_2d::texture_2d(const util::extent &extent, texture_format format, const
     glActiveTexture(GL_TEXTURE0);
 }
 
+void texture_2d::set_data(const void *data)
+{
+    auto traits = format_traits[format];
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTextureSubImage2D(
+        tex, 0, 0, 0, GLsizei(extent.width), GLsizei(extent.height), traits.format, traits.type, data);
+    GL_CHECK();
+}
+
 } // namespace rendering
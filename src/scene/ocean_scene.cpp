@@ -1,6 +1,8 @@
-#include <chrono>
 #include <scene/ocean_scene.h>
+#include <imgui.h>
+#include <string>
 #include <util/log.h>
+#include <util/trace.h>
 
 using namespace rendering::shader_type;
 
@@ -8,9 +10,10 @@ namespace scene {
 
 namespace {
 
+// The ocean maps take a unit per cascade, from these on.
 constexpr gpu::graphics::texture_unit ocean_displacement_tex_unit = 0;
-constexpr gpu::graphics::texture_unit ocean_height_deriv_tex_unit = 1;
-constexpr gpu::graphics::texture_unit sky_cubemap_tex_unit = 2;
+constexpr gpu::graphics::texture_unit ocean_height_deriv_tex_unit = ocean::max_cascades;
+constexpr gpu::graphics::texture_unit sky_cubemap_tex_unit = 2 * ocean::max_cascades;
 
 } // unnamed namespace
 
@@ -18,23 +21,34 @@ ocean_scene::ocean_scene(
     gpu::compute::command_queue queue,
     const ocean::surface_params &surface_params,
     const rendering::rendering_params &rendering_params)
-    : rendering_params(rendering_params), ocean_surface(queue, surface_params)
+    : rendering_params(rendering_params)
+    , ocean_surface(queue, surface_params)
+    , render_timer("render scene")
+    , ocean_drawcall_timer("draw ocean")
 {
     main_camera.set_look_at(math::vec3(0, 1, 0));
     main_camera.set_position(math::vec3(0, 14, 30));
 
     // Ocean
     ocean_surface.set_texture_max_anisotropy(rendering_params.texture_max_anisotropy);
-    ocean_surface.bind_displacement_texture(ocean_displacement_tex_unit);
-    ocean_surface.bind_height_gradient_texture(ocean_height_deriv_tex_unit);
 
     ocean_effect.load_shaders("shaders/ocean.glsl", VERTEX | GEOMETRY | FRAGMENT);
     ocean_effect.use();
     ocean_effect.set_parameter(
         "units_per_meter", surface_params.tile_size_logical / surface_params.tile_size_physical);
     ocean_effect.set_parameter("tile_size_logical", surface_params.tile_size_logical);
-    ocean_effect.set_parameter("displacement_tex", ocean_displacement_tex_unit);
-    ocean_effect.set_parameter("normal_tex", ocean_height_deriv_tex_unit);
+    ocean_effect.set_parameter("num_cascades", GLint(ocean_surface.get_num_cascades()));
+    for (int i = 0; i < ocean_surface.get_num_cascades(); ++i) {
+        const std::string index = "[" + std::to_string(i) + "]";
+        ocean_effect.set_parameter(
+            ("cascade_ratio" + index).c_str(), GLfloat(ocean_surface.get_cascade_ratio(i)));
+        ocean_effect.set_parameter(
+            ("displacement_tex" + index).c_str(),
+            gpu::graphics::texture_unit(ocean_displacement_tex_unit + i));
+        ocean_effect.set_parameter(
+            ("normal_tex" + index).c_str(),
+            gpu::graphics::texture_unit(ocean_height_deriv_tex_unit + i));
+    }
     ocean_effect.set_parameter("sky_env", sky_cubemap_tex_unit);
 
     // Sky
@@ -59,14 +73,16 @@ ocean_scene::ocean_scene(
     }
 }
 
-void ocean_scene::render()
+void ocean_scene::render(math::real time)
 {
+    util::trace::scope trace_scope("ocean scene");
+
     // Gui
     {
         ImGui::Begin("ocean params");
 
-        ImGui::SliderFloat("amplitude", &gui_state.amplitude, 0, 5);
-        ocean_surface.set_wave_amplitude(gui_state.amplitude);
+        if (ImGui::SliderFloat("amplitude", &gui_state.amplitude, 0, 5))
+            ocean_surface.set_wave_amplitude(gui_state.amplitude);
 
         const bool wind_changed = ImGui::SliderFloat("wind speed", &gui_state.wind_speed, 0, 20);
         if (wind_changed) {
@@ -78,16 +94,16 @@ void ocean_scene::render()
     }
 
     // Scene
-    static auto start_time = std::chrono::steady_clock::now();
-    auto current_time = std::chrono::steady_clock::now();
-    float time =
-        0.001f *
-        std::chrono::duration_cast<std::chrono::milliseconds>(current_time - start_time).count();
-
     ocean_surface.enqueue_generate(time);
+    for (int i = 0; i < ocean_surface.get_num_cascades(); ++i) {
+        ocean_surface.bind_displacement_texture(
+            i, gpu::graphics::texture_unit(ocean_displacement_tex_unit + i));
+        ocean_surface.bind_height_gradient_texture(
+            i, gpu::graphics::texture_unit(ocean_height_deriv_tex_unit + i));
+    }
     timings.surface_geometry_timing_data = ocean_surface.get_timing_data();
 
-    timer.start();
+    render_timer.start();
 
     glDepthMask(GL_TRUE);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -118,10 +134,11 @@ void ocean_scene::render()
     ocean_effect.set_parameter("grid_dim", grid_dim);
     ocean_effect.set_parameter("proj_view_world_transform", proj_view_world);
 
-    double render_except_ocean_drawcall = timer.stop_and_get_milliseconds();
+    double render_except_ocean_drawcall = render_timer.stop_and_get_milliseconds();
 
     {
-        auto ocean_timer = util::scoped_timer(timer, timings.ocean_drawcall_milliseconds);
+        auto ocean_timer =
+            util::scoped_timer(ocean_drawcall_timer, timings.ocean_drawcall_milliseconds);
         unit_quad.draw_instanced(grid_dim.x * grid_dim.y);
     }
 
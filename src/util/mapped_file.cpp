@@ -0,0 +1,235 @@
+#include <util/mapped_file.h>
+
+#include <cstdint>
+#include <util/error.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace util {
+
+#ifdef _WIN32
+
+mapped_file::mapped_file()
+    : mapping(nullptr)
+    , mapping_size(0)
+    , reused(false)
+    , read_only(false)
+    , file_handle(INVALID_HANDLE_VALUE)
+    , mapping_handle(nullptr)
+{
+}
+
+mapped_file::mapped_file(const std::string &path, size_t size) : mapped_file()
+{
+    file_handle = CreateFileA(
+        path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file_handle == INVALID_HANDLE_VALUE)
+        DIE("Cannot open %s for mapping.\n", path.c_str());
+
+    LARGE_INTEGER file_size;
+    reused = GetFileSizeEx(file_handle, &file_size) && uint64_t(file_size.QuadPart) == size;
+
+    // CreateFileMapping grows the file if needed; shrinking goes through SetEndOfFile.
+    LARGE_INTEGER new_size;
+    new_size.QuadPart = LONGLONG(size);
+    if (!reused &&
+        !(SetFilePointerEx(file_handle, new_size, nullptr, FILE_BEGIN) && SetEndOfFile(file_handle)))
+        DIE("Cannot resize %s to %zu bytes.\n", path.c_str(), size);
+
+    mapping_handle = CreateFileMappingA(
+        file_handle, nullptr, PAGE_READWRITE, DWORD(uint64_t(size) >> 32), DWORD(size), nullptr);
+    if (!mapping_handle)
+        DIE("Cannot map %s.\n", path.c_str());
+    mapping = MapViewOfFile(mapping_handle, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (!mapping)
+        DIE("Cannot map %s.\n", path.c_str());
+    mapping_size = size;
+}
+
+mapped_file::mapped_file(const std::string &path) : mapped_file()
+{
+    read_only = true;
+    file_handle = CreateFileA(
+        path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+        nullptr);
+    if (file_handle == INVALID_HANDLE_VALUE)
+        DIE("Cannot open %s for mapping.\n", path.c_str());
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file_handle, &file_size))
+        DIE("Cannot get the size of %s.\n", path.c_str());
+    const size_t size = size_t(file_size.QuadPart);
+    if (size == 0)
+        return;
+
+    mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping_handle)
+        DIE("Cannot map %s.\n", path.c_str());
+    mapping = MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, size);
+    if (!mapping)
+        DIE("Cannot map %s.\n", path.c_str());
+    mapping_size = size;
+}
+
+mapped_file::mapped_file(mapped_file &&other)
+    : mapping(other.mapping)
+    , mapping_size(other.mapping_size)
+    , reused(other.reused)
+    , read_only(other.read_only)
+    , file_handle(other.file_handle)
+    , mapping_handle(other.mapping_handle)
+{
+    other.mapping = nullptr;
+    other.mapping_size = 0;
+    other.file_handle = INVALID_HANDLE_VALUE;
+    other.mapping_handle = nullptr;
+}
+
+mapped_file &mapped_file::operator=(mapped_file &&other)
+{
+    if (this != &other) {
+        close();
+        mapping = other.mapping;
+        mapping_size = other.mapping_size;
+        reused = other.reused;
+        read_only = other.read_only;
+        file_handle = other.file_handle;
+        mapping_handle = other.mapping_handle;
+        other.mapping = nullptr;
+        other.mapping_size = 0;
+        other.file_handle = INVALID_HANDLE_VALUE;
+        other.mapping_handle = nullptr;
+    }
+    return *this;
+}
+
+void mapped_file::flush()
+{
+    if (mapping && !read_only)
+        FlushViewOfFile(mapping, mapping_size);
+}
+
+void mapped_file::close()
+{
+    if (mapping)
+        UnmapViewOfFile(mapping);
+    if (mapping_handle)
+        CloseHandle(mapping_handle);
+    if (file_handle != INVALID_HANDLE_VALUE)
+        CloseHandle(file_handle);
+    mapping = nullptr;
+    mapping_size = 0;
+    mapping_handle = nullptr;
+    file_handle = INVALID_HANDLE_VALUE;
+    read_only = false;
+}
+
+#else
+
+mapped_file::mapped_file()
+    : mapping(nullptr), mapping_size(0), reused(false), read_only(false), fd(-1)
+{
+}
+
+mapped_file::mapped_file(const std::string &path, size_t size) : mapped_file()
+{
+    fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        DIE("Cannot open %s for mapping.\n", path.c_str());
+
+    struct stat st;
+    reused = fstat(fd, &st) == 0 && size_t(st.st_size) == size;
+    if (!reused && ftruncate(fd, off_t(size)) != 0)
+        DIE("Cannot resize %s to %zu bytes.\n", path.c_str(), size);
+
+    mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        mapping = nullptr;
+        DIE("Cannot map %s.\n", path.c_str());
+    }
+    mapping_size = size;
+}
+
+mapped_file::mapped_file(const std::string &path) : mapped_file()
+{
+    read_only = true;
+    fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        DIE("Cannot open %s for mapping.\n", path.c_str());
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        DIE("Cannot get the size of %s.\n", path.c_str());
+    const size_t size = size_t(st.st_size);
+    if (size == 0)
+        return;
+
+    mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        mapping = nullptr;
+        DIE("Cannot map %s.\n", path.c_str());
+    }
+    mapping_size = size;
+}
+
+mapped_file::mapped_file(mapped_file &&other)
+    : mapping(other.mapping)
+    , mapping_size(other.mapping_size)
+    , reused(other.reused)
+    , read_only(other.read_only)
+    , fd(other.fd)
+{
+    other.mapping = nullptr;
+    other.mapping_size = 0;
+    other.fd = -1;
+}
+
+mapped_file &mapped_file::operator=(mapped_file &&other)
+{
+    if (this != &other) {
+        close();
+        mapping = other.mapping;
+        mapping_size = other.mapping_size;
+        reused = other.reused;
+        read_only = other.read_only;
+        fd = other.fd;
+        other.mapping = nullptr;
+        other.mapping_size = 0;
+        other.fd = -1;
+    }
+    return *this;
+}
+
+void mapped_file::flush()
+{
+    if (mapping && !read_only)
+        msync(mapping, mapping_size, MS_SYNC);
+}
+
+void mapped_file::close()
+{
+    if (mapping)
+        munmap(mapping, mapping_size);
+    if (fd >= 0)
+        ::close(fd);
+    mapping = nullptr;
+    mapping_size = 0;
+    fd = -1;
+    read_only = false;
+}
+
+#endif
+
+mapped_file::~mapped_file() { close(); }
+
+} // namespace util
@@ -0,0 +1,121 @@
+#include <util/statistics.h>
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace util {
+
+namespace {
+
+// Nearest-rank percentile of sorted values.
+double get_sorted_percentile(const std::vector<double> &sorted, double percentile)
+{
+    int rank = int(std::ceil(percentile / 100 * sorted.size()));
+    return sorted[std::min(std::max(rank - 1, 0), int(sorted.size()) - 1)];
+}
+
+} // unnamed namespace
+
+log_histogram::log_histogram(double min_value, int num_octaves, int sub_buckets)
+    : min_value(min_value)
+    , num_octaves(num_octaves)
+    , sub_buckets(sub_buckets)
+    , counts(num_octaves * sub_buckets + 2, 0)
+    , total_count(0)
+{
+}
+
+void log_histogram::add(double value)
+{
+    int bucket;
+    if (!(value >= min_value)) {
+        bucket = 0;
+    } else {
+        int octave = int(std::floor(std::log2(value / min_value)));
+        if (octave >= num_octaves) {
+            bucket = get_num_buckets() - 1;
+        } else {
+            double octave_begin = std::ldexp(min_value, octave);
+            int sub_bucket = int((value / octave_begin - 1) * sub_buckets);
+            sub_bucket = std::min(std::max(sub_bucket, 0), sub_buckets - 1);
+            bucket = 1 + octave * sub_buckets + sub_bucket;
+        }
+    }
+    ++counts[bucket];
+    ++total_count;
+}
+
+void log_histogram::clear()
+{
+    std::fill(counts.begin(), counts.end(), 0);
+    total_count = 0;
+}
+
+double log_histogram::get_bucket_upper_bound(int bucket) const
+{
+    if (bucket == 0)
+        return min_value;
+    if (bucket == get_num_buckets() - 1)
+        return HUGE_VAL;
+    int octave = (bucket - 1) / sub_buckets;
+    int sub_bucket = (bucket - 1) % sub_buckets;
+    return std::ldexp(min_value, octave) * (1 + double(sub_bucket + 1) / sub_buckets);
+}
+
+double log_histogram::get_percentile(double percentile) const
+{
+    if (total_count == 0)
+        return 0;
+    auto rank = uint64_t(std::ceil(percentile / 100 * total_count));
+    uint64_t sum = 0;
+    for (int bucket = 0; bucket < get_num_buckets(); ++bucket) {
+        sum += counts[bucket];
+        if (sum >= rank && sum > 0)
+            return get_bucket_upper_bound(bucket);
+    }
+    return get_bucket_upper_bound(get_num_buckets() - 1);
+}
+
+rolling_statistics::rolling_statistics(int window_size)
+    : window_size(std::max(window_size, 1)), next_sample(0)
+{
+    window.reserve(this->window_size);
+}
+
+void rolling_statistics::add(double value)
+{
+    if (int(window.size()) < window_size)
+        window.push_back(value);
+    else
+        window[next_sample] = value;
+    next_sample = (next_sample + 1) % window_size;
+    histogram.add(value);
+}
+
+void rolling_statistics::clear()
+{
+    window.clear();
+    next_sample = 0;
+    histogram.clear();
+}
+
+rolling_statistics::summary rolling_statistics::get_summary() const
+{
+    summary res = {};
+    res.count = int(window.size());
+    if (window.empty())
+        return res;
+
+    auto sorted = window;
+    std::sort(sorted.begin(), sorted.end());
+    res.min = sorted.front();
+    res.max = sorted.back();
+    res.mean = std::accumulate(sorted.begin(), sorted.end(), 0.0) / sorted.size();
+    res.p50 = get_sorted_percentile(sorted, 50);
+    res.p95 = get_sorted_percentile(sorted, 95);
+    res.p99 = get_sorted_percentile(sorted, 99);
+    return res;
+}
+
+} // namespace util
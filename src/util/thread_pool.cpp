@@ -0,0 +1,107 @@
+#include <util/thread_pool.h>
+
+#include <algorithm>
+#include <util/trace.h>
+
+namespace util {
+
+namespace {
+// Set while the thread runs chunks of a job, on the workers and on the caller
+// alike, so nested calls never touch submit_mutex again.
+thread_local bool is_in_job = false;
+} // unnamed namespace
+
+thread_pool::thread_pool(unsigned num_threads)
+    : generation(0), pending_workers(0), stopping(false), job_fn(nullptr), job_count(0), job_chunk(1)
+{
+    if (num_threads == 0)
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned i = 1; i < num_threads; ++i)
+        workers.emplace_back(&thread_pool::worker_main, this);
+}
+
+thread_pool::~thread_pool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    work_available.notify_all();
+    for (auto &worker : workers)
+        worker.join();
+}
+
+void thread_pool::parallel_for(int count, const range_function &fn, int grain)
+{
+    if (count <= 0)
+        return;
+    grain = std::max(grain, 1);
+
+    std::unique_lock<std::mutex> submit_lock(submit_mutex, std::defer_lock);
+    if (workers.empty() || is_in_job || count <= grain || !submit_lock.try_lock()) {
+        fn(0, count);
+        return;
+    }
+
+    // Hand out a few chunks per thread so uneven ranges still balance.
+    int chunks_per_thread = 4;
+    int chunk = std::max(grain, count / int(get_num_threads() * chunks_per_thread));
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job_fn = &fn;
+        job_count = count;
+        job_chunk = chunk;
+        next_index = 0;
+        pending_workers = unsigned(workers.size());
+        ++generation;
+    }
+    work_available.notify_all();
+
+    is_in_job = true;
+    run_chunks();
+    is_in_job = false;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    work_done.wait(lock, [this] { return pending_workers == 0; });
+    job_fn = nullptr;
+}
+
+void thread_pool::worker_main()
+{
+    is_in_job = true;
+    unsigned seen_generation = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            work_available.wait(lock, [&] { return stopping || generation != seen_generation; });
+            if (stopping)
+                return;
+            seen_generation = generation;
+        }
+
+        run_chunks();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--pending_workers == 0)
+            work_done.notify_one();
+    }
+}
+
+void thread_pool::run_chunks()
+{
+    trace::scope trace_scope("parallel_for");
+    for (;;) {
+        int begin = next_index.fetch_add(job_chunk);
+        if (begin >= job_count)
+            break;
+        (*job_fn)(begin, std::min(begin + job_chunk, job_count));
+    }
+}
+
+thread_pool &default_thread_pool()
+{
+    static thread_pool pool;
+    return pool;
+}
+
+} // namespace util
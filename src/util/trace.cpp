@@ -0,0 +1,147 @@
+#include <util/trace.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace util {
+namespace trace {
+
+namespace {
+
+struct event {
+    const char *name;
+    int64_t begin_ns;
+    int64_t end_ns;
+    track event_track;
+};
+
+// Written only by its thread; write_json reads up to the published count.
+struct thread_buffer {
+    enum { capacity = 1 << 16 };
+
+    explicit thread_buffer(int thread_id)
+        : thread_id(thread_id), events(new event[capacity]), count(0)
+    {
+    }
+
+    int thread_id;
+    std::unique_ptr<event[]> events;
+    std::atomic<uint64_t> count;
+};
+
+// Thread ids of the queue tracks, after those of the threads.
+const int compute_queue_thread_id = 1000;
+const int graphics_queue_thread_id = 1001;
+
+std::atomic<bool> enabled(false);
+
+// Buffers outlive their threads so that their events can still be written.
+std::mutex buffers_mutex;
+std::vector<std::unique_ptr<thread_buffer>> buffers;
+
+thread_local thread_buffer *local_buffer = nullptr;
+
+thread_buffer &get_local_buffer()
+{
+    if (!local_buffer) {
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+        buffers.emplace_back(new thread_buffer(int(buffers.size()) + 1));
+        local_buffer = buffers.back().get();
+    }
+    return *local_buffer;
+}
+
+int get_thread_id(const thread_buffer &buffer, track event_track)
+{
+    switch (event_track) {
+    case TRACK_COMPUTE_QUEUE:
+        return compute_queue_thread_id;
+    case TRACK_GRAPHICS_QUEUE:
+        return graphics_queue_thread_id;
+    default:
+        return buffer.thread_id;
+    }
+}
+
+void write_thread_name(FILE *file, int thread_id, const char *name, int index)
+{
+    fprintf(file,
+        "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+        "\"args\":{\"name\":\"%s",
+        thread_id, name);
+    if (index >= 0)
+        fprintf(file, " %d", index);
+    fprintf(file, "\"}},\n");
+}
+
+} // unnamed namespace
+
+int64_t now()
+{
+    auto since_epoch = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(since_epoch).count();
+}
+
+void set_enabled(bool is_enabled) { enabled = is_enabled; }
+
+bool is_enabled() { return enabled.load(std::memory_order_relaxed); }
+
+void record(const char *name, int64_t begin_ns, int64_t end_ns, track event_track)
+{
+    if (!is_enabled())
+        return;
+    auto &buffer = get_local_buffer();
+    uint64_t index = buffer.count.load(std::memory_order_relaxed);
+    buffer.events[index % thread_buffer::capacity] = { name, begin_ns, end_ns, event_track };
+    buffer.count.store(index + 1, std::memory_order_release);
+}
+
+bool write_json(const std::string &file_name)
+{
+    FILE *file = fopen(file_name.c_str(), "w");
+    if (!file)
+        return false;
+
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+
+    // Timestamps are written relative to the first event, in microseconds.
+    int64_t origin_ns = INT64_MAX;
+    for (auto &buffer : buffers) {
+        uint64_t count = buffer->count.load(std::memory_order_acquire);
+        uint64_t first = count > thread_buffer::capacity ? count - thread_buffer::capacity : 0;
+        for (uint64_t i = first; i < count; ++i)
+            origin_ns = std::min(origin_ns, buffer->events[i % thread_buffer::capacity].begin_ns);
+    }
+
+    fprintf(file, "{\"traceEvents\":[\n");
+    write_thread_name(file, compute_queue_thread_id, "OpenCL queue", -1);
+    write_thread_name(file, graphics_queue_thread_id, "GL queue", -1);
+    for (auto &buffer : buffers) {
+        write_thread_name(file, buffer->thread_id, "thread", buffer->thread_id);
+
+        uint64_t count = buffer->count.load(std::memory_order_acquire);
+        uint64_t first = count > thread_buffer::capacity ? count - thread_buffer::capacity : 0;
+        for (uint64_t i = first; i < count; ++i) {
+            const auto &e = buffer->events[i % thread_buffer::capacity];
+            fprintf(file,
+                "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f},\n",
+                e.name, get_thread_id(*buffer, e.event_track), (e.begin_ns - origin_ns) * 1e-3,
+                (e.end_ns - e.begin_ns) * 1e-3);
+        }
+    }
+    // Closes the list, which must not end in a comma.
+    fprintf(
+        file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+              "\"args\":{\"name\":\"ocean demo\"}}\n");
+    fprintf(file, "]}\n");
+
+    return fclose(file) == 0;
+}
+
+} // namespace trace
+} // namespace util
@@ -1,8 +1,17 @@
+#include <cerrno>
+#include <cstdlib>
 #include <fstream>
 #include <sstream>
 #include <util/error.h>
+#include <util/log.h>
 #include <util/util.h>
 
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
 namespace util {
 
 std::string read_file_contents(const std::string &filename)
@@ -19,4 +28,37 @@ std::string read_file_contents(const std::string &filename)
     return "";
 }
 
+bool make_directory(const std::string &path)
+{
+#ifdef _WIN32
+    int res = _mkdir(path.c_str());
+#else
+    int res = mkdir(path.c_str(), 0755);
+#endif
+    if (res != 0 && errno != EEXIST) {
+        LOG("Cannot create directory %s.\n", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+std::string get_cache_directory(const std::string &name)
+{
+    const char *base = getenv("OCEAN_CACHE_DIR");
+    std::string path = (base && *base) ? base : "cache";
+    make_directory(path);
+    path += "/" + name;
+    make_directory(path);
+    return path;
+}
+
+void set_environment_variable(const std::string &name, const std::string &value)
+{
+#ifdef _WIN32
+    _putenv_s(name.c_str(), value.c_str());
+#else
+    setenv(name.c_str(), value.c_str(), 1);
+#endif
+}
+
 } // namespace util
@@ -0,0 +1,1344 @@
+#include <api/cpu/fft.h>
+#include <api/gpu/compute.h>
+#include <api/gpu/fft.h>
+#include <api/math.h>
+#include <ocean/height_field.h>
+#include <ocean/host_phase_shift.h>
+#include <ocean/host_simulation.h>
+#include <ocean/spectrum.h>
+#include <ocean/surface_recording.h>
+#include <util/statistics.h>
+#include <util/thread_pool.h>
+#include <util/timing.h>
+#include <util/util.h>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <complex>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <random>
+#include <string>
+#include <thread>
+
+namespace {
+
+ocean::surface_params default_params(int fft_size)
+{
+    auto params = ocean::surface_params::get_defaults();
+    params.fft_size = math::ivec2(fft_size, fft_size);
+    params.num_cascades = 1;
+    params.transition_time = 0; // Unlike the demo, changes apply at once.
+    params.backend = ocean::SIMULATION_BACKEND_HOST;
+    return params;
+}
+
+// Largest difference of any channel of two RGBA8 maps.
+int max_texel_difference(
+    const std::vector<ocean::host_simulation::texel> &a,
+    const std::vector<ocean::host_simulation::texel> &b)
+{
+    int res = 0;
+    for (size_t i = 0; i < a.size(); ++i)
+        for (int shift = 0; shift < 32; shift += 8)
+            res = std::max(res, std::abs(int((a[i] >> shift) & 0xff) - int((b[i] >> shift) & 0xff)));
+    return res;
+}
+
+// The OpenCL pipeline of surface_geometry, exporting to plain images instead
+// of shared GL textures.
+struct opencl_pipeline {
+    typedef ocean::host_simulation::texel texel;
+
+    opencl_pipeline(gpu::compute::command_queue queue, const ocean::surface_params &params)
+        : queue(queue)
+        , N(params.fft_size.x)
+        , M(params.fft_size.y)
+        , wave_spectrum(queue.getInfo<CL_QUEUE_CONTEXT>(), params)
+    {
+        auto context = queue.getInfo<CL_QUEUE_CONTEXT>();
+        size_t buffer_size;
+        if (params.packed_fft) {
+            const int batches = ocean::spectrum::get_num_packed_output_fields(params);
+            packed_fft_algorithm.reset(
+                new gpu::fft::ifft2d_complex_inplace(queue, params.fft_size, batches));
+            buffer_size = batches * 2 * size_t(N) * M * sizeof(float);
+        } else {
+            const int batches = ocean::spectrum::get_num_output_fields(params);
+            fft_algorithm.reset(
+                new gpu::fft::ifft2d_hermitian_inplace(queue, params.fft_size, batches));
+            buffer_size = batches * size_t(N + 2) * M * sizeof(float);
+        }
+        fft_buffer = gpu::compute::buffer(context, CL_MEM_READ_WRITE, buffer_size);
+
+        const gpu::compute::image_format format(CL_RGBA, CL_UNORM_INT8);
+        displacement_img = gpu::compute::image(context, CL_MEM_WRITE_ONLY, format, N, M);
+        normal_img = gpu::compute::image(context, CL_MEM_WRITE_ONLY, format, N, M);
+        auto program = gpu::compute::create_program_from_file(
+            context, "kernels/export_to_texture.cl",
+            ocean::spectrum::get_kernel_build_options(params));
+        export_kernel = gpu::compute::kernel(
+            program, params.packed_fft ? "export_to_texture_packed" : "export_to_texture");
+        export_kernel.setArg(0, fft_buffer);
+        export_kernel.setArg(1, N);
+        export_kernel.setArg(2, M);
+        export_kernel.setArg(3, displacement_img);
+        export_kernel.setArg(4, normal_img);
+        export_kernel.setArg(5, 0);
+        export_kernel.setArg(6, 1.0f);
+    }
+
+    // Simulates the frame at time and waits for it.
+    void run(math::real time)
+    {
+        event_spectrum = wave_spectrum.enqueue_generate(queue, time, fft_buffer);
+        auto event_vector_spectrum = gpu::compute::event_vector({ event_spectrum });
+        if (packed_fft_algorithm)
+            event_fft =
+                packed_fft_algorithm->enqueue_transform(queue, fft_buffer, &event_vector_spectrum);
+        else
+            event_fft = fft_algorithm->enqueue_transform(queue, fft_buffer, &event_vector_spectrum);
+        auto event_vector_export = gpu::compute::event_vector({ event_fft });
+        // Same launch configuration as surface_geometry.
+        queue.enqueueNDRangeKernel(
+            export_kernel, gpu::compute::nd_range(0, 0), gpu::compute::nd_range(N, M),
+            gpu::compute::nd_range(1, 1), &event_vector_export, &event_export);
+        event_export.wait();
+    }
+
+    // The maps of the last frame, laid out like those of host_simulation.
+    void read_maps(std::vector<texel> &displacement_map, std::vector<texel> &normal_map)
+    {
+        displacement_map.resize(size_t(N) * M);
+        normal_map.resize(size_t(N) * M);
+        const std::array<size_t, 3> origin = { { 0, 0, 0 } };
+        const std::array<size_t, 3> region = { { size_t(N), size_t(M), 1 } };
+        queue.enqueueReadImage(
+            displacement_img, CL_TRUE, origin, region, 0, 0, displacement_map.data());
+        queue.enqueueReadImage(normal_img, CL_TRUE, origin, region, 0, 0, normal_map.data());
+    }
+
+    gpu::compute::command_queue queue;
+    int N, M;
+    ocean::spectrum wave_spectrum;
+    std::unique_ptr<gpu::fft::ifft2d_hermitian_inplace> fft_algorithm;
+    std::unique_ptr<gpu::fft::ifft2d_complex_inplace> packed_fft_algorithm;
+    gpu::compute::buffer fft_buffer;
+    gpu::compute::image displacement_img, normal_img;
+    gpu::compute::kernel export_kernel;
+    gpu::compute::event event_spectrum, event_fft, event_export;
+};
+
+// Largest and mean angle between the normals of two RGBA8 normal maps, in
+// degrees.
+struct normal_angles {
+    double max;
+    double mean;
+};
+normal_angles get_normal_angles(
+    const std::vector<ocean::host_simulation::texel> &a,
+    const std::vector<ocean::host_simulation::texel> &b)
+{
+    const auto decode = [](ocean::host_simulation::texel t) {
+        return math::normalize(
+            math::vec3(t & 0xff, (t >> 8) & 0xff, (t >> 16) & 0xff) / math::real(127.5) -
+            math::vec3(1, 1, 1));
+    };
+    normal_angles res = { 0, 0 };
+    for (size_t i = 0; i < a.size(); ++i) {
+        const double c = math::dot(decode(a[i]), decode(b[i]));
+        const double angle = std::acos(std::min(std::max(c, -1.0), 1.0)) * 180 / M_PI;
+        res.max = std::max(res.max, angle);
+        res.mean += angle;
+    }
+    res.mean /= std::max(a.size(), size_t(1));
+    return res;
+}
+
+// Runs the host simulation with all nine fields and with reduced fields and
+// compares the maps at a few points in time.
+int compare_reduced_fields(const ocean::surface_params &params, const ocean::spectrum &wave_spectrum)
+{
+    auto full_params = params;
+    full_params.reduced_fields = false;
+    auto reduced_params = params;
+    reduced_params.reduced_fields = true;
+
+    auto &pool = util::default_thread_pool();
+    ocean::host_simulation full(pool, full_params), reduced(pool, reduced_params);
+    int res = 0;
+    for (int i = 0; i < 4; ++i) {
+        const math::real time = ocean::spectrum::period * i / 4 + math::real(0.3);
+        full.generate(wave_spectrum, time);
+        reduced.generate(wave_spectrum, time);
+        res = std::max(res, max_texel_difference(full.get_normal_map(), reduced.get_normal_map()));
+        res = std::max(
+            res, max_texel_difference(full.get_displacement_map(), reduced.get_displacement_map()));
+    }
+    return res;
+}
+
+// Same for the OpenCL pipeline, which has the REDUCED_FIELDS variants of the
+// kernels: reduced fields, and reduced fields packed into complex transforms,
+// against all nine fields.
+int compare_opencl_reduced_fields(
+    gpu::compute::command_queue queue,
+    const ocean::surface_params &params)
+{
+    auto full_params = params;
+    full_params.backend = ocean::SIMULATION_BACKEND_OPENCL;
+    full_params.reduced_fields = false;
+    full_params.packed_fft = false;
+    auto reduced_params = full_params;
+    reduced_params.reduced_fields = true;
+    auto packed_params = reduced_params;
+    packed_params.packed_fft = true;
+
+    opencl_pipeline full(queue, full_params), reduced(queue, reduced_params),
+        packed(queue, packed_params);
+    std::vector<opencl_pipeline::texel> full_displacement, full_normal, displacement, normal;
+    int res = 0;
+    for (int i = 0; i < 4; ++i) {
+        const math::real time = ocean::spectrum::period * i / 4 + math::real(0.3);
+        full.run(time);
+        full.read_maps(full_displacement, full_normal);
+        for (auto *pipeline : { &reduced, &packed }) {
+            pipeline->run(time);
+            pipeline->read_maps(displacement, normal);
+            res = std::max(res, max_texel_difference(full_normal, normal));
+            res = std::max(res, max_texel_difference(full_displacement, displacement));
+        }
+    }
+    return res;
+}
+
+// Phase shift timings and the reduced field check.
+int run_simulation_benchmark(int fft_size, int frames)
+{
+    const auto params = default_params(fft_size);
+    ocean::spectrum wave_spectrum(gpu::compute::context(), params);
+    ocean::host_phase_shift phase_shift(params);
+    auto &pool = util::default_thread_pool();
+    std::vector<math::real> output(
+        ocean::spectrum::get_num_output_fields(params) * size_t(fft_size + 2) * fft_size);
+
+    util::cpu_timer timer;
+    const math::real dt = math::real(1) / 60;
+
+    // Phase shift reading the tables built by spectrum::rebuild.
+    timer.start();
+    for (int i = 0; i < frames; ++i)
+        phase_shift.apply(pool, wave_spectrum, i * dt, output.data());
+    const double cached_ms = timer.stop_and_get_milliseconds() / frames;
+
+    // Rebuilding the tables every frame, which is what the phase shift used to
+    // pay for the sqrt, the dispersion relation and the wave vectors.
+    timer.start();
+    for (int i = 0; i < frames; ++i) {
+        auto tables = ocean::spectrum::build_wave_tables(params);
+        (void)tables;
+    }
+    const double tables_ms = timer.stop_and_get_milliseconds() / frames;
+
+    std::cout << "fft size:              " << fft_size << "x" << fft_size << std::endl;
+    std::cout << "threads:               " << pool.get_num_threads() << std::endl;
+    std::cout << "instruction set:       "
+              << cpu::simd::get_instruction_set_name(phase_shift.get_instruction_set()) << std::endl;
+    std::cout << "phase shift:           " << cached_ms << " ms/frame" << std::endl;
+    std::cout << "wave table rebuild:    " << tables_ms << " ms/frame (saved)" << std::endl;
+
+    // Reduced fields have to give the same maps as all nine fields.
+    const int reduced_difference = compare_reduced_fields(params, wave_spectrum);
+    std::cout << "reduced fields:        max. difference " << reduced_difference << "/255"
+              << std::endl;
+    if (reduced_difference > 1) {
+        std::cerr << "error: reduced fields do not match the full pipeline." << std::endl;
+        return 1;
+    }
+
+    // The same for the kernels, when there is a device to run them on.
+    if (!gpu::compute::has_device()) {
+        std::cout << "reduced fields opencl: skipped, no OpenCL device" << std::endl;
+        return 0;
+    }
+    const int opencl_difference =
+        compare_opencl_reduced_fields(gpu::compute::init_headless(), params);
+    std::cout << "reduced fields opencl: max. difference " << opencl_difference << "/255"
+              << std::endl;
+    if (opencl_difference > 1) {
+        std::cerr << "error: reduced OpenCL fields do not match the full pipeline." << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+// Random half spectra in the layout of ifft2d_hermitian_inplace. Columns 0 and
+// size.x / 2 are made hermitian themselves, so that the spectra are those of
+// real samples.
+std::vector<math::real> get_random_half_spectra(const math::ivec2 &size, int num_batches)
+{
+    const int N = size.x, M = size.y;
+    const size_t batch_stride = size_t(N + 2) * M;
+    std::vector<math::real> res(num_batches * batch_stride);
+    std::mt19937 generator(1);
+    std::uniform_real_distribution<math::real> distribution(-1, 1);
+    for (auto &x : res)
+        x = distribution(generator);
+
+    for (int b = 0; b < num_batches; ++b) {
+        auto *batch = reinterpret_cast<cpu::fft::complex *>(res.data() + b * batch_stride);
+        for (int k_x : { 0, N / 2 }) {
+            for (int k_z = 0; k_z <= M / 2; ++k_z) {
+                auto &h = batch[k_z * (N / 2 + 1) + k_x];
+                if (k_z == 0 || k_z == M / 2)
+                    h = h.real();
+                else
+                    batch[(M - k_z) * (N / 2 + 1) + k_x] = std::conj(h);
+            }
+        }
+    }
+    return res;
+}
+
+// Real samples of the half spectra, size.x by size.y per batch, by a naive
+// double precision DFT.
+std::vector<double> get_reference_samples(
+    const std::vector<math::real> &half_spectra,
+    const math::ivec2 &size,
+    int num_batches)
+{
+    typedef std::complex<double> complex;
+    const int N = size.x, M = size.y;
+    const size_t batch_stride = size_t(N + 2) * M;
+    std::vector<complex> twiddles_x(N), twiddles_z(M);
+    for (int i = 0; i < N; ++i)
+        twiddles_x[i] = std::polar(1.0, 2 * M_PI * i / N);
+    for (int i = 0; i < M; ++i)
+        twiddles_z[i] = std::polar(1.0, 2 * M_PI * i / M);
+
+    std::vector<double> res(size_t(num_batches) * N * M);
+    std::vector<complex> spectrum(size_t(N) * M);
+    for (int b = 0; b < num_batches; ++b) {
+        const math::real *half = half_spectra.data() + b * batch_stride;
+        for (int k_z = 0; k_z < M; ++k_z) {
+            for (int k_x = 0; k_x <= N / 2; ++k_x) {
+                const size_t idx = 2 * (size_t(k_z) * (N / 2 + 1) + k_x);
+                const complex h(half[idx], half[idx + 1]);
+                spectrum[size_t(k_z) * N + k_x] = h;
+                if (k_x != 0 && k_x != N / 2)
+                    spectrum[size_t((M - k_z) % M) * N + N - k_x] = std::conj(h);
+            }
+        }
+        for (int z = 0; z < M; ++z) {
+            for (int x = 0; x < N; ++x) {
+                complex sum = 0;
+                for (int k_z = 0; k_z < M; ++k_z)
+                    for (int k_x = 0; k_x < N; ++k_x)
+                        sum += spectrum[size_t(k_z) * N + k_x] *
+                            twiddles_x[(k_x * x) % N] * twiddles_z[(k_z * z) % M];
+                res[(size_t(b) * M + z) * N + x] = sum.real();
+            }
+        }
+    }
+    return res;
+}
+
+// Largest difference of the transformed samples from the reference, over the
+// largest reference sample.
+double get_relative_fft_error(
+    const std::vector<math::real> &samples,
+    const std::vector<double> &reference,
+    const math::ivec2 &size,
+    int num_batches)
+{
+    const int N = size.x, M = size.y;
+    double max_error = 0, max_magnitude = 0;
+    for (int b = 0; b < num_batches; ++b) {
+        for (int z = 0; z < M; ++z) {
+            for (int x = 0; x < N; ++x) {
+                const double expected = reference[(size_t(b) * M + z) * N + x];
+                const double actual = samples[(size_t(b) * M + z) * (N + 2) + x];
+                max_error = std::max(max_error, std::abs(actual - expected));
+                max_magnitude = std::max(max_magnitude, std::abs(expected));
+            }
+        }
+    }
+    return max_error / std::max(max_magnitude, 1.0);
+}
+
+// Checks ifft2d_hermitian_inplace with both column passes, and clFFT when there
+// is an OpenCL device, against the naive DFT on a few small non-square sizes.
+bool check_fft_accuracy(util::thread_pool &pool)
+{
+    const cpu::fft::column_pass passes[] = { cpu::fft::COLUMN_PASS_BLOCKED,
+                                              cpu::fft::COLUMN_PASS_TRANSPOSED };
+    const char *pass_names[] = { "blocked", "transposed" };
+    const math::ivec2 sizes[] = { math::ivec2(16, 8), math::ivec2(32, 64), math::ivec2(128, 16) };
+    const int num_batches = 2;
+    // A few float roundings per stage, far below a wrong twiddle or index.
+    const double tolerance = 1e-5;
+
+    gpu::compute::command_queue queue;
+    const bool has_opencl = gpu::compute::has_device();
+    if (has_opencl)
+        queue = gpu::compute::init_headless();
+
+    bool res = true;
+    for (const auto &size : sizes) {
+        const auto input = get_random_half_spectra(size, num_batches);
+        const auto reference = get_reference_samples(input, size, num_batches);
+        std::cout << size.x << "x" << size.y << " relative error:";
+        for (int p = 0; p < 2; ++p) {
+            auto samples = input;
+            cpu::fft::ifft2d_hermitian_inplace fft_algorithm(pool, size, num_batches, passes[p]);
+            fft_algorithm.transform(samples.data());
+            const double error = get_relative_fft_error(samples, reference, size, num_batches);
+            std::cout << " " << pass_names[p] << " " << error;
+            res = res && error <= tolerance;
+        }
+        if (has_opencl) {
+            auto samples = input;
+            const size_t buffer_size = samples.size() * sizeof(math::real);
+            gpu::compute::buffer buffer(
+                queue.getInfo<CL_QUEUE_CONTEXT>(), CL_MEM_READ_WRITE, buffer_size);
+            queue.enqueueWriteBuffer(buffer, CL_TRUE, 0, buffer_size, samples.data());
+            gpu::fft::ifft2d_hermitian_inplace fft_algorithm(queue, size, num_batches);
+            fft_algorithm.enqueue_transform(queue, buffer).wait();
+            queue.enqueueReadBuffer(buffer, CL_TRUE, 0, buffer_size, samples.data());
+            const double error = get_relative_fft_error(samples, reference, size, num_batches);
+            std::cout << " clfft " << error;
+            res = res && error <= tolerance;
+        }
+        std::cout << std::endl;
+    }
+    if (!has_opencl)
+        std::cout << "clfft: skipped, no OpenCL device" << std::endl;
+    return res;
+}
+
+// Accuracy and throughput of cpu::fft::ifft2d_hermitian_inplace with one batch
+// per field.
+int run_fft_benchmark(int frames)
+{
+    const int num_batches = ocean::spectrum::num_reduced_output_fields;
+    auto &pool = util::default_thread_pool();
+    util::cpu_timer timer;
+
+    if (!check_fft_accuracy(pool)) {
+        std::cerr << "error: the FFT does not match the reference DFT." << std::endl;
+        return 1;
+    }
+
+    const cpu::fft::column_pass passes[] = { cpu::fft::COLUMN_PASS_BLOCKED,
+                                              cpu::fft::COLUMN_PASS_TRANSPOSED };
+    const char *pass_names[] = { "blocked", "transposed" };
+
+    std::cout << "threads: " << pool.get_num_threads() << ", batches: " << num_batches << std::endl;
+    for (int fft_size = 256; fft_size <= 2048; fft_size *= 2) {
+        const math::ivec2 size(fft_size, fft_size);
+        std::vector<math::real> buffer(num_batches * size_t(fft_size + 2) * fft_size, 0);
+        for (int p = 0; p < 2; ++p) {
+            cpu::fft::ifft2d_hermitian_inplace fft_algorithm(pool, size, num_batches, passes[p]);
+
+            // Warm up once, larger sizes get fewer runs.
+            fft_algorithm.transform(buffer.data());
+            const int runs = std::max(1, frames * 256 / fft_size / 4);
+            timer.start();
+            for (int i = 0; i < runs; ++i)
+                fft_algorithm.transform(buffer.data());
+            const double ms = timer.stop_and_get_milliseconds() / runs;
+
+            // The usual 2.5 * n * log2(n) flop estimate of a real transform.
+            const double n = double(fft_size) * fft_size;
+            const double gflops = 2.5 * n * std::log2(n) * num_batches / (ms * 1e6);
+            std::cout << fft_size << "x" << fft_size << " " << pass_names[p] << ": " << ms
+                      << " ms, " << ms / num_batches << " ms/transform, " << gflops << " GFlop/s"
+                      << std::endl;
+        }
+    }
+    return 0;
+}
+
+// Two frames of the host simulation, dt apart, into the height field.
+void simulate_height_field(
+    const ocean::spectrum &wave_spectrum,
+    math::real dt,
+    ocean::host_simulation &simulation,
+    ocean::height_field &heights)
+{
+    for (int i = 0; i < 2; ++i) {
+        simulation.generate(wave_spectrum, 3 + i * dt);
+        const size_t row_stride = simulation.get_field_row_stride();
+        heights.update(
+            3 + i * dt, { simulation.get_field(0), 1, row_stride },
+            { simulation.get_field(1), 1, row_stride }, { simulation.get_field(2), 1, row_stride });
+    }
+}
+
+// Deterministic random numbers in [0, 1).
+class random_sequence {
+public:
+    explicit random_sequence(uint32_t seed) : seed(seed) {}
+    math::real next()
+    {
+        seed = seed * 1664525u + 1013904223u;
+        return math::real(seed >> 8) / math::real(1 << 24);
+    }
+
+private:
+    uint32_t seed;
+};
+
+// Height field queries: accuracy of the displacement inversion, agreement
+// of the SIMD and scalar paths, and throughput.
+int run_height_query_benchmark(int num_queries)
+{
+    const auto params = default_params(512);
+    ocean::spectrum wave_spectrum(gpu::compute::context(), params);
+    auto &pool = util::default_thread_pool();
+    ocean::host_simulation simulation(pool, params);
+    ocean::height_field heights(pool, params);
+
+    const math::real dt = math::real(1) / 60;
+    simulate_height_field(wave_spectrum, dt, simulation, heights);
+
+    // Querying the displaced position of a texel center has to give the
+    // height of that texel.
+    const int N = params.fft_size.x, M = params.fft_size.y;
+    const math::vec3 units_per_meter = params.tile_size_logical / params.tile_size_physical;
+    const math::vec2 cell_size(params.tile_size_logical.x / N, params.tile_size_logical.z / M);
+    std::vector<math::vec2> texel_points;
+    std::vector<math::real> expected_heights;
+    for (int j = 0; j < M; j += 5) {
+        for (int i = 0; i < N; i += 7) {
+            const size_t idx = j * simulation.get_field_row_stride() + i;
+            const math::vec2 p0 = math::vec2(i + math::real(0.5), j + math::real(0.5)) * cell_size;
+            const math::vec2 displacement(
+                simulation.get_field(0)[idx] * units_per_meter.x,
+                simulation.get_field(2)[idx] * units_per_meter.z);
+            texel_points.push_back(p0 + displacement);
+            expected_heights.push_back(simulation.get_field(1)[idx] * units_per_meter.y);
+        }
+    }
+    std::vector<math::real> texel_heights(texel_points.size());
+    heights.sample_heights(texel_points.data(), texel_points.size(), texel_heights.data());
+    math::real inversion_error = 0;
+    for (size_t i = 0; i < texel_heights.size(); ++i)
+        inversion_error =
+            std::max(inversion_error, std::abs(texel_heights[i] - expected_heights[i]));
+
+    // Random points over a few tiles.
+    std::vector<math::vec2> points(num_queries);
+    random_sequence random(12345);
+    const math::real extent = 4 * params.tile_size_logical.x;
+    for (auto &p : points)
+        p = math::vec2(random.next() - math::real(0.5), random.next() - math::real(0.5)) * extent;
+
+    const auto instruction_set = heights.get_instruction_set();
+    const cpu::simd::instruction_set sets[] = { cpu::simd::INSTRUCTION_SET_SCALAR,
+                                                instruction_set };
+    std::vector<math::real> result_heights[2];
+    std::vector<math::vec3> result_normals[2], result_velocities[2];
+    double milliseconds[2];
+    util::cpu_timer timer;
+    for (int s = 0; s < 2; ++s) {
+        heights.set_instruction_set(sets[s]);
+        result_heights[s].resize(num_queries);
+        result_normals[s].resize(num_queries);
+        result_velocities[s].resize(num_queries);
+        const int runs = 10;
+        timer.start();
+        for (int r = 0; r < runs; ++r)
+            heights.sample(
+                points.data(), points.size(), result_heights[s].data(),
+                result_normals[s].data(), result_velocities[s].data());
+        milliseconds[s] = timer.stop_and_get_milliseconds() / runs;
+    }
+    heights.set_instruction_set(instruction_set);
+
+    math::real simd_difference = 0;
+    for (int i = 0; i < num_queries; ++i) {
+        simd_difference =
+            std::max(simd_difference, std::abs(result_heights[0][i] - result_heights[1][i]));
+        const math::vec3 dn = result_normals[0][i] - result_normals[1][i];
+        const math::vec3 dv = result_velocities[0][i] - result_velocities[1][i];
+        simd_difference = std::max(simd_difference, std::sqrt(math::dot(dn, dn)));
+        simd_difference = std::max(simd_difference, std::sqrt(math::dot(dv, dv)) * dt);
+    }
+
+    std::cout << "fft size:              " << N << "x" << M << std::endl;
+    std::cout << "threads:               " << pool.get_num_threads() << std::endl;
+    std::cout << "queries:               " << num_queries << std::endl;
+    std::cout << "inversion error:       " << inversion_error << " units" << std::endl;
+    for (int s = 0; s < 2; ++s)
+        std::cout << cpu::simd::get_instruction_set_name(sets[s]) << ": " << milliseconds[s]
+                  << " ms, " << num_queries / (milliseconds[s] * 1e3) << " Mqueries/s" << std::endl;
+    std::cout << "SIMD vs. scalar:       max. difference " << simd_difference << std::endl;
+
+    // Heights are a few units, the texel size is 0.2 units.
+    if (inversion_error > math::real(0.05) || simd_difference > math::real(1e-3)) {
+        std::cerr << "error: height field queries are inaccurate." << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// Ray queries: the pyramid walk against marching every ray, for rays from
+// above the surface in all directions down to grazing ones.
+int run_ray_query_benchmark(int num_rays)
+{
+    const auto params = default_params(512);
+    ocean::spectrum wave_spectrum(gpu::compute::context(), params);
+    auto &pool = util::default_thread_pool();
+    ocean::host_simulation simulation(pool, params);
+    ocean::height_field heights(pool, params);
+    simulate_height_field(wave_spectrum, math::real(1) / 60, simulation, heights);
+
+    std::vector<math::vec3> origins(num_rays), directions(num_rays);
+    random_sequence random(54321);
+    const math::real extent = 2 * params.tile_size_logical.x;
+    for (int i = 0; i < num_rays; ++i) {
+        origins[i] = math::vec3(
+            (random.next() - math::real(0.5)) * extent, 2 + 20 * random.next(),
+            (random.next() - math::real(0.5)) * extent);
+        const math::real azimuth = math::two_pi * random.next();
+        const math::real elevation = -math::half_pi * random.next() * random.next();
+        directions[i] = math::vec3(
+            glm::cos(elevation) * glm::cos(azimuth), glm::sin(elevation),
+            glm::cos(elevation) * glm::sin(azimuth));
+    }
+    const math::real max_distance = 200;
+
+    std::vector<ocean::height_field::ray_hit> hits(num_rays), reference(num_rays);
+    util::cpu_timer timer;
+    timer.start();
+    heights.intersect(origins.data(), directions.data(), num_rays, max_distance, hits.data());
+    const double pyramid_milliseconds = timer.stop_and_get_milliseconds();
+    timer.start();
+    heights.intersect_brute_force(
+        origins.data(), directions.data(), num_rays, max_distance, reference.data());
+    const double brute_force_milliseconds = timer.stop_and_get_milliseconds();
+
+    int num_hits = 0, num_mismatches = 0;
+    math::real max_distance_difference = 0;
+    for (int i = 0; i < num_rays; ++i) {
+        const bool is_hit = hits[i].distance >= 0;
+        num_hits += is_hit;
+        if (is_hit != (reference[i].distance >= 0)) {
+            ++num_mismatches;
+            continue;
+        }
+        if (is_hit)
+            max_distance_difference = std::max(
+                max_distance_difference, std::abs(hits[i].distance - reference[i].distance));
+    }
+
+    std::cout << "fft size:              " << params.fft_size.x << "x" << params.fft_size.y
+              << std::endl;
+    std::cout << "threads:               " << pool.get_num_threads() << std::endl;
+    std::cout << "rays:                  " << num_rays << ", " << num_hits << " hits" << std::endl;
+    std::cout << "pyramid:               " << pyramid_milliseconds << " ms, "
+              << num_rays / (pyramid_milliseconds * 1e3) << " Mrays/s" << std::endl;
+    std::cout << "brute force:           " << brute_force_milliseconds << " ms, "
+              << num_rays / (brute_force_milliseconds * 1e3) << " Mrays/s" << std::endl;
+    std::cout << "mismatches:            " << num_mismatches << ", max. distance difference "
+              << max_distance_difference << std::endl;
+
+    // Grazing rays may graze a crest in one and miss it in the other, where
+    // the march steps fall differently.
+    if (num_mismatches > num_rays / 1000 || max_distance_difference > math::real(0.1)) {
+        std::cerr << "error: the pyramid walk does not match brute force." << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// Spectrum rebuild: the noise drawn once and the envelope applied on every
+// wind change, timed per instruction set, with results that do not depend on
+// the thread count or (beyond rounding) on the instruction set. Then the
+// blend to a new wind: what the frame waits for and the blended spectrum
+// halfway through.
+int run_rebuild_benchmark(int fft_size)
+{
+    const auto params = default_params(fft_size);
+    ocean::spectrum wave_spectrum(gpu::compute::context(), params);
+    auto &pool = util::default_thread_pool();
+    const auto instruction_set = wave_spectrum.get_instruction_set();
+    const cpu::simd::instruction_set sets[] = { cpu::simd::INSTRUCTION_SET_SCALAR,
+                                                instruction_set };
+
+    std::cout << "fft size:              " << fft_size << "x" << fft_size << std::endl;
+    std::cout << "threads:               " << pool.get_num_threads() << std::endl;
+    ocean::spectrum::host_data results[2];
+    util::cpu_timer timer;
+    for (int s = 0; s < 2; ++s) {
+        wave_spectrum.set_instruction_set(sets[s]);
+        const int runs = 5;
+        timer.start();
+        for (int r = 0; r < runs; ++r)
+            wave_spectrum.draw_noise();
+        const double noise_ms = timer.stop_and_get_milliseconds() / runs;
+        timer.start();
+        for (int r = 0; r < runs; ++r) {
+            wave_spectrum.rebuild();
+            wave_spectrum.finish_transition();
+        }
+        const double envelope_ms = timer.stop_and_get_milliseconds() / runs;
+        std::cout << cpu::simd::get_instruction_set_name(sets[s]) << ": noise " << noise_ms
+                  << " ms (once), envelope " << envelope_ms << " ms (per wind change)"
+                  << std::endl;
+        results[s] = wave_spectrum.get_host_data();
+    }
+
+    // Called from inside the pool, the rows are generated serially.
+    pool.parallel_for(1, [&](int, int) {
+        wave_spectrum.draw_noise();
+        wave_spectrum.rebuild();
+        wave_spectrum.finish_transition();
+    });
+    const auto &serial = wave_spectrum.get_host_data();
+    const bool is_thread_independent = serial.re == results[1].re && serial.im == results[1].im;
+    wave_spectrum.set_instruction_set(instruction_set);
+
+    // Relative to the largest coefficient: the envelope falls off to
+    // denormals, where the rounding of either path dominates.
+    double max_magnitude = 0, max_difference = 0;
+    for (size_t i = 0; i < results[0].re.size(); ++i) {
+        const double re = results[0].re[i], im = results[0].im[i];
+        max_magnitude = std::max(max_magnitude, std::sqrt(re * re + im * im));
+        max_difference = std::max(
+            max_difference,
+            std::max(std::abs(re - results[1].re[i]), std::abs(im - results[1].im[i])));
+    }
+    const double simd_difference = max_difference / max_magnitude;
+    std::cout << "SIMD vs. scalar:       max. relative difference " << simd_difference
+              << std::endl;
+    std::cout << "serial vs. parallel:   " << (is_thread_independent ? "identical" : "different")
+              << std::endl;
+
+    if (!is_thread_independent || simd_difference > 1e-4) {
+        std::cerr << "error: the rebuilt spectra do not match." << std::endl;
+        return 1;
+    }
+
+    auto blend_params = params;
+    blend_params.transition_time = 1;
+    ocean::spectrum blended(gpu::compute::context(), blend_params);
+    const auto from = blended.get_host_data();
+    blended.set_wind_vector(math::vec2(0, 10));
+    timer.start();
+    blended.rebuild();
+    const double rebuild_call_ms = timer.stop_and_get_milliseconds();
+    // The blend starts at the first update after the target is built.
+    while (blended.get_transition_weight() == 1) {
+        std::this_thread::yield();
+        blended.update(0);
+    }
+    blended.update(math::real(0.5));
+    const auto halfway = blended.get_host_data();
+    blended.update(1);
+    const auto &to = blended.get_host_data();
+    double blend_difference = 0;
+    for (size_t i = 0; i < to.re.size(); ++i) {
+        const double re = 0.5 * (double(from.re[i]) + to.re[i]);
+        const double im = 0.5 * (double(from.im[i]) + to.im[i]);
+        blend_difference = std::max(
+            blend_difference,
+            std::max(std::abs(halfway.re[i] - re), std::abs(halfway.im[i] - im)));
+    }
+    std::cout << "wind change:           " << rebuild_call_ms << " ms on the frame" << std::endl;
+    std::cout << "halfway blend:         max. difference " << blend_difference << std::endl;
+
+    if (blend_difference > 1e-6) {
+        std::cerr << "error: the blended spectrum is off." << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// Significant wave height of the JONSWAP spectrum (and Pierson-Moskowitz,
+// for gamma = 1) from its parameters, DNV-RP-C205 (2010), eq. 3.5.5.
+double get_jonswap_reference_height(double alpha, double omega_p, double gamma, double g)
+{
+    const double a_gamma = 1 - 0.287 * std::log(gamma);
+    return 4 * g / (omega_p * omega_p) * std::sqrt(alpha / (5 * a_gamma));
+}
+
+// Significant wave height of the TMA spectrum by integrating the frequency
+// spectrum.
+double get_tma_reference_height(double alpha, double omega_p, double gamma, double depth, double g)
+{
+    double m0 = 0;
+    const double d_omega = 1e-4;
+    for (double omega = d_omega / 2; omega < 20; omega += d_omega) {
+        const double r = omega_p / omega;
+        const double sigma = (omega <= omega_p) ? 0.07 : 0.09;
+        const double d = (omega - omega_p) / (sigma * omega_p);
+        const double s = alpha * g * g * std::pow(omega, -5) * std::exp(-1.25 * std::pow(r, 4)) *
+                         std::pow(gamma, std::exp(-0.5 * d * d));
+        const double omega_h = omega * std::sqrt(depth / g);
+        const double phi = (omega_h <= 1) ? 0.5 * omega_h * omega_h
+                                          : (omega_h < 2) ? 1 - 0.5 * (2 - omega_h) * (2 - omega_h)
+                                                          : 1;
+        m0 += s * phi * d_omega;
+    }
+    return 4 * std::sqrt(m0);
+}
+
+// Spectrum models: the significant wave height of the discrete spectrum of
+// every model and spreading function against published references, the
+// height of a simulated surface, and the time to build the envelope.
+int run_spectra_benchmark(int fft_size)
+{
+    const double g = 9.80665;
+    auto params = default_params(fft_size);
+    // Large enough for the peak of the fully developed sea to be well inside.
+    params.tile_size_physical = math::vec3(2000, 2000, 2000);
+    params.wavelength_low_threshold = 0;
+    params.amplitude = 1;
+    const double U = params.wind_speed, F = params.fetch, gamma = params.peak_enhancement;
+    const double U_19_5 = 1.026 * U;
+    const double jonswap_alpha = 0.076 * std::pow(U * U / (F * g), 0.22);
+    const double jonswap_omega_p = 22 * std::cbrt(g * g / (U * F));
+
+    struct model_case {
+        const char *name;
+        ocean::spectrum_model model;
+        double reference; // Significant wave height, meters.
+    };
+    const model_case models[] = {
+        { "pierson-moskowitz", ocean::SPECTRUM_MODEL_PIERSON_MOSKOWITZ,
+          0.21 * U_19_5 * U_19_5 / g }, // Pierson and Moskowitz (1964).
+        { "jonswap", ocean::SPECTRUM_MODEL_JONSWAP,
+          get_jonswap_reference_height(jonswap_alpha, jonswap_omega_p, gamma, g) },
+        { "tma", ocean::SPECTRUM_MODEL_TMA,
+          get_tma_reference_height(jonswap_alpha, jonswap_omega_p, gamma, params.depth, g) },
+    };
+    const std::pair<const char *, ocean::directional_spreading> spreadings[] = {
+        { "cos^2", ocean::DIRECTIONAL_SPREADING_COSINE_SQUARED },
+        { "mitsuyasu", ocean::DIRECTIONAL_SPREADING_MITSUYASU },
+        { "donelan-banner", ocean::DIRECTIONAL_SPREADING_DONELAN_BANNER },
+    };
+
+    std::cout << "fft size:              " << fft_size << "x" << fft_size << ", "
+              << params.tile_size_physical.x << " m" << std::endl;
+    std::cout << "wind:                  " << U << " m/s, fetch " << F / 1000 << " km, depth "
+              << params.depth << " m" << std::endl;
+    auto &pool = util::default_thread_pool();
+    util::cpu_timer timer;
+    double max_error = 0;
+    for (const auto &m : models) {
+        for (const auto &s : spreadings) {
+            params.model = m.model;
+            params.spreading = s.second;
+            const double expected = ocean::spectrum::get_significant_wave_height(params);
+
+            ocean::spectrum wave_spectrum(gpu::compute::context(), params);
+            timer.start();
+            wave_spectrum.rebuild();
+            wave_spectrum.finish_transition();
+            const double envelope_ms = timer.stop_and_get_milliseconds();
+
+            ocean::host_simulation simulation(pool, params);
+            simulation.generate(wave_spectrum, 0);
+            const size_t row_stride = simulation.get_field_row_stride();
+            double sum = 0, sum_sqr = 0;
+            for (int z = 0; z < fft_size; ++z) {
+                for (int x = 0; x < fft_size; ++x) {
+                    const double h = simulation.get_field(1)[z * row_stride + x];
+                    sum += h;
+                    sum_sqr += h * h;
+                }
+            }
+            const double count = double(fft_size) * fft_size;
+            const double mean = sum / count;
+            const double simulated = 4 * std::sqrt(sum_sqr / count - mean * mean);
+
+            const double error = std::abs(expected - m.reference) / m.reference;
+            max_error = std::max(max_error, error);
+            std::cout << m.name << ", " << s.first << ": Hs " << expected << " m (reference "
+                      << m.reference << " m), simulated " << simulated << " m, envelope "
+                      << envelope_ms << " ms" << std::endl;
+        }
+    }
+
+    if (max_error > 0.05) {
+        std::cerr << "error: the significant wave heights are off." << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// Root mean square of the slope of the height of a host simulation.
+double get_rms_slope(const ocean::host_simulation &simulation, int fft_size)
+{
+    // ddy_du and ddy_dv, see kernels/phase_shift.cl.
+    const size_t row_stride = simulation.get_field_row_stride();
+    double sum_sqr = 0;
+    for (int z = 0; z < fft_size; ++z) {
+        for (int x = 0; x < fft_size; ++x) {
+            const double du = simulation.get_field(5)[z * row_stride + x];
+            const double dv = simulation.get_field(6)[z * row_stride + x];
+            sum_sqr += du * du + dv * dv;
+        }
+    }
+    return std::sqrt(sum_sqr / (double(fft_size) * fft_size));
+}
+
+// Cascades: the significant wave height of three cascades against one tile as
+// large as the first with the resolution of the last, which checks that the
+// bands neither overlap nor leave gaps, the slope the smaller cascades add to
+// the simulated surface, and the host simulation time of each cascade.
+int run_cascade_benchmark(int fft_size)
+{
+    const int num_cascades = 3;
+    const int frames = 20;
+    struct cascade_case {
+        const char *name;
+        ocean::spectrum_model model;
+        math::real tile_size; // Of the first cascade, meters.
+        math::real wavelength_low_threshold;
+    };
+    const cascade_case cases[] = {
+        { "phillips", ocean::SPECTRUM_MODEL_PHILLIPS, 200, math::real(0.7) },
+        { "jonswap", ocean::SPECTRUM_MODEL_JONSWAP, 2000, 0 },
+    };
+
+    std::cout << "fft size:              " << fft_size << "x" << fft_size << ", " << num_cascades
+              << " cascades" << std::endl;
+    auto &pool = util::default_thread_pool();
+    util::cpu_timer timer;
+    double max_error = 0;
+    for (const auto &c : cases) {
+        auto params = default_params(fft_size);
+        params.model = c.model;
+        params.tile_size_physical = math::vec3(c.tile_size, c.tile_size, c.tile_size);
+        params.wavelength_low_threshold = c.wavelength_low_threshold;
+        params.amplitude = 1;
+        params.num_cascades = num_cascades;
+
+        auto reference = params;
+        reference.num_cascades = 1;
+        const double last_ratio = ocean::spectrum::get_cascade_ratio(
+            ocean::spectrum::get_cascade_params(params, num_cascades - 1));
+        const int reference_size = 2 * int(std::ceil(fft_size * last_ratio / 2));
+        reference.fft_size = math::ivec2(reference_size, reference_size);
+        const double reference_height = ocean::spectrum::get_significant_wave_height(reference);
+
+        std::cout << c.name << ":" << std::endl;
+        double height_sqr = 0, slope_sqr = 0, first_slope = 0;
+        for (int i = 0; i < num_cascades; ++i) {
+            const auto cascade_params = ocean::spectrum::get_cascade_params(params, i);
+            const double height = ocean::spectrum::get_significant_wave_height(cascade_params);
+            height_sqr += height * height;
+
+            ocean::spectrum wave_spectrum(gpu::compute::context(), cascade_params);
+            ocean::host_simulation simulation(pool, cascade_params);
+            simulation.generate(wave_spectrum, 0);
+            const double slope = get_rms_slope(simulation, fft_size);
+            slope_sqr += slope * slope;
+            if (i == 0)
+                first_slope = slope;
+            const math::real dt = math::real(1) / 60;
+            timer.start();
+            for (int frame = 0; frame < frames; ++frame)
+                simulation.generate(wave_spectrum, frame * dt);
+            const double frame_ms = timer.stop_and_get_milliseconds() / frames;
+
+            // Wavelengths of the band, down to two samples for the last.
+            const auto band = ocean::spectrum::get_cascade_band(cascade_params);
+            const double tile = cascade_params.tile_size_physical.x;
+            const double longest = (band.x > 0) ? math::two_pi / band.x : tile;
+            const double shortest = (i + 1 < num_cascades) ? math::two_pi / band.y
+                                                           : 2 * tile / fft_size;
+            std::cout << "  cascade " << i << ": " << tile << " m tile, waves of " << shortest
+                      << " to " << longest << " m, Hs " << height << " m, rms slope " << slope
+                      << ", " << frame_ms << " ms per frame" << std::endl;
+        }
+
+        const double total_height = std::sqrt(height_sqr);
+        const double error = std::abs(total_height - reference_height) / reference_height;
+        max_error = std::max(max_error, error);
+        std::cout << "  total: Hs " << total_height << " m (one " << reference_size << "x"
+                  << reference_size << " tile: " << reference_height << " m), rms slope "
+                  << std::sqrt(slope_sqr) << " (first cascade alone: " << first_slope << ")"
+                  << std::endl;
+    }
+
+    if (max_error > 0.02) {
+        std::cerr << "error: the cascades do not add up to the single tile." << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// Recording: the cost of surface_recorder::append on the frame, frames
+// dropped while the writer catches up, and the round trip through each
+// storage format, with the spectrum parameters restored by the replay.
+int run_recording_benchmark(int frames)
+{
+    // Not the default spectrum, so that the replay has to restore it.
+    auto params = default_params(512);
+    params.model = ocean::SPECTRUM_MODEL_JONSWAP;
+    params.spreading = ocean::DIRECTIONAL_SPREADING_MITSUYASU;
+    ocean::spectrum wave_spectrum(gpu::compute::context(), params);
+    auto &pool = util::default_thread_pool();
+    ocean::host_simulation simulation(pool, params);
+    const std::string directory = util::get_cache_directory("bench");
+    const size_t row_stride = simulation.get_field_row_stride();
+    const math::real dt = math::real(1) / 60;
+
+    const ocean::recording_format formats[] = { ocean::RECORDING_FORMAT_FLOAT32,
+                                                ocean::RECORDING_FORMAT_FLOAT16,
+                                                ocean::RECORDING_FORMAT_UNORM8 };
+    const char *const format_names[] = { "float32", "float16", "unorm8" };
+    // Heights are a few meters: exact, half precision, half a quantization step.
+    const math::real tolerances[] = { math::real(1e-6), math::real(0.01), math::real(0.021) };
+    // The recorded normals are central differences over two cells, which
+    // flatten the waves near the shortest the grid holds; the simulation takes
+    // them from the exact derivatives of the spectrum. At 512x512 they differ
+    // by about 3.5 degrees on average and 32 at most.
+    const double max_normal_angle = 45, max_mean_normal_angle = 5;
+    bool is_accurate = true;
+    util::cpu_timer timer;
+    for (int f = 0; f < 3; ++f) {
+        const std::string path = directory + "/recording_" + format_names[f] + ".bin";
+        util::rolling_statistics append_milliseconds(frames);
+        int dropped;
+        {
+            ocean::surface_recorder recorder(path, params, formats[f]);
+            for (int i = 0; i < frames; ++i) {
+                simulation.generate(wave_spectrum, i * dt);
+                timer.start();
+                recorder.append(
+                    i * dt, { simulation.get_field(0), 1, row_stride },
+                    { simulation.get_field(1), 1, row_stride },
+                    { simulation.get_field(2), 1, row_stride });
+                append_milliseconds.add(timer.stop_and_get_milliseconds());
+            }
+            recorder.close();
+            dropped = recorder.get_num_dropped_frames();
+        }
+
+        // Simulate the recorded frames again and compare.
+        ocean::surface_replay replay(pool, path);
+        const auto &replay_params = replay.get_params();
+        const bool is_same_spectrum = replay_params.model == params.model &&
+            replay_params.spreading == params.spreading && replay_params.fetch == params.fetch &&
+            replay_params.peak_enhancement == params.peak_enhancement &&
+            replay_params.depth == params.depth;
+        const int N = params.fft_size.x, M = params.fft_size.y;
+        std::vector<float> values(size_t(N) * M);
+        std::vector<ocean::host_simulation::texel> displacement_map(values.size()),
+            normal_map(values.size());
+        math::real displacement_error = 0;
+        int texel_difference = 0;
+        normal_angles normal_error = { 0, 0 };
+        int num_checked = 0;
+        timer.start();
+        for (int i = 0; i < replay.get_num_frames(); ++i)
+            replay.sample(math::real(replay.get_frame_time(i)), displacement_map.data(),
+                          normal_map.data());
+        const double sample_milliseconds =
+            timer.stop_and_get_milliseconds() / replay.get_num_frames();
+        const int check_step = std::max(replay.get_num_frames() / 4, 1);
+        for (int i = 0; i < replay.get_num_frames(); i += check_step) {
+            const math::real time = math::real(replay.get_frame_time(i));
+            simulation.generate(wave_spectrum, time);
+            for (int c = 0; c < 3; ++c) {
+                replay.read_plane(i, ocean::recording_plane(ocean::RECORDING_PLANE_DX + c),
+                                  values.data());
+                // Quantized values are clamped like the textures.
+                const math::real *field = simulation.get_field(c);
+                const math::real limit = formats[f] == ocean::RECORDING_FORMAT_UNORM8
+                    ? math::real(5)
+                    : std::numeric_limits<math::real>::max();
+                for (int y = 0; y < M; ++y) {
+                    for (int x = 0; x < N; ++x) {
+                        const math::real expected =
+                            std::min(std::max(field[y * row_stride + x], -limit), limit);
+                        displacement_error = std::max(
+                            displacement_error, std::abs(values[size_t(y) * N + x] - expected));
+                    }
+                }
+            }
+            replay.sample(time, displacement_map.data(), normal_map.data());
+            texel_difference = std::max(
+                texel_difference,
+                max_texel_difference(displacement_map, simulation.get_displacement_map()));
+            const auto angles = get_normal_angles(normal_map, simulation.get_normal_map());
+            normal_error.max = std::max(normal_error.max, angles.max);
+            normal_error.mean += angles.mean;
+            ++num_checked;
+        }
+        normal_error.mean /= num_checked;
+        std::remove(path.c_str());
+
+        const auto append_summary = append_milliseconds.get_summary();
+        std::cout << format_names[f] << ": append mean " << append_summary.mean << " ms, max "
+                  << append_summary.max << " ms, "
+                  << replay.get_num_frames() << " frames written, " << dropped
+                  << " dropped, sample " << sample_milliseconds << " ms" << std::endl;
+        std::cout << "    max. displacement error " << displacement_error
+                  << " m, max. displacement map difference " << texel_difference << std::endl;
+        std::cout << "    normals: max. angle " << normal_error.max << " deg, mean "
+                  << normal_error.mean << " deg" << std::endl;
+        if (!is_same_spectrum)
+            std::cout << "    spectrum parameters not restored" << std::endl;
+        if (displacement_error > tolerances[f] || texel_difference > 1 || !is_same_spectrum ||
+            normal_error.max > max_normal_angle || normal_error.mean > max_mean_normal_angle)
+            is_accurate = false;
+    }
+
+    if (!is_accurate) {
+        std::cerr << "error: the recordings do not match the simulation." << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// Per-stage timings of one sweep configuration, in milliseconds.
+struct stage_samples {
+    util::rolling_statistics phase_shift, fft, export_maps, frame;
+
+    explicit stage_samples(int frames)
+        : phase_shift(frames), fft(frames), export_maps(frames), frame(frames)
+    {
+    }
+};
+
+// Work of one frame, for the throughput figures. The byte counts are the
+// least each stage has to read and write; the FFT is assumed to read and
+// write its buffer once per dimension.
+struct stage_work {
+    double phase_shift_bytes, fft_bytes, export_bytes;
+    double fft_flops;
+};
+
+stage_work get_stage_work(const ocean::surface_params &params)
+{
+    const double N = params.fft_size.x, M = params.fft_size.y;
+    const double half_spectrum = (N / 2 + 1) * M;
+    const double fields = ocean::spectrum::get_num_output_fields(params);
+    const double spectrum_in_bytes = half_spectrum * (2 + 4) * sizeof(float);
+    const double maps_bytes = 2 * N * M * sizeof(uint32_t);
+
+    stage_work res;
+    if (params.packed_fft) {
+        const double batches = ocean::spectrum::get_num_packed_output_fields(params);
+        const double buffer_bytes = batches * N * M * 2 * sizeof(float);
+        res.phase_shift_bytes = spectrum_in_bytes + buffer_bytes;
+        res.fft_bytes = 2 * 2 * buffer_bytes;
+        res.export_bytes = buffer_bytes + maps_bytes;
+        // The usual 5 * n * log2(n) flop estimate of a complex transform.
+        res.fft_flops = 5 * N * M * std::log2(N * M) * batches;
+    } else {
+        const double buffer_bytes = fields * (N + 2) * M * sizeof(float);
+        res.phase_shift_bytes = spectrum_in_bytes + fields * half_spectrum * 2 * sizeof(float);
+        res.fft_bytes = 2 * 2 * buffer_bytes;
+        res.export_bytes = fields * N * M * sizeof(float) + maps_bytes;
+        // Half of that for a real transform.
+        res.fft_flops = 2.5 * N * M * std::log2(N * M) * fields;
+    }
+    return res;
+}
+
+void write_stage_json(
+    std::ostream &out,
+    const char *name,
+    const util::rolling_statistics &samples,
+    double bytes,
+    double flops)
+{
+    auto summary = samples.get_summary();
+    out << "        \"" << name << "\": { \"mean_ms\": " << summary.mean
+        << ", \"p50_ms\": " << summary.p50 << ", \"p99_ms\": " << summary.p99
+        << ", \"gbytes_per_second\": " << bytes / (summary.mean * 1e6);
+    if (flops > 0)
+        out << ", \"gflops\": " << flops / (summary.mean * 1e6);
+    out << " }";
+}
+
+void write_result_json(
+    std::ostream &out,
+    const ocean::surface_params &params,
+    const stage_samples &samples,
+    bool is_first)
+{
+    const auto work = get_stage_work(params);
+    const int fft_batches = params.packed_fft
+                                ? ocean::spectrum::get_num_packed_output_fields(params)
+                                : ocean::spectrum::get_num_output_fields(params);
+    out << (is_first ? "" : ",\n") << "    {\n";
+    out << "      \"fft_size\": " << params.fft_size.x << ",\n";
+    out << "      \"fields\": " << ocean::spectrum::get_num_output_fields(params) << ",\n";
+    out << "      \"fft_layout\": \"" << (params.packed_fft ? "complex" : "hermitian") << "\",\n";
+    out << "      \"fft_batches\": " << fft_batches << ",\n";
+    out << "      \"frames_per_second\": " << 1000 / samples.frame.get_summary().mean << ",\n";
+    out << "      \"stages\": {\n";
+    write_stage_json(out, "phase_shift", samples.phase_shift, work.phase_shift_bytes, 0);
+    out << ",\n";
+    write_stage_json(out, "fft", samples.fft, work.fft_bytes, work.fft_flops);
+    out << ",\n";
+    write_stage_json(out, "export", samples.export_maps, work.export_bytes, 0);
+    out << "\n      }\n    }";
+}
+
+void run_host_frames(const ocean::surface_params &params, int frames, stage_samples &samples)
+{
+    ocean::spectrum wave_spectrum(gpu::compute::context(), params);
+    ocean::host_simulation simulation(util::default_thread_pool(), params);
+    const math::real dt = math::real(1) / 60;
+
+    simulation.generate(wave_spectrum, 0);
+    for (int i = 0; i < frames; ++i) {
+        simulation.generate(wave_spectrum, i * dt);
+        auto timings = simulation.get_timing_data();
+        samples.phase_shift.add(timings.phase_shift_milliseconds);
+        samples.fft.add(timings.fft_milliseconds);
+        samples.export_maps.add(timings.export_milliseconds);
+        samples.frame.add(
+            timings.phase_shift_milliseconds + timings.fft_milliseconds +
+            timings.export_milliseconds);
+    }
+}
+
+double get_elapsed_milliseconds(const gpu::compute::event &begin, const gpu::compute::event &end)
+{
+    int64_t begin_ns = begin.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+    int64_t end_ns = end.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+    return (end_ns - begin_ns) * 1e-6;
+}
+
+void run_opencl_frames(
+    gpu::compute::command_queue queue,
+    const ocean::surface_params &params,
+    int frames,
+    stage_samples &samples)
+{
+    opencl_pipeline pipeline(queue, params);
+    const math::real dt = math::real(1) / 60;
+    for (int i = -1; i < frames; ++i) {
+        pipeline.run(std::max(i, 0) * dt);
+
+        // The first frame is a warm-up.
+        if (i < 0)
+            continue;
+        samples.phase_shift.add(
+            get_elapsed_milliseconds(pipeline.event_spectrum, pipeline.event_spectrum));
+        samples.fft.add(get_elapsed_milliseconds(pipeline.event_fft, pipeline.event_fft));
+        samples.export_maps.add(
+            get_elapsed_milliseconds(pipeline.event_export, pipeline.event_export));
+        samples.frame.add(get_elapsed_milliseconds(pipeline.event_spectrum, pipeline.event_export));
+    }
+}
+
+// Runs every combination of FFT size and field layout and prints the
+// per-stage throughput as JSON.
+int run_sweep(const std::string &backend, int frames)
+{
+    const bool is_opencl = backend == "opencl";
+    if (!is_opencl && backend != "host") {
+        std::cerr << "error: unknown backend " << backend << "." << std::endl;
+        return 1;
+    }
+    frames = std::max(frames, 1);
+
+    gpu::compute::command_queue queue;
+    std::string device_name = "host";
+    if (is_opencl) {
+        queue = gpu::compute::init_headless();
+        device_name = queue.getInfo<CL_QUEUE_DEVICE>().getInfo<CL_DEVICE_NAME>();
+    }
+
+    std::cout << "{\n";
+    std::cout << "  \"backend\": \"" << backend << "\",\n";
+    std::cout << "  \"device\": \"" << device_name << "\",\n";
+    std::cout << "  \"threads\": " << util::default_thread_pool().get_num_threads() << ",\n";
+    std::cout << "  \"frames\": " << frames << ",\n";
+    std::cout << "  \"results\": [\n";
+
+    // Field layouts: all nine fields, reduced fields, and for OpenCL reduced
+    // fields packed in pairs into complex transforms.
+    struct layout {
+        bool reduced_fields;
+        bool packed_fft;
+    };
+    std::vector<layout> layouts = { { false, false }, { true, false } };
+    if (is_opencl)
+        layouts.push_back({ true, true });
+
+    bool is_first = true;
+    for (int fft_size = 128; fft_size <= 1024; fft_size *= 2) {
+        for (const auto &l : layouts) {
+            auto params = default_params(fft_size);
+            params.backend =
+                is_opencl ? ocean::SIMULATION_BACKEND_OPENCL : ocean::SIMULATION_BACKEND_HOST;
+            params.reduced_fields = l.reduced_fields;
+            params.packed_fft = l.packed_fft;
+
+            stage_samples samples(frames);
+            if (is_opencl)
+                run_opencl_frames(queue, params, frames, samples);
+            else
+                run_host_frames(params, frames, samples);
+            write_result_json(std::cout, params, samples, is_first);
+            is_first = false;
+        }
+    }
+
+    std::cout << "\n  ]\n}" << std::endl;
+    return 0;
+}
+
+} // unnamed namespace
+
+int main(int argc, char *argv[])
+{
+    // Check command line args.
+    const bool fft_mode = argc > 1 && std::string(argv[1]) == "fft";
+    const bool sweep_mode = argc > 1 && std::string(argv[1]) == "sweep";
+    const bool heights_mode = argc > 1 && std::string(argv[1]) == "heights";
+    const bool rays_mode = argc > 1 && std::string(argv[1]) == "rays";
+    const bool record_mode = argc > 1 && std::string(argv[1]) == "record";
+    const bool rebuild_mode = argc > 1 && std::string(argv[1]) == "rebuild";
+    const bool spectra_mode = argc > 1 && std::string(argv[1]) == "spectra";
+    const bool cascades_mode = argc > 1 && std::string(argv[1]) == "cascades";
+    if (argc > (sweep_mode ? 4 : 3)) {
+        std::cerr << "usage: " << argv[0] << " [fft_size] [frames]" << std::endl;
+        std::cerr << "       " << argv[0] << " fft [frames]" << std::endl;
+        std::cerr << "       " << argv[0] << " sweep [host|opencl] [frames]" << std::endl;
+        std::cerr << "       " << argv[0] << " heights [queries]" << std::endl;
+        std::cerr << "       " << argv[0] << " rays [rays]" << std::endl;
+        std::cerr << "       " << argv[0] << " record [frames]" << std::endl;
+        std::cerr << "       " << argv[0] << " rebuild [fft_size]" << std::endl;
+        std::cerr << "       " << argv[0] << " spectra [fft_size]" << std::endl;
+        std::cerr << "       " << argv[0] << " cascades [fft_size]" << std::endl;
+        return 1;
+    }
+    if (fft_mode)
+        return run_fft_benchmark((argc > 2) ? atoi(argv[2]) : 20);
+    if (rays_mode)
+        return run_ray_query_benchmark((argc > 2) ? atoi(argv[2]) : 10000);
+    if (record_mode)
+        return run_recording_benchmark((argc > 2) ? atoi(argv[2]) : 60);
+    if (rebuild_mode)
+        return run_rebuild_benchmark((argc > 2) ? atoi(argv[2]) : 2048);
+    if (spectra_mode)
+        return run_spectra_benchmark((argc > 2) ? atoi(argv[2]) : 512);
+    if (cascades_mode)
+        return run_cascade_benchmark((argc > 2) ? atoi(argv[2]) : 256);
+    if (heights_mode)
+        return run_height_query_benchmark((argc > 2) ? atoi(argv[2]) : 100000);
+    if (sweep_mode)
+        return run_sweep((argc > 2) ? argv[2] : "host", (argc > 3) ? atoi(argv[3]) : 50);
+
+    const int fft_size = (argc > 1) ? atoi(argv[1]) : 512;
+    const int frames = (argc > 2) ? atoi(argv[2]) : 100;
+    return run_simulation_benchmark(fft_size, frames);
+}
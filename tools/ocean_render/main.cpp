@@ -0,0 +1,237 @@
+#include <api/os/window.h>
+#include <rendering/framebuffer.h>
+#include <rendering/pixel_readback.h>
+#include <rendering/rendering_params.h>
+#include <scene/ocean_scene.h>
+#include <util/error.h>
+#include <util/timing.h>
+#include <util/util.h>
+#include <IL/il.h>
+#include <iostream>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+enum output_format { OUTPUT_FORMAT_PNG, OUTPUT_FORMAT_RAW };
+
+// Encodes and writes frames on a background thread, so that encoding overlaps
+// rendering. Raw frames are RGB8, bottom row first.
+class frame_writer {
+public:
+    frame_writer(int width, int height, output_format format, const std::string &directory)
+        : width(width)
+        , height(height)
+        , format(format)
+        , directory(directory)
+        , num_written(0)
+        , is_finished(false)
+    {
+        ilInit();
+        thread = std::thread(&frame_writer::writer_main, this);
+    }
+    ~frame_writer()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            is_finished = true;
+        }
+        queue_changed.notify_all();
+        thread.join();
+    }
+    frame_writer(const frame_writer &) = delete;
+    frame_writer &operator=(const frame_writer &) = delete;
+
+    // Copies the frame, waits while too many frames are queued already.
+    void write(const uint8_t *pixels)
+    {
+        std::vector<uint8_t> frame(pixels, pixels + size_t(width) * height * 3);
+        std::unique_lock<std::mutex> lock(mutex);
+        queue_changed.wait(lock, [this] { return frames.size() < max_queued_frames; });
+        frames.push_back(std::move(frame));
+        queue_changed.notify_all();
+    }
+
+private:
+    static constexpr size_t max_queued_frames = 8;
+
+    void writer_main()
+    {
+        for (;;) {
+            std::vector<uint8_t> frame;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                queue_changed.wait(lock, [this] { return is_finished || !frames.empty(); });
+                if (frames.empty())
+                    return;
+                frame = std::move(frames.front());
+                frames.pop_front();
+            }
+            queue_changed.notify_all();
+            write_frame(num_written++, frame);
+        }
+    }
+
+    void write_frame(int index, const std::vector<uint8_t> &pixels)
+    {
+        char file_name[32];
+        snprintf(
+            file_name, sizeof(file_name), "frame_%05d.%s", index,
+            format == OUTPUT_FORMAT_PNG ? "png" : "raw");
+        const std::string path = directory + "/" + file_name;
+
+        if (format == OUTPUT_FORMAT_RAW) {
+            FILE *file = fopen(path.c_str(), "wb");
+            if (!file || fwrite(pixels.data(), 1, pixels.size(), file) != pixels.size())
+                std::cerr << "error: cannot write " << path << "." << std::endl;
+            if (file)
+                fclose(file);
+            return;
+        }
+
+        ILuint img;
+        ilGenImages(1, &img);
+        ilBindImage(img);
+        ilTexImage(
+            width, height, 1, 3, IL_RGB, IL_UNSIGNED_BYTE, const_cast<uint8_t *>(pixels.data()));
+        std::remove(path.c_str());
+        if (!ilSaveImage(path.c_str()))
+            std::cerr << "error: cannot write " << path << "." << std::endl;
+        ilDeleteImages(1, &img);
+    }
+
+    int width, height;
+    output_format format;
+    std::string directory;
+    int num_written;
+
+    std::mutex mutex;
+    std::condition_variable queue_changed;
+    std::deque<std::vector<uint8_t>> frames;
+    bool is_finished;
+    std::thread thread;
+};
+
+// Single-sample color target the multisampled scene is resolved into.
+class color_target {
+public:
+    color_target(int width, int height)
+    {
+        glGenFramebuffers(1, &fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glGenRenderbuffers(1, &color_rb);
+        glBindRenderbuffer(GL_RENDERBUFFER, color_rb);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGB8, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color_rb);
+        GL_CHECK();
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            DIE("Framebuffer is incomplete.\n");
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+    ~color_target()
+    {
+        glDeleteFramebuffers(1, &fbo);
+        glDeleteRenderbuffers(1, &color_rb);
+    }
+    color_target(const color_target &) = delete;
+    color_target &operator=(const color_target &) = delete;
+
+    gpu::graphics::framebuffer fbo;
+    gpu::graphics::renderbuffer color_rb;
+};
+
+} // unnamed namespace
+
+int main(int argc, char *argv[])
+{
+    // Check command line args.
+    if (argc > 6) {
+        std::cerr << "usage: " << argv[0] << " [frames] [width] [height] [output_dir] [png|raw]"
+                  << std::endl;
+        return 1;
+    }
+    const int frames = (argc > 1) ? atoi(argv[1]) : 300;
+    const int width = (argc > 2) ? atoi(argv[2]) : 1280;
+    const int height = (argc > 3) ? atoi(argv[3]) : 720;
+    const std::string output_dir = (argc > 4) ? argv[4] : "frames";
+    const std::string format_name = (argc > 5) ? argv[5] : "png";
+    if (frames <= 0 || width <= 0 || height <= 0 ||
+        (format_name != "png" && format_name != "raw")) {
+        std::cerr << "error: invalid arguments." << std::endl;
+        return 1;
+    }
+    const output_format format = format_name == "png" ? OUTPUT_FORMAT_PNG : OUTPUT_FORMAT_RAW;
+    if (!util::make_directory(output_dir))
+        return 1;
+
+    // Create hidden window (this will initialize OpenGL).
+    os::window window("ocean render", util::extent(width, height), SDL_WINDOW_HIDDEN);
+
+    // Same as src/main.cpp.
+    rendering::rendering_params rendering_params;
+    rendering_params.texture_max_anisotropy = 2;
+    rendering_params.multisampling_sample_count = 4;
+    rendering_params.tile_size_pixels = math::vec2(4, 4);
+
+    auto ocean_params = ocean::surface_params::get_defaults();
+    ocean_params.transition_time = 0; // Frames are rendered at fixed times.
+    // A software GL has no OpenCL interop.
+    ocean_params.backend = ocean::SIMULATION_BACKEND_HOST;
+
+    scene::ocean_scene ocean_scene(gpu::compute::command_queue(), ocean_params, rendering_params);
+    auto &camera = ocean_scene.get_main_camera();
+    camera.set_viewport_size(util::extent(width, height));
+    gpu::graphics::set_viewport_size(width, height);
+
+    rendering::multisample_framebuffer framebuffer(
+        width, height, rendering_params.multisampling_sample_count);
+    color_target target(width, height);
+    rendering::pixel_readback readback(width, height);
+    util::cpu_timer timer;
+    double encode_wait_milliseconds = 0;
+    {
+        frame_writer writer(width, height, format, output_dir);
+        auto consume = [&](const uint8_t *pixels) {
+            util::cpu_timer wait_timer;
+            wait_timer.start();
+            writer.write(pixels);
+            encode_wait_milliseconds += wait_timer.stop_and_get_milliseconds();
+        };
+
+        // 30 frames per second of simulated time, the camera circles the
+        // origin once a minute.
+        timer.start();
+        const math::real dt = math::real(1) / 30;
+        for (int i = 0; i < frames; ++i) {
+            const math::real time = i * dt;
+            const math::real angle = math::two_pi * time / 60;
+            camera.set_position(math::vec3(30 * glm::sin(angle), 14, 30 * glm::cos(angle)));
+            camera.set_look_at(math::vec3(0, 1, 0));
+
+            window.begin_frame();
+            framebuffer.activate();
+            ocean_scene.render(time);
+            framebuffer.resolve_to(target.fbo);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, target.fbo);
+            readback.read(consume);
+
+            // Finish the gui frame of the scene on the hidden backbuffer.
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            window.end_frame();
+        }
+        readback.flush(consume);
+    }
+    const double total_milliseconds = timer.stop_and_get_milliseconds();
+
+    std::cout << "frames:          " << frames << " (" << width << "x" << height << ", "
+              << format_name << ")" << std::endl;
+    std::cout << "total:           " << total_milliseconds << " ms" << std::endl;
+    std::cout << "frames/s:        " << frames * 1000 / total_milliseconds << std::endl;
+    std::cout << "encoder stalls:  " << encode_wait_milliseconds << " ms" << std::endl;
+    return 0;
+}